@@ -0,0 +1,27 @@
+#ifndef SRC_BLAKE3_BATCH_H_
+#define SRC_BLAKE3_BATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Hashes num_inputs independent messages of block_len bytes each (block_len <= 64),
+ * several at a time in SIMD lanes.
+ *
+ * inputs = num_inputs * 64 bytes, each message zero padded to 64 bytes
+ * out = num_inputs * 32 bytes
+ *
+ * Output is identical to blake3_hasher_init() + blake3_hasher_update(block_len)
+ * + blake3_hasher_finalize(32) for every message.
+ */
+void blake3_hash_single_blocks(const uint8_t *inputs, size_t num_inputs, uint32_t block_len, uint8_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SRC_BLAKE3_BATCH_H_
@@ -0,0 +1,512 @@
+/*
+ * AsyncIO.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INCLUDE_CHIA_ASYNCIO_H_
+#define INCLUDE_CHIA_ASYNCIO_H_
+
+#include <chia/settings.h>
+
+#include <mutex>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define CHIA_IO_URING
+#endif
+#endif
+
+
+inline
+int open_file(const std::string& file_name, const bool write)
+{
+#ifdef _WIN32
+	const int fd = _open(file_name.c_str(),
+			_O_BINARY | (write ? _O_RDWR | _O_CREAT | _O_TRUNC : _O_RDONLY), _S_IREAD | _S_IWRITE);
+#else
+	const int fd = ::open(file_name.c_str(), write ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+#endif
+	if(fd < 0) {
+		throw std::runtime_error("open() failed with: " + std::string(std::strerror(errno)) + " (" + file_name + ")");
+	}
+	return fd;
+}
+
+inline
+void close_file(const int fd)
+{
+#ifdef _WIN32
+	_close(fd);
+#else
+	::close(fd);
+#endif
+}
+
+/*
+ * Positional read / write of exactly length bytes, throws on error or end of file.
+ */
+inline
+void pread_ex(const int fd, void* buf, size_t length, uint64_t offset)
+{
+	auto* dst = (uint8_t*)buf;
+	while(length) {
+#ifdef _WIN32
+		static std::mutex mutex;
+		std::lock_guard<std::mutex> lock(mutex);
+		const auto ret = _lseeki64(fd, offset, SEEK_SET) < 0 ? -1 : _read(fd, dst, length);
+#else
+		const auto ret = ::pread(fd, dst, length, offset);
+#endif
+		if(ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if(ret < 0) {
+			throw std::runtime_error("pread() failed with: " + std::string(std::strerror(errno)));
+		}
+		if(ret == 0) {
+			throw std::runtime_error("pread() failed with: unexpected end of file");
+		}
+		dst += ret;
+		length -= ret;
+		offset += ret;
+	}
+}
+
+inline
+void pwrite_ex(const int fd, const void* buf, size_t length, uint64_t offset)
+{
+	auto* src = (const uint8_t*)buf;
+	while(length) {
+#ifdef _WIN32
+		static std::mutex mutex;
+		std::lock_guard<std::mutex> lock(mutex);
+		const auto ret = _lseeki64(fd, offset, SEEK_SET) < 0 ? -1 : _write(fd, src, length);
+#else
+		const auto ret = ::pwrite(fd, src, length, offset);
+#endif
+		if(ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if(ret <= 0) {
+			throw std::runtime_error("pwrite() failed with: " + std::string(std::strerror(errno)));
+		}
+		src += ret;
+		length -= ret;
+		offset += ret;
+	}
+}
+
+/*
+ * Queue of positional reads / writes with up to queue_depth requests in flight.
+ * Uses io_uring where available, otherwise every request is done synchronously at submit time.
+ * Buffers need to stay valid until wait() on the returned ticket, or until the slot is
+ * reused queue_depth requests later. Errors are thrown from wait() / wait_all().
+ * Not thread-safe, use one instance per thread.
+ *
+ * There is one ring per reader / writer thread, not per device: N threads keep up to
+ * N * queue_depth requests in flight on the same device, which is what spreads the load over
+ * the members of --stripe and over NVMe queues. A shared queue would serialize the threads on
+ * its lock and completion handling.
+ *
+ * Between plug() and unplug(), requests are queued instead of submitted one by one: a request
+ * which continues the previous one in the same file is merged with it, into one readv / writev
+ * of up to kMaxMerge bytes, and the queue is submitted with one io_uring_enter() on unplug()
+ * or on the next wait(). Requests are not aligned here, the page cache does not need it and
+ * the direct backend aligns them itself.
+ */
+class AsyncIO {
+public:
+	static constexpr uint64_t kDone = 0;		// ticket of a request which was completed synchronously
+	static constexpr size_t kMaxMerge = 4 << 20;
+	
+	AsyncIO(const int queue_depth = g_io_queue_depth)
+		:	depth(std::max(queue_depth, 1)),
+			slots(depth)
+	{
+#ifdef CHIA_IO_URING
+		if(depth > 1) {
+			ring_setup();
+		}
+#endif
+	}
+	
+	~AsyncIO() {
+		try {
+			wait_all();
+		} catch(...) {
+			// nothing we can do
+		}
+#ifdef CHIA_IO_URING
+		ring_close();
+#endif
+	}
+	
+	AsyncIO(const AsyncIO&) = delete;
+	AsyncIO& operator=(const AsyncIO&) = delete;
+	
+	uint64_t read(const int fd, void* buf, const size_t length, const uint64_t offset) {
+		return submit(fd, (uint8_t*)buf, length, offset, false);
+	}
+	
+	uint64_t write(const int fd, const void* buf, const size_t length, const uint64_t offset) {
+		return submit(fd, (uint8_t*)buf, length, offset, true);
+	}
+	
+	void plug() {
+		is_plugged = true;
+	}
+	
+	void unplug() {
+		is_plugged = false;
+		submit_queued();
+	}
+	
+	void wait(const uint64_t ticket) {
+		if(ticket == kDone) {
+			return;
+		}
+		auto& slot = slots[ticket % depth];
+		if(slot.pending && slot.ticket == ticket) {
+			submit_queued();
+		}
+		while(slot.pending && slot.ticket == ticket) {
+			reap();
+		}
+		if(slot.ticket == ticket && !slot.error.empty()) {
+			const auto error = slot.error;
+			slot.error.clear();
+			throw std::runtime_error(error);
+		}
+	}
+	
+	void wait_all() {
+		for(auto& slot : slots) {
+			wait(slot.ticket);
+		}
+	}
+	
+	int queue_depth() const {
+		return is_async() ? depth : 1;
+	}
+	
+	bool is_async() const {
+#ifdef CHIA_IO_URING
+		return ring.fd >= 0;
+#else
+		return false;
+#endif
+	}
+
+private:
+	struct slot_t {
+		uint64_t ticket = 0;
+		bool pending = false;
+		bool is_write = false;
+		int fd = -1;
+		uint8_t* buf = nullptr;
+		size_t length = 0;
+		uint64_t offset = 0;
+		uint64_t last = 0;			// last ticket merged into this request, see merge()
+		std::string error;
+#ifdef CHIA_IO_URING
+		std::vector<iovec> iov;		// of tickets [ticket, last]
+#endif
+	};
+	
+	uint64_t submit(const int fd, uint8_t* buf, const size_t length, const uint64_t offset, const bool is_write)
+	{
+		const uint64_t ticket = next_ticket++;
+		auto& slot = slots[ticket % depth];
+		if(slot.pending) {
+			wait(slot.ticket);
+		}
+		slot.ticket = ticket;
+		slot.is_write = is_write;
+		slot.fd = fd;
+		slot.buf = buf;
+		slot.length = length;
+		slot.offset = offset;
+		slot.last = ticket;
+		slot.error.clear();
+#ifdef CHIA_IO_URING
+		if(is_async()) {
+			slot.pending = true;
+			if(!merge(slot)) {
+				ring_queue();
+				slot.iov.assign(1, iovec{buf, length});
+				open = ticket;
+				open_length = length;
+			}
+			if(!is_plugged) {
+				submit_queued();
+			}
+			return ticket;
+		}
+#endif
+		if(is_write) {
+			pwrite_ex(fd, buf, length, offset);
+		} else {
+			pread_ex(fd, buf, length, offset);
+		}
+		return ticket;
+	}
+	
+	void reap() {
+#ifdef CHIA_IO_URING
+		ring_reap();
+#endif
+	}
+	
+	void submit_queued() {
+#ifdef CHIA_IO_URING
+		ring_queue();
+		while(num_queued) {
+			num_queued -= ring_enter(num_queued, 0, 0);
+		}
+#endif
+	}
+
+#ifdef CHIA_IO_URING
+	struct ring_t {
+		int fd = -1;
+		unsigned* sq_tail = nullptr;
+		unsigned* sq_mask = nullptr;
+		unsigned* sq_array = nullptr;
+		io_uring_sqe* sqes = nullptr;
+		unsigned* cq_head = nullptr;
+		unsigned* cq_tail = nullptr;
+		unsigned* cq_mask = nullptr;
+		io_uring_cqe* cqes = nullptr;
+		void* sq_ptr = nullptr;
+		void* cq_ptr = nullptr;
+		size_t sq_size = 0;
+		size_t cq_size = 0;
+		size_t sqes_size = 0;
+	};
+	
+	void ring_setup()
+	{
+		io_uring_params params = {};
+		const int fd = syscall(__NR_io_uring_setup, depth, &params);
+		if(fd < 0) {
+			return;		// not supported, fall back to pread() / pwrite()
+		}
+		// IORING_OP_READ / IORING_OP_WRITE came with the same kernel as IORING_FEAT_RW_CUR_POS
+		if(!(params.features & IORING_FEAT_RW_CUR_POS)) {
+			::close(fd);
+			return;
+		}
+		ring.sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		ring.cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+		if(single_mmap) {
+			ring.sq_size = ring.cq_size = std::max(ring.sq_size, ring.cq_size);
+		}
+		ring.sq_ptr = mmap(0, ring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if(ring.sq_ptr == MAP_FAILED) {
+			ring.sq_ptr = nullptr;
+			::close(fd);
+			return;
+		}
+		if(single_mmap) {
+			ring.cq_ptr = ring.sq_ptr;
+		} else {
+			ring.cq_ptr = mmap(0, ring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+			if(ring.cq_ptr == MAP_FAILED) {
+				ring.cq_ptr = nullptr;
+				ring.fd = fd;
+				ring_close();
+				return;
+			}
+		}
+		ring.sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+		void* sqes = mmap(0, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if(sqes == MAP_FAILED) {
+			ring.fd = fd;
+			ring_close();
+			return;
+		}
+		auto* sq = (uint8_t*)ring.sq_ptr;
+		auto* cq = (uint8_t*)ring.cq_ptr;
+		ring.sq_tail = (unsigned*)(sq + params.sq_off.tail);
+		ring.sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+		ring.sq_array = (unsigned*)(sq + params.sq_off.array);
+		ring.sqes = (io_uring_sqe*)sqes;
+		ring.cq_head = (unsigned*)(cq + params.cq_off.head);
+		ring.cq_tail = (unsigned*)(cq + params.cq_off.tail);
+		ring.cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+		ring.cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+		ring.fd = fd;
+	}
+	
+	void ring_close()
+	{
+		if(ring.sqes) {
+			munmap(ring.sqes, ring.sqes_size);
+		}
+		if(ring.cq_ptr && ring.cq_ptr != ring.sq_ptr) {
+			munmap(ring.cq_ptr, ring.cq_size);
+		}
+		if(ring.sq_ptr) {
+			munmap(ring.sq_ptr, ring.sq_size);
+		}
+		if(ring.fd >= 0) {
+			::close(ring.fd);
+		}
+		ring = ring_t();
+	}
+	
+	// returns the number of requests submitted
+	unsigned ring_enter(const unsigned to_submit, const unsigned min_complete, const unsigned flags)
+	{
+		while(true) {
+			const auto ret = syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete, flags, nullptr, 0);
+			if(ret >= 0) {
+				return ret;
+			}
+			if(errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+				throw std::runtime_error("io_uring_enter() failed with: " + std::string(std::strerror(errno)));
+			}
+		}
+	}
+	
+	/*
+	 * Appends slot to the open request, if it continues it in the same file and buffer space is left.
+	 * Merged tickets are consecutive, since only the last request can be open.
+	 */
+	bool merge(const slot_t& slot)
+	{
+		if(!is_plugged || !open) {
+			return false;
+		}
+		auto& first = slots[open % depth];
+		const auto& last = slots[first.last % depth];
+		if(slot.fd != first.fd || slot.is_write != first.is_write
+			|| slot.offset != last.offset + last.length
+			|| open_length + slot.length > kMaxMerge)
+		{
+			return false;
+		}
+		if(slot.buf == last.buf + last.length) {
+			first.iov.back().iov_len += slot.length;
+		} else {
+			first.iov.push_back(iovec{slot.buf, slot.length});
+		}
+		first.last = slot.ticket;
+		open_length += slot.length;
+		return true;
+	}
+	
+	// moves the open request to the submission queue
+	void ring_queue()
+	{
+		if(!open) {
+			return;
+		}
+		const auto& slot = slots[open % depth];
+		open = 0;
+		
+		// at most depth requests in flight, so the submission queue cannot be full
+		const unsigned tail = *ring.sq_tail;
+		const unsigned index = tail & *ring.sq_mask;
+		auto& sqe = ring.sqes[index];
+		std::memset(&sqe, 0, sizeof(sqe));
+		if(slot.iov.size() > 1) {
+			sqe.opcode = slot.is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+			sqe.addr = uint64_t(slot.iov.data());
+			sqe.len = slot.iov.size();
+		} else {
+			sqe.opcode = slot.is_write ? IORING_OP_WRITE : IORING_OP_READ;
+			sqe.addr = uint64_t(slot.iov[0].iov_base);
+			sqe.len = slot.iov[0].iov_len;
+		}
+		sqe.fd = slot.fd;
+		sqe.off = slot.offset;
+		sqe.user_data = slot.ticket;
+		ring.sq_array[index] = index;
+		__atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+		num_queued++;
+	}
+	
+	void ring_reap()
+	{
+		unsigned head = *ring.cq_head;
+		if(head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+			ring_enter(0, 1, IORING_ENTER_GETEVENTS);
+		}
+		while(head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE))
+		{
+			const auto& cqe = ring.cqes[head & *ring.cq_mask];
+			auto& slot = slots[cqe.user_data % depth];
+			if(slot.pending && slot.ticket == cqe.user_data) {
+				complete(slot, cqe.res);
+			}
+			__atomic_store_n(ring.cq_head, ++head, __ATOMIC_RELEASE);
+		}
+	}
+	
+	// completes tickets [first.ticket, first.last]
+	void complete(const slot_t& first, const int res)
+	{
+		for(uint64_t ticket = first.ticket; ticket <= first.last; ++ticket)
+		{
+			auto& slot = slots[ticket % depth];
+			slot.pending = false;
+			if(res < 0) {
+				slot.error = std::string(slot.is_write ? "io_uring write" : "io_uring read")
+						+ " failed with: " + std::strerror(-res);
+				continue;
+			}
+			const uint64_t begin = slot.offset - first.offset;
+			const size_t done = std::min<uint64_t>(uint64_t(res) > begin ? res - begin : 0, slot.length);
+			if(done < slot.length) {
+				// short transfer, do the rest synchronously
+				try {
+					if(slot.is_write) {
+						pwrite_ex(slot.fd, slot.buf + done, slot.length - done, slot.offset + done);
+					} else {
+						pread_ex(slot.fd, slot.buf + done, slot.length - done, slot.offset + done);
+					}
+				} catch(const std::exception& ex) {
+					slot.error = ex.what();
+				}
+			}
+		}
+	}
+	
+	ring_t ring;
+	uint64_t open = 0;				// ticket of the request which is still being merged, 0 = none
+	size_t open_length = 0;
+	unsigned num_queued = 0;		// requests in the submission queue, not yet submitted
+#endif
+
+private:
+	const int depth;
+	bool is_plugged = false;
+	uint64_t next_ticket = 1;
+	std::vector<slot_t> slots;
+
+};
+
+
+#endif /* INCLUDE_CHIA_ASYNCIO_H_ */
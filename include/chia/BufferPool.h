@@ -0,0 +1,137 @@
+/*
+ * BufferPool.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INCLUDE_CHIA_BUFFERPOOL_H_
+#define INCLUDE_CHIA_BUFFERPOOL_H_
+
+#include <chia/Thread.h>
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+
+
+struct buffer_stats_t {
+	std::atomic<uint64_t> num_alloc {0};		// get() without a free buffer
+	std::atomic<uint64_t> num_reuse {0};		// get() with a recycled buffer
+};
+
+/*
+ * Global counters by stage name, totals of all plots in flight.
+ */
+class BufferStats {
+public:
+	static buffer_stats_t& get(const std::string& name)
+	{
+		std::lock_guard<std::mutex> lock(mutex());
+		auto& entry = map()[name];
+		if(!entry) {
+			entry = std::make_shared<buffer_stats_t>();
+		}
+		return *entry;
+	}
+	
+	/*
+	 * Returns "<name> <alloc> of <total> allocated, ..." for all stages starting with prefix,
+	 * where <total> is what was allocated before recycling. Resets the counters.
+	 */
+	static std::string report(const std::string& prefix)
+	{
+		std::lock_guard<std::mutex> lock(mutex());
+		std::ostringstream out;
+		for(const auto& entry : map()) {
+			if(entry.first.compare(0, prefix.size(), prefix) == 0) {
+				const uint64_t num_alloc = entry.second->num_alloc.exchange(0);
+				const uint64_t num_reuse = entry.second->num_reuse.exchange(0);
+				if(num_alloc + num_reuse) {
+					out << (out.tellp() ? ", " : "") << entry.first << " "
+						<< num_alloc << " of " << num_alloc + num_reuse << " allocated";
+				}
+			}
+		}
+		return out.str();
+	}
+	
+	static void print(const std::string& tag, const std::string& prefix)
+	{
+		const auto info = report(prefix);
+		if(!info.empty()) {
+			std::cout << tag << " Buffers: " << info << std::endl;
+		}
+	}
+	
+private:
+	static std::mutex& mutex() {
+		static std::mutex instance;
+		return instance;
+	}
+	static std::map<std::string, std::shared_ptr<buffer_stats_t>>& map() {
+		static std::map<std::string, std::shared_ptr<buffer_stats_t>> instance;
+		return instance;
+	}
+	
+};
+
+/*
+ * Free list of buffers for one pipeline stage: the producer calls get(), the consumer
+ * passes the buffer back via take() once done, which keeps its capacity for the next get().
+ * T needs clear() and capacity(), ie. std::vector.
+ */
+template<typename T>
+class BufferPool : public Processor<T> {
+public:
+	BufferPool(const std::string& name, const size_t max_free = 1024)
+		:	max_free(max_free),
+			stats(BufferStats::get(name))
+	{
+	}
+	
+	// returns an empty buffer [thread-safe]
+	T get()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(!free.empty()) {
+				T out = std::move(free.back());
+				free.pop_back();
+				stats.num_reuse++;
+				return out;
+			}
+		}
+		stats.num_alloc++;
+		return T();
+	}
+	
+	// returns a buffer to the pool [thread-safe]
+	void take(T& buffer) override
+	{
+		if(!buffer.capacity()) {
+			return;
+		}
+		buffer.clear();
+		std::lock_guard<std::mutex> lock(mutex);
+		if(free.size() < max_free) {
+			free.emplace_back(std::move(buffer));
+		}
+		buffer = T();
+	}
+	
+private:
+	const size_t max_free;
+	buffer_stats_t& stats;
+	
+	std::mutex mutex;
+	std::vector<T> free;
+	
+};
+
+
+#endif /* INCLUDE_CHIA_BUFFERPOOL_H_ */
@@ -8,9 +8,13 @@
 #ifndef INCLUDE_CHIA_DISKSORT_H_
 #define INCLUDE_CHIA_DISKSORT_H_
 
+#include <chia/sort.h>
 #include <chia/buffer.h>
+#include <chia/bitpack.h>
+#include <chia/Storage.h>
 #include <chia/ThreadPool.h>
 
+#include <deque>
 #include <vector>
 #include <string>
 #include <cstdio>
@@ -19,36 +23,114 @@
 #include <functional>
 
 
+/*
+ * Layout of entries in bucket files, which by default is T::write().
+ * Specializations can drop the upper key bits, since they are implied by the bucket index:
+ * key_bits is the number of key bits to store, key_prefix the implied upper part of the key.
+ */
 template<typename T, typename Key>
+struct bucket_layout_t {
+	static size_t entry_size(const int key_bits) {
+		return T::disk_size;
+	}
+	static void write(const T& entry, uint8_t* buf, const int key_bits) {
+		entry.write(buf);
+	}
+	static void read(T& entry, const uint8_t* buf, const int key_bits, const uint64_t key_prefix) {
+		entry.read(buf);
+	}
+	static uint64_t read_key(const uint8_t* buf, const int key_bits, const uint64_t key_prefix) {
+		T entry;
+		entry.read(buf);
+		return Key{}(entry);
+	}
+};
+
+/*
+ * Bucket layout derived from T::layout, storing only the lower key_bits of its first field.
+ * Entries are still rounded up to whole bytes, so the stripped bits only save a byte where they
+ * cross a byte boundary: with 256 buckets one byte for every entry type, with 64 buckets only
+ * for phase1::entry_1 and phase2::entry_x.
+ */
+template<typename T>
+struct bucket_key_layout_t {
+	typedef typename bit_layout_split<typename T::layout>::head key_field;
+	typedef typename bit_layout_split<typename T::layout>::tail tail;
+	
+	static size_t entry_size(const int key_bits) {
+		return bitpack_size(key_bits + tail::num_bits);
+	}
+	static void write(const T& entry, uint8_t* buf, const int key_bits) {
+		bit_writer_t out(buf);
+		out.write(key_field::get(entry) & ((uint64_t(1) << key_bits) - 1), key_bits);
+		tail::write(entry, out);
+		out.flush();
+	}
+	static void read(T& entry, const uint8_t* buf, const int key_bits, const uint64_t key_prefix) {
+		bit_reader_t in(buf);
+		key_field::set(entry, key_prefix | in.read(key_bits));
+		tail::read(entry, in);
+	}
+	// without decoding the rest of the entry
+	static uint64_t read_key(const uint8_t* buf, const int key_bits, const uint64_t key_prefix) {
+		bit_reader_t in(buf);
+		return key_prefix | in.read(key_bits);
+	}
+};
+
+template<typename T, typename Key, typename Sort = std_sort_t<T, Key>>
 class DiskSort {
 private:
+	typedef bucket_layout_t<T, Key> Layout;
+	
 	struct bucket_t {
-		FILE* file = nullptr;
-		std::mutex mutex;
 		std::string file_name;
+		std::shared_ptr<Segment> segment;
 		size_t num_entries = 0;
-		
-		void open(const char* mode);
-		void write(const void* data, size_t count);
-		void close();
-		void remove();
+	};
+	
+	/*
+	 * Sub-bucket in file order, to be sorted: a slice of the decoded bucket.
+	 */
+	struct block_t {
+		std::shared_ptr<std::vector<T>> bucket;		// all sub-buckets, one after the other
+		size_t begin = 0;			// slice of bucket
+		size_t count = 0;
+		size_t offset = 0;			// position in sorted output
+		int node = -1;				// where bucket was allocated
+	};
+	
+	struct read_local_t {
+		std::vector<uint8_t> buffer;	// bucket as stored, or one chunk if in memory
+		AsyncIO io;
+	};
+	
+	struct sort_local_t {
+		std::vector<T> tmp;				// for Sort
 	};
 	
 public:
 	class WriteCache {
 	public:
 		WriteCache(DiskSort* disk, int key_shift, int num_buckets);
-		~WriteCache() { flush(); }
+		~WriteCache();
 		void add(const T& entry);
 		void flush();
+	private:
+		uint8_t* next_buffer(size_t size);
 	private:
 		DiskSort* disk = nullptr;
 		const int key_shift = 0;
 		std::vector<write_buffer_t<T>> buckets;
+		std::deque<std::pair<uint64_t, uint8_t*>> in_flight;		// [ticket, buffer]
+		std::vector<uint8_t*> spare;
+		AsyncIO io;
 	};
 	
+	// storage = get_storage(file_prefix) by default
 	DiskSort(	int key_size, int log_num_buckets,
-				std::string file_prefix, bool read_only = false);
+				std::string file_prefix, bool read_only = false,
+				std::shared_ptr<Storage> storage = nullptr);
 	
 	~DiskSort() {
 		close();
@@ -80,14 +162,19 @@ public:
 	}
 	
 private:
+	// returns ticket for io.wait()
+	uint64_t write(AsyncIO& io, size_t index, const void* data, size_t count);
+	
 	void read_bucket(	std::pair<size_t, size_t>& index,
-						std::vector<std::pair<std::vector<T>, size_t>>& out,
-						read_buffer_t<T>& buffer);
+						std::vector<block_t>& out,
+						read_local_t& local);
 	
 private:
 	const int key_size = 0;
 	const int log_num_buckets = 0;
 	const int bucket_key_shift = 0;
+	const size_t entry_size = 0;		// bytes per entry in bucket files
+	const std::shared_ptr<Storage> storage;
 	
 	bool keep_files = false;
 	bool is_finished = false;
@@ -10,60 +10,22 @@
 
 #include <chia/DiskSort.h>
 #include <chia/util.hpp>
+#include <chia/numa.h>
 
-#include <map>
 #include <algorithm>
-#include <unordered_map>
 
 
-template<typename T, typename Key>
-void DiskSort<T, Key>::bucket_t::open(const char* mode)
-{
-	if(file) {
-		fclose(file);
-	}
-	file = fopen(file_name.c_str(), mode);
-	if(!file) {
-		throw std::runtime_error("fopen() failed");
-	}
-}
-
-template<typename T, typename Key>
-void DiskSort<T, Key>::bucket_t::write(const void* data, size_t count)
-{
-	std::lock_guard<std::mutex> lock(mutex);
-	if(file) {
-		if(fwrite(data, T::disk_size, count, file) != count) {
-			throw std::runtime_error("fwrite() failed");
-		}
-		num_entries += count;
-	}
-}
-
-template<typename T, typename Key>
-void DiskSort<T, Key>::bucket_t::close()
-{
-	if(file) {
-		fclose(file);
-		file = nullptr;
-	}
-}
-
-template<typename T, typename Key>
-void DiskSort<T, Key>::bucket_t::remove()
-{
-	close();
-	std::remove(file_name.c_str());
-}
-
-template<typename T, typename Key>
-DiskSort<T, Key>::WriteCache::WriteCache(DiskSort* disk, int key_shift, int num_buckets)
+template<typename T, typename Key, typename Sort>
+DiskSort<T, Key, Sort>::WriteCache::WriteCache(DiskSort* disk, int key_shift, int num_buckets)
 	:	disk(disk), key_shift(key_shift), buckets(num_buckets)
 {
+	for(auto& buffer : buckets) {
+		buffer.entry_size = disk->entry_size;
+	}
 }
 
-template<typename T, typename Key>
-void DiskSort<T, Key>::WriteCache::add(const T& entry)
+template<typename T, typename Key, typename Sort>
+void DiskSort<T, Key, Sort>::WriteCache::add(const T& entry)
 {
 	const size_t index = Key{}(entry) >> key_shift;
 	if(index >= buckets.size()) {
@@ -71,55 +33,115 @@ void DiskSort<T, Key>::WriteCache::add(const T& entry)
 	}
 	auto& buffer = buckets[index];
 	if(buffer.count >= buffer.capacity) {
-		disk->write(index, buffer.data, buffer.count);
+		in_flight.emplace_back(disk->write(io, index, buffer.data, buffer.count), buffer.data);
+		buffer.data = next_buffer(buffer.capacity * buffer.entry_size);
 		buffer.count = 0;
 	}
-	entry.write(buffer.entry_at(buffer.count));
+	Layout::write(entry, buffer.entry_at(buffer.count), key_shift);
 	buffer.count++;
 }
 
-template<typename T, typename Key>
-void DiskSort<T, Key>::WriteCache::flush()
+template<typename T, typename Key, typename Sort>
+void DiskSort<T, Key, Sort>::WriteCache::flush()
 {
+	io.plug();
 	for(size_t index = 0; index < buckets.size(); ++index) {
 		auto& buffer = buckets[index];
 		if(buffer.count) {
-			disk->write(index, buffer.data, buffer.count);
-			buffer.count = 0;
+			disk->write(io, index, buffer.data, buffer.count);
 		}
 	}
+	io.unplug();
+	io.wait_all();
+	
+	for(auto& buffer : buckets) {
+		buffer.count = 0;
+	}
+	for(const auto& entry : in_flight) {
+		spare.push_back(entry.second);
+	}
+	in_flight.clear();
+}
+
+template<typename T, typename Key, typename Sort>
+DiskSort<T, Key, Sort>::WriteCache::~WriteCache()
+{
+	flush();
+	for(auto* data : spare) {
+		delete [] data;
+	}
+}
+
+/*
+ * Returns a buffer for the next bucket write, waits for the oldest write if queue_depth are in flight.
+ */
+template<typename T, typename Key, typename Sort>
+uint8_t* DiskSort<T, Key, Sort>::WriteCache::next_buffer(size_t size)
+{
+	if(in_flight.size() >= size_t(io.queue_depth())) {
+		const auto oldest = in_flight.front();
+		in_flight.pop_front();
+		spare.push_back(oldest.second);
+		io.wait(oldest.first);
+	}
+	if(spare.empty()) {
+		return new uint8_t[size];
+	}
+	auto* data = spare.back();
+	spare.pop_back();
+	return data;
 }
 
-template<typename T, typename Key>
-DiskSort<T, Key>::DiskSort(	int key_size, int log_num_buckets,
-							std::string file_prefix, bool read_only)
+template<typename T, typename Key, typename Sort>
+DiskSort<T, Key, Sort>::DiskSort(	int key_size, int log_num_buckets,
+							std::string file_prefix, bool read_only,
+							std::shared_ptr<Storage> storage)
 	:	key_size(key_size),
 		log_num_buckets(log_num_buckets),
 		bucket_key_shift(key_size - log_num_buckets),
+		entry_size(Layout::entry_size(key_size - log_num_buckets)),
+		storage(storage ? storage : get_storage(file_prefix)),
 		keep_files(read_only),
 		is_finished(read_only),
 		cache(this, key_size - log_num_buckets, 1 << log_num_buckets),
 		buckets(1 << log_num_buckets)
 {
+	if(entry_size > T::disk_size) {
+		throw std::logic_error("entry_size > disk_size");
+	}
 	for(size_t i = 0; i < buckets.size(); ++i) {
 		auto& bucket = buckets[i];
 		bucket.file_name = file_prefix + ".sort_bucket_" + std::to_string(i) + ".tmp";
 		if(read_only) {
-			bucket.num_entries = get_file_size(bucket.file_name.c_str()) / T::disk_size;
+			bucket.num_entries = this->storage->size(bucket.file_name) / entry_size;
 		} else {
-			bucket.open("wb");
+			bucket.segment = this->storage->create(bucket.file_name);
 		}
 	}
 }
 
-template<typename T, typename Key>
-void DiskSort<T, Key>::add(const T& entry)
+template<typename T, typename Key, typename Sort>
+void DiskSort<T, Key, Sort>::add(const T& entry)
 {
 	cache.add(entry);
 }
 
-template<typename T, typename Key>
-void DiskSort<T, Key>::write(size_t index, const void* data, size_t count)
+template<typename T, typename Key, typename Sort>
+void DiskSort<T, Key, Sort>::write(size_t index, const void* data, size_t count)
+{
+	if(is_finished) {
+		throw std::logic_error("read only");
+	}
+	if(index >= buckets.size()) {
+		throw std::logic_error("bucket index out of range");
+	}
+	if(auto segment = buckets[index].segment) {
+		segment->append(data, count * entry_size);
+	}
+}
+
+template<typename T, typename Key, typename Sort>
+uint64_t DiskSort<T, Key, Sort>::write(AsyncIO& io, size_t index, const void* data, size_t count)
 {
 	if(is_finished) {
 		throw std::logic_error("read only");
@@ -127,50 +149,57 @@ void DiskSort<T, Key>::write(size_t index, const void* data, size_t count)
 	if(index >= buckets.size()) {
 		throw std::logic_error("bucket index out of range");
 	}
-	buckets[index].write(data, count);
+	auto& bucket = buckets[index];
+	if(!bucket.segment) {
+		throw std::logic_error("bucket not open");
+	}
+	return bucket.segment->append(io, data, count * entry_size);
 }
 
-template<typename T, typename Key>
-std::shared_ptr<typename DiskSort<T, Key>::WriteCache> DiskSort<T, Key>::add_cache()
+template<typename T, typename Key, typename Sort>
+std::shared_ptr<typename DiskSort<T, Key, Sort>::WriteCache> DiskSort<T, Key, Sort>::add_cache()
 {
 	return std::make_shared<WriteCache>(this, bucket_key_shift, buckets.size());
 }
 
-template<typename T, typename Key>
-void DiskSort<T, Key>::read(Processor<std::pair<std::vector<T>, size_t>>* output,
+template<typename T, typename Key, typename Sort>
+void DiskSort<T, Key, Sort>::read(Processor<std::pair<std::vector<T>, size_t>>* output,
 							int num_threads, int num_threads_read)
 {
 	if(num_threads_read < 0) {
 		num_threads_read = std::max(num_threads / 2, 2);
 	}
 	
-	ThreadPool<	std::pair<std::vector<T>, size_t>,
-				std::pair<std::vector<T>, size_t>> sort_pool(
-		[](std::pair<std::vector<T>, size_t>& input, std::pair<std::vector<T>, size_t>& out, size_t&) {
-			std::sort(input.first.begin(), input.first.end(),
-				[](const T& lhs, const T& rhs) -> bool {
-					return Key{}(lhs) < Key{}(rhs);
-				});
-			out = std::move(input);
+	const int key_bits = bucket_key_shift - log_num_buckets;
+	
+	ThreadPool<block_t, std::pair<std::vector<T>, size_t>, sort_local_t> sort_pool(
+		[key_bits](block_t& input, std::pair<std::vector<T>, size_t>& out, sort_local_t& local) {
+			// the slice is only used by this block, Sort may overwrite it
+			out.first.resize(input.count);
+			Sort{}(input.bucket->data() + input.begin, out.first.data(), input.count, key_bits, local.tmp);
+			out.second = input.offset;
+			input.bucket = nullptr;
 		}, output, num_threads, "Disk/sort");
 	
-	Thread<std::vector<std::pair<std::vector<T>, size_t>>> sort_thread(
-		[&sort_pool](std::vector<std::pair<std::vector<T>, size_t>>& input) {
+	Thread<std::vector<block_t>> sort_thread(
+		[&sort_pool](std::vector<block_t>& input) {
 			for(auto& block : input) {
-				sort_pool.take(block);
+				sort_pool.take_on(block, block.node);
 			}
-		}, "Disk/sort");
+		}, "Disk/split");
 	
 	ThreadPool<	std::pair<size_t, size_t>,
-				std::vector<std::pair<std::vector<T>, size_t>>,
-				read_buffer_t<T>> read_pool(
+				std::vector<block_t>,
+				read_local_t> read_pool(
 		std::bind(&DiskSort::read_bucket, this,
 				std::placeholders::_1, std::placeholders::_2, std::placeholders::_3),
 		&sort_thread, num_threads_read, "Disk/read");
 	
+	// with NUMA, each node reads and sorts every n-th bucket
 	uint64_t offset = 0;
 	for(size_t i = 0; i < buckets.size(); ++i) {
-		read_pool.take_copy(std::make_pair(i, offset));
+		auto index = std::make_pair(i, offset);
+		read_pool.take_on(index, Numa::node_of(i));
 		offset += buckets[i].num_entries;
 	}
 	read_pool.close();
@@ -178,75 +207,142 @@ void DiskSort<T, Key>::read(Processor<std::pair<std::vector<T>, size_t>>* output
 	sort_pool.close();
 }
 
-template<typename T, typename Key>
-void DiskSort<T, Key>::read_bucket(	std::pair<size_t, size_t>& index,
-									std::vector<std::pair<std::vector<T>, size_t>>& out,
-									read_buffer_t<T>& buffer)
+template<typename T, typename Key, typename Sort>
+void DiskSort<T, Key, Sort>::read_bucket(	std::pair<size_t, size_t>& index,
+											std::vector<block_t>& out,
+											read_local_t& local)
 {
 	auto& bucket = buckets[index.first];
-	bucket.open("rb");
+	bucket.segment = storage->open(bucket.file_name);
 	
 	const int key_shift = bucket_key_shift - log_num_buckets;
 	if(key_shift < 0) {
 		throw std::logic_error("key_shift < 0");
 	}
-	std::unordered_map<size_t, std::vector<T>> table;
-	table.reserve(size_t(1) << log_num_buckets);
+	const size_t num_entries = bucket.num_entries;
+	const size_t key_base = index.first << log_num_buckets;
+	std::vector<size_t> offsets((size_t(1) << log_num_buckets) + 1);
+	
+	const uint64_t key_prefix = uint64_t(index.first) << bucket_key_shift;
 	
-	for(size_t i = 0; i < bucket.num_entries;)
+	// read the whole bucket with queue_depth chunks in flight, unless the segment is in memory
+	auto& io = local.io;
+	auto& buffer = local.buffer;
+	const auto& segment = bucket.segment;
+	const bool in_memory = num_entries && segment->map(0, entry_size);
+	const size_t depth = in_memory ? 1 : io.queue_depth();
+	const size_t chunk_size = g_read_chunk_size;
+	const size_t chunk_bytes = chunk_size * entry_size;
+	const size_t num_chunks = (num_entries + chunk_size - 1) / chunk_size;
+	buffer.resize(in_memory ? chunk_bytes : num_entries * entry_size);
+	
+	std::vector<uint64_t> tickets(depth);
+	const auto read_chunk = [&](const size_t i) {
+		const size_t count = std::min(chunk_size, num_entries - i * chunk_size);
+		tickets[i % depth] = segment->read(io, buffer.data() + i * chunk_bytes, count * entry_size, i * chunk_bytes);
+	};
+	const auto get_chunk = [&](const size_t i, const size_t count) -> const uint8_t* {
+		if(in_memory) {
+			// no copy, unless the chunk crosses a memory block
+			if(auto data = segment->map(i * chunk_bytes, count * entry_size)) {
+				return data;
+			}
+			segment->read(buffer.data(), count * entry_size, i * chunk_bytes);
+			return buffer.data();
+		}
+		return buffer.data() + i * chunk_bytes;
+	};
+	if(!in_memory) {
+		// merged into large reads, submitted at once
+		io.plug();
+		for(size_t i = 0; i < std::min(depth, num_chunks); ++i) {
+			read_chunk(i);
+		}
+		io.unplug();
+	}
+	
+	// first pass: count entries per sub-bucket, from the key bits only
+	for(size_t i = 0; i < num_chunks; ++i)
 	{
-		const size_t num_entries = std::min(buffer.capacity, bucket.num_entries - i);
-		if(fread(buffer.data, T::disk_size, num_entries, bucket.file) != num_entries) {
-			throw std::runtime_error("fread() failed");
+		const size_t count = std::min(chunk_size, num_entries - i * chunk_size);
+		if(!in_memory) {
+			io.wait(tickets[i % depth]);
 		}
-		for(size_t k = 0; k < num_entries; ++k) {
-			T entry;
-			entry.read(buffer.entry_at(k));
-			
-			auto& block = table[Key{}(entry) >> key_shift];
-			if(block.empty()) {
-				block.reserve((bucket.num_entries >> log_num_buckets) * 1.1);
+		const uint8_t* data = get_chunk(i, count);
+		for(size_t k = 0; k < count; ++k) {
+			const uint64_t key = Layout::read_key(data + k * entry_size, bucket_key_shift, key_prefix);
+			const size_t sub = (key >> key_shift) - key_base;
+			if(sub + 1 >= offsets.size()) {
+				throw std::logic_error("sub-bucket index out of range");
 			}
-			block.push_back(entry);
+			offsets[sub + 1]++;
+		}
+		if(!in_memory && i + depth < num_chunks) {
+			read_chunk(i + depth);
 		}
-		i += num_entries;
 	}
-	if(!keep_files) {
-		bucket.remove();
+	for(size_t sub = 1; sub < offsets.size(); ++sub) {
+		offsets[sub] += offsets[sub - 1];
 	}
 	
-	std::map<size_t, std::vector<T>> sorted;
-	for(auto& entry : table) {
-		sorted.emplace(entry.first, std::move(entry.second));
+	// second pass: decode once, straight to the sub-bucket's place in one exactly sized vector
+	auto entries = std::make_shared<std::vector<T>>(num_entries);
+	{
+		std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+		for(size_t i = 0; i < num_chunks; ++i)
+		{
+			const size_t count = std::min(chunk_size, num_entries - i * chunk_size);
+			const uint8_t* data = get_chunk(i, count);
+			for(size_t k = 0; k < count; ++k) {
+				T entry;
+				Layout::read(entry, data + k * entry_size, bucket_key_shift, key_prefix);
+				(*entries)[next[(Key{}(entry) >> key_shift) - key_base]++] = entry;
+			}
+		}
 	}
-	table.clear();
+	// frees the memory of RamStorage
+	bucket.segment = nullptr;
+	if(!keep_files) {
+		storage->remove(bucket.file_name);
+	}
+	// not kept between buckets
+	std::vector<uint8_t>().swap(buffer);
 	
-	out.reserve(sorted.size());
-	uint64_t offset = index.second;
-	for(auto& entry : sorted) {
-		const auto count = entry.second.size();
-		out.emplace_back(std::move(entry.second), offset);
-		offset += count;
+	// the sub-buckets are slices of entries, which is freed once all of them are sorted
+	for(size_t sub = 0; sub + 1 < offsets.size(); ++sub) {
+		if(offsets[sub + 1] > offsets[sub]) {
+			block_t block;
+			block.bucket = entries;
+			block.begin = offsets[sub];
+			block.count = offsets[sub + 1] - offsets[sub];
+			block.offset = index.second + offsets[sub];
+			block.node = Numa::current_node();
+			out.push_back(std::move(block));
+		}
 	}
 }
 
-template<typename T, typename Key>
-void DiskSort<T, Key>::finish()
+template<typename T, typename Key, typename Sort>
+void DiskSort<T, Key, Sort>::finish()
 {
 	cache.flush();
 	for(auto& bucket : buckets) {
-		bucket.close();
+		if(bucket.segment) {
+			bucket.segment->close();
+			bucket.num_entries = bucket.segment->size() / entry_size;
+			bucket.segment = nullptr;		// re-opened by read_bucket()
+		}
 	}
 	is_finished = true;
 }
 
-template<typename T, typename Key>
-void DiskSort<T, Key>::close()
+template<typename T, typename Key, typename Sort>
+void DiskSort<T, Key, Sort>::close()
 {
 	for(auto& bucket : buckets) {
-		bucket.close();
+		bucket.segment = nullptr;
 		if(!keep_files) {
-			bucket.remove();
+			storage->remove(bucket.file_name);
 		}
 	}
 	buckets.clear();
@@ -9,6 +9,7 @@
 #define INCLUDE_CHIA_DISKTABLE_H_
 
 #include <chia/buffer.h>
+#include <chia/Storage.h>
 #include <chia/ThreadPool.h>
 
 #include <cstdio>
@@ -17,29 +18,27 @@
 template<typename T>
 class DiskTable {
 private:
-	struct local_t {
-		FILE* file = nullptr;
-		uint8_t* buffer = nullptr;
-		~local_t() {
-			if(file) {
-				fclose(file);
-			}
-			delete [] buffer;
-		}
+	struct block_t {
+		const uint8_t* data = nullptr;		// points into buffer, or the segment if in memory
+		size_t count = 0;
+		size_t offset = 0;
+		std::vector<uint8_t> buffer;
 	};
 	
 public:
-	DiskTable(std::string file_name, size_t num_entries = 0)
+	// storage = get_storage(file_name) by default
+	DiskTable(std::string file_name, size_t num_entries = 0, std::shared_ptr<Storage> storage = nullptr)
 		:	file_name(file_name),
-			num_entries(num_entries)
+			num_entries(num_entries),
+			storage(storage ? storage : get_storage(file_name))
 	{
 		if(!num_entries) {
-			file_out = fopen(file_name.c_str(), "wb");
+			segment_out = this->storage->create(file_name);
 		}
 	}
 	
-	DiskTable(const table_t& info)
-		:	DiskTable(info.file_name, info.num_entries)
+	DiskTable(const table_t& info, std::shared_ptr<Storage> storage = nullptr)
+		:	DiskTable(info.file_name, info.num_entries, storage)
 	{
 	}
 	
@@ -57,35 +56,55 @@ public:
 		return out;
 	}
 	
+	/*
+	 * Reads blocks with up to g_io_queue_depth requests in flight,
+	 * decoding is done by num_threads_read threads.
+	 * Segments in memory are decoded in place.
+	 */
 	void read(	Processor<std::pair<std::vector<T>, size_t>>* output,
 				int num_threads_read = 2,
 				const size_t block_size = g_read_chunk_size) const
 	{
-		ThreadPool<std::pair<size_t, size_t>, std::pair<std::vector<T>, size_t>, local_t> pool(
+		ThreadPool<block_t, std::pair<std::vector<T>, size_t>> pool(
 			std::bind(&DiskTable::read_block, this,
 					std::placeholders::_1, std::placeholders::_2, std::placeholders::_3),
 			output, num_threads_read, "Table/read");
 		
-		for(size_t i = 0; i < pool.num_threads(); ++i)
-		{
-			FILE* file = fopen(file_name.c_str(), "rb");
-			if(!file) {
-				throw std::runtime_error("fopen() failed");
+		const auto segment = storage->open(file_name);
+		const bool in_memory = num_entries && segment->map(0, T::disk_size);
+		std::vector<block_t> blocks;
+		
+		AsyncIO io;		// destroyed first, waits for pending reads into blocks
+		const size_t depth = in_memory ? 1 : io.queue_depth();
+		const size_t num_blocks = (num_entries + block_size - 1) / block_size;
+		
+		std::vector<uint64_t> tickets(depth);
+		blocks.resize(depth);
+		
+		const auto read_block = [&](const size_t i) {
+			auto& block = blocks[i % depth];
+			block.offset = i * block_size;
+			block.count = std::min(block_size, num_entries - block.offset);
+			const size_t num_bytes = block.count * T::disk_size;
+			block.data = in_memory ? segment->map(block.offset * T::disk_size, num_bytes) : nullptr;
+			if(!block.data) {
+				block.buffer.resize(num_bytes);
+				block.data = block.buffer.data();
+				tickets[i % depth] = segment->read(io, block.buffer.data(), num_bytes, block.offset * T::disk_size);
 			}
-			auto& local = pool.get_local(i);
-			local.file = file;
-			local.buffer = new uint8_t[block_size * T::disk_size];
+		};
+		io.plug();
+		for(size_t i = 0; i < std::min(depth, num_blocks); ++i) {
+			read_block(i);
 		}
-		const size_t num_blocks = num_entries / block_size;
-		const size_t left_over = num_entries % block_size;
-		
-		size_t offset = 0;
+		io.unplug();
 		for(size_t i = 0; i < num_blocks; ++i) {
-			pool.take_copy(std::make_pair(offset, block_size));
-			offset += block_size;
-		}
-		if(left_over) {
-			pool.take_copy(std::make_pair(offset, left_over));
+			io.wait(tickets[i % depth]);
+			tickets[i % depth] = AsyncIO::kDone;
+			pool.take(blocks[i % depth]);
+			if(i + depth < num_blocks) {
+				read_block(i + depth);
+			}
 		}
 		pool.close();
 	}
@@ -100,46 +119,40 @@ public:
 	}
 	
 	void flush() {
-		if(fwrite(cache.data, cache.entry_size, cache.count, file_out) != cache.count) {
-			throw std::runtime_error("fwrite() failed");
-		}
+		segment_out->append(cache.data, cache.count * cache.entry_size);
 		num_entries += cache.count;
 		cache.count = 0;
 	}
 	
 	void close() {
-		if(file_out) {
+		if(segment_out) {
 			flush();
-			fclose(file_out);
-			file_out = nullptr;
+			segment_out->close();
+			segment_out = nullptr;
 		}
 	}
 	
 private:
-	void read_block(std::pair<size_t, size_t>& param,
+	void read_block(block_t& input,
 					std::pair<std::vector<T>, size_t>& out,
-					local_t& local) const
+					size_t&) const
 	{
-		if(int err = fseek(local.file, param.first * T::disk_size, SEEK_SET)) {
-			throw std::runtime_error("fseek() failed");
-		}
-		if(fread(local.buffer, T::disk_size, param.second, local.file) != param.second) {
-			throw std::runtime_error("fread() failed");
-		}
 		auto& entries = out.first;
-		entries.resize(param.second);
-		for(size_t k = 0; k < param.second; ++k) {
-			entries[k].read(local.buffer + k * T::disk_size);
+		entries.resize(input.count);
+		for(size_t k = 0; k < input.count; ++k) {
+			entries[k].read(input.data + k * T::disk_size);
 		}
-		out.second = param.first;
+		out.second = input.offset;
 	}
 	
 private:
 	std::string file_name;
 	size_t num_entries;
 	
+	std::shared_ptr<Storage> storage;
+	
 	write_buffer_t<T> cache;
-	FILE* file_out = nullptr;
+	std::shared_ptr<Segment> segment_out;
 	
 };
 
@@ -0,0 +1,166 @@
+/*
+ * RingQueue.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INCLUDE_CHIA_RINGQUEUE_H_
+#define INCLUDE_CHIA_RINGQUEUE_H_
+
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <cstdint>
+#include <stdexcept>
+#include <condition_variable>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+
+/*
+ * Bounded lock-free queue, any number of producers and consumers.
+ * Each slot has a sequence number which tells if it's free for push() or ready for pop().
+ * Needs at least 2 slots, otherwise "free for pos + 1" and "ready at pos" look the same.
+ */
+template<typename T>
+class RingQueue {
+public:
+	RingQueue(const size_t capacity)
+		:	capacity(std::max<size_t>(capacity, 2)),
+			slots(new slot_t[this->capacity])
+	{
+		if(capacity < 1) {
+			throw std::logic_error("capacity < 1");
+		}
+		for(size_t i = 0; i < this->capacity; ++i) {
+			slots[i].seq.store(i, std::memory_order_relaxed);
+		}
+	}
+	
+	// returns false if full, data is only moved on success
+	bool try_push(T& data)
+	{
+		uint64_t pos = push_pos.load(std::memory_order_relaxed);
+		while(true) {
+			auto& slot = slots[pos % capacity];
+			const int64_t diff = int64_t(slot.seq.load(std::memory_order_acquire) - pos);
+			if(diff == 0) {
+				if(push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					slot.data = std::move(data);
+					slot.seq.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			} else if(diff < 0) {
+				return false;
+			} else {
+				pos = push_pos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+	
+	// returns false if empty
+	bool try_pop(T& data)
+	{
+		uint64_t pos = pop_pos.load(std::memory_order_relaxed);
+		while(true) {
+			auto& slot = slots[pos % capacity];
+			const int64_t diff = int64_t(slot.seq.load(std::memory_order_acquire) - (pos + 1));
+			if(diff == 0) {
+				if(pop_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					data = std::move(slot.data);
+					slot.data = T();
+					slot.seq.store(pos + capacity, std::memory_order_release);
+					return true;
+				}
+			} else if(diff < 0) {
+				return false;
+			} else {
+				pos = pop_pos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+	
+	size_t get_capacity() const {
+		return capacity;
+	}
+	
+private:
+	struct slot_t {
+		std::atomic<uint64_t> seq;
+		T data;
+	};
+	
+	const size_t capacity;
+	std::unique_ptr<slot_t[]> slots;
+	
+	alignas(64) std::atomic<uint64_t> push_pos {0};
+	alignas(64) std::atomic<uint64_t> pop_pos {0};
+	
+};
+
+
+/*
+ * Spin-then-park waiting: await() polls for a while before it blocks,
+ * wake() only takes the mutex when somebody is actually blocked.
+ * No spinning on a single core, since the thread we wait for cannot make progress meanwhile.
+ */
+class Parker {
+public:
+	static constexpr int max_spins = 256;
+	
+	template<typename F>
+	void await(const F& pred)
+	{
+		static const int num_spins = std::thread::hardware_concurrency() > 1 ? max_spins : 0;
+		
+		for(int i = 0; i < num_spins; ++i) {
+			if(pred()) {
+				return;
+			}
+			pause(i);
+		}
+		std::unique_lock<std::mutex> lock(mutex);
+		num_parked++;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		while(!pred()) {
+			signal.wait(lock);
+		}
+		num_parked--;
+	}
+	
+	// call after changing the state that await() is checking
+	void wake()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(num_parked.load(std::memory_order_relaxed)) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+			}
+			signal.notify_all();
+		}
+	}
+	
+private:
+	static void pause(const int iter) {
+		if(iter < max_spins / 2) {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+			_mm_pause();
+#endif
+		} else {
+			std::this_thread::yield();
+		}
+	}
+	
+private:
+	std::mutex mutex;
+	std::condition_variable signal;
+	std::atomic<int> num_parked {0};
+	
+};
+
+
+#endif /* INCLUDE_CHIA_RINGQUEUE_H_ */
@@ -0,0 +1,131 @@
+/*
+ * Scheduler.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INCLUDE_CHIA_SCHEDULER_H_
+#define INCLUDE_CHIA_SCHEDULER_H_
+
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+#include <condition_variable>
+
+
+struct budget_t {
+	int threads = 0;
+	uint64_t memory = 0;		// bytes
+	uint64_t tmp_space = 0;		// bytes
+	
+	budget_t& operator+=(const budget_t& other) {
+		threads += other.threads;
+		memory += other.memory;
+		tmp_space += other.tmp_space;
+		return *this;
+	}
+	budget_t& operator-=(const budget_t& other) {
+		threads -= other.threads;
+		memory -= other.memory;
+		tmp_space -= other.tmp_space;
+		return *this;
+	}
+};
+
+/*
+ * Global budget of threads, memory and tmp space, shared by concurrent plots.
+ * A zero limit means unlimited.
+ */
+class Scheduler {
+public:
+	Scheduler(const budget_t& limit)
+		:	limit(limit)
+	{
+	}
+	
+	// blocks until request fits into the budget, in order of arrival
+	void acquire(const budget_t& request)
+	{
+		check(request);
+		std::unique_lock<std::mutex> lock(mutex);
+		const uint64_t ticket = next_ticket++;
+		while(ticket != serving || !fits(used, budget_t(), request)) {
+			signal.wait(lock);
+		}
+		used += request;
+		serving++;
+		lock.unlock();
+		signal.notify_all();
+	}
+	
+	/*
+	 * Replaces prev with next, blocks until next fits.
+	 * Does not queue behind acquire(), since prev may be what a waiting request needs.
+	 */
+	void exchange(const budget_t& prev, const budget_t& next)
+	{
+		check(next);
+		std::unique_lock<std::mutex> lock(mutex);
+		while(!fits(used, prev, next)) {
+			signal.wait(lock);
+		}
+		used -= prev;
+		used += next;
+		lock.unlock();
+		signal.notify_all();
+	}
+	
+	void release(const budget_t& request)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			used -= request;
+		}
+		signal.notify_all();
+	}
+	
+	budget_t get_used() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return used;
+	}
+	
+	budget_t get_limit() const {
+		return limit;
+	}
+	
+	// throws if request could never be granted
+	void check(const budget_t& request) const {
+		if(!fits(request)) {
+			throw std::logic_error("request exceeds budget: " + std::to_string(request.threads) + " threads, "
+					+ std::to_string(request.memory >> 20) + " MiB memory, "
+					+ std::to_string(request.tmp_space >> 30) + " GiB tmp space");
+		}
+	}
+	
+private:
+	bool fits(const budget_t& total) const {
+		return (!limit.threads || total.threads <= limit.threads)
+			&& (!limit.memory || total.memory <= limit.memory)
+			&& (!limit.tmp_space || total.tmp_space <= limit.tmp_space);
+	}
+	
+	bool fits(budget_t total, const budget_t& prev, const budget_t& next) const {
+		total -= prev;
+		total += next;
+		return fits(total);
+	}
+	
+private:
+	const budget_t limit;
+	
+	mutable std::mutex mutex;
+	std::condition_variable signal;
+	budget_t used;
+	uint64_t next_ticket = 0;
+	uint64_t serving = 0;
+	
+};
+
+
+#endif /* INCLUDE_CHIA_SCHEDULER_H_ */
@@ -0,0 +1,746 @@
+/*
+ * Storage.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INCLUDE_CHIA_STORAGE_H_
+#define INCLUDE_CHIA_STORAGE_H_
+
+#include <chia/AsyncIO.h>
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+#include <sys/stat.h>
+
+
+/*
+ * Temporary data written once by appending, then read by position (like a file).
+ * Functions returning a ticket may complete asynchronously via io,
+ * see AsyncIO::wait(), synchronous backends return AsyncIO::kDone.
+ */
+class Segment {
+public:
+	virtual ~Segment() {}
+	
+	// number of bytes appended so far
+	virtual uint64_t size() const = 0;
+	
+	// thread-safe, data needs to stay valid until io.wait(ticket)
+	virtual uint64_t append(AsyncIO& io, const void* data, size_t length) = 0;
+	
+	// thread-safe, returns ticket
+	virtual uint64_t read(AsyncIO& io, void* data, size_t length, uint64_t offset) = 0;
+	
+	// finishes all writes, segment is read-only afterwards
+	virtual void close() {}
+	
+	// returns pointer to the data when held in memory, otherwise nullptr
+	virtual const uint8_t* map(uint64_t offset, size_t length) const {
+		return nullptr;
+	}
+	
+	void append(const void* data, size_t length) {
+		AsyncIO io(1);
+		io.wait(append(io, data, length));
+	}
+	
+	void read(void* data, size_t length, uint64_t offset) {
+		AsyncIO io(1);
+		io.wait(read(io, data, length, offset));
+	}
+
+};
+
+/*
+ * Backend for temporary data, segments are identified by file name.
+ */
+class Storage {
+public:
+	virtual ~Storage() {}
+	
+	virtual std::string name() const = 0;
+	
+	// creates a new empty segment, replacing an existing one
+	virtual std::shared_ptr<Segment> create(const std::string& file_name) = 0;
+	
+	// opens an existing segment for reading
+	virtual std::shared_ptr<Segment> open(const std::string& file_name) = 0;
+	
+	virtual void remove(const std::string& file_name) = 0;
+	
+	virtual uint64_t size(const std::string& file_name) = 0;
+
+};
+
+
+/*
+ * Regular file, using AsyncIO for reads and writes when async = true, otherwise pread() / pwrite().
+ */
+class FileSegment : public Segment {
+public:
+	FileSegment(const std::string& file_name, const bool write, const bool async)
+		:	async(async)
+	{
+		fd = open_file(file_name, write);
+		if(!write) {
+			struct stat info = {};
+			if(fstat(fd, &info)) {
+				close_file(fd);
+				throw std::runtime_error("fstat() failed with: " + std::string(std::strerror(errno)));
+			}
+			end = info.st_size;
+		}
+	}
+	
+	~FileSegment() {
+		close_file(fd);
+	}
+	
+	uint64_t size() const override {
+		return end;
+	}
+	
+	uint64_t append(AsyncIO& io, const void* data, size_t length) override {
+		const uint64_t offset = end.fetch_add(length);
+		if(async) {
+			return io.write(fd, data, length, offset);
+		}
+		pwrite_ex(fd, data, length, offset);
+		return AsyncIO::kDone;
+	}
+	
+	uint64_t read(AsyncIO& io, void* data, size_t length, uint64_t offset) override {
+		if(async) {
+			return io.read(fd, data, length, offset);
+		}
+		pread_ex(fd, data, length, offset);
+		return AsyncIO::kDone;
+	}
+	
+	using Segment::append;
+	using Segment::read;
+
+private:
+	int fd = -1;
+	const bool async;
+	std::atomic<uint64_t> end {0};
+
+};
+
+class FileStorage : public Storage {
+public:
+	FileStorage(const bool async) : async(async) {}
+	
+	std::string name() const override {
+		return async ? "uring" : "pread";
+	}
+	std::shared_ptr<Segment> create(const std::string& file_name) override {
+		return std::make_shared<FileSegment>(file_name, true, async);
+	}
+	std::shared_ptr<Segment> open(const std::string& file_name) override {
+		return std::make_shared<FileSegment>(file_name, false, async);
+	}
+	void remove(const std::string& file_name) override {
+		std::remove(file_name.c_str());
+	}
+	uint64_t size(const std::string& file_name) override {
+		struct stat info = {};
+		if(stat(file_name.c_str(), &info)) {
+			return 0;
+		}
+		return info.st_size;
+	}
+
+private:
+	const bool async;
+
+};
+
+
+/*
+ * Buffered stdio, one FILE* per segment.
+ */
+class StdioSegment : public Segment {
+public:
+	StdioSegment(const std::string& file_name, const bool write) {
+		file = fopen(file_name.c_str(), write ? "wb+" : "rb");
+		if(!file) {
+			throw std::runtime_error("fopen() failed with: " + std::string(std::strerror(errno)) + " (" + file_name + ")");
+		}
+		if(!write) {
+			fseek(file, 0, SEEK_END);
+			end = ftell(file);
+		}
+	}
+	
+	~StdioSegment() {
+		fclose(file);
+	}
+	
+	uint64_t size() const override {
+		return end;
+	}
+	
+	uint64_t append(AsyncIO& io, const void* data, size_t length) override {
+		std::lock_guard<std::mutex> lock(mutex);
+		seek(end);
+		if(fwrite(data, 1, length, file) != length) {
+			throw std::runtime_error("fwrite() failed");
+		}
+		end += length;
+		return AsyncIO::kDone;
+	}
+	
+	uint64_t read(AsyncIO& io, void* data, size_t length, uint64_t offset) override {
+		std::lock_guard<std::mutex> lock(mutex);
+		seek(offset);
+		if(fread(data, 1, length, file) != length) {
+			throw std::runtime_error("fread() failed");
+		}
+		return AsyncIO::kDone;
+	}
+	
+	void close() override {
+		std::lock_guard<std::mutex> lock(mutex);
+		fflush(file);
+	}
+	
+	using Segment::append;
+	using Segment::read;
+
+private:
+	void seek(const uint64_t offset) {
+		if(fseek(file, offset, SEEK_SET)) {
+			throw std::runtime_error("fseek() failed");
+		}
+	}
+
+private:
+	FILE* file = nullptr;
+	std::mutex mutex;
+	uint64_t end = 0;
+
+};
+
+class StdioStorage : public FileStorage {
+public:
+	StdioStorage() : FileStorage(false) {}
+	
+	std::string name() const override {
+		return "stdio";
+	}
+	std::shared_ptr<Segment> create(const std::string& file_name) override {
+		return std::make_shared<StdioSegment>(file_name, true);
+	}
+	std::shared_ptr<Segment> open(const std::string& file_name) override {
+		return std::make_shared<StdioSegment>(file_name, false);
+	}
+
+};
+
+
+#ifdef O_DIRECT
+/*
+ * Unbuffered file via O_DIRECT, bypassing the page cache.
+ * Appends are collected in an aligned buffer and written as kBufferSize blocks,
+ * reads go through an aligned bounce buffer.
+ */
+class DirectSegment : public Segment {
+public:
+	static constexpr size_t kAlign = 4096;
+	static constexpr size_t kBufferSize = 256 * 1024;
+	
+	DirectSegment(const std::string& file_name, const bool write)
+	{
+		fd = ::open(file_name.c_str(), (write ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY) | O_DIRECT, 0644);
+		if(fd < 0) {
+			throw std::runtime_error("open(O_DIRECT) failed with: " + std::string(std::strerror(errno)) + " (" + file_name + ")");
+		}
+		if(write) {
+			buffer = alloc(kBufferSize);
+		} else {
+			struct stat info = {};
+			if(fstat(fd, &info)) {
+				::close(fd);
+				throw std::runtime_error("fstat() failed with: " + std::string(std::strerror(errno)));
+			}
+			end = info.st_size;
+		}
+	}
+	
+	~DirectSegment() {
+		try {
+			close();
+		} catch(...) {
+			// nothing we can do
+		}
+		::close(fd);
+	}
+	
+	uint64_t size() const override {
+		return end;
+	}
+	
+	uint64_t append(AsyncIO& io, const void* data, size_t length) override {
+		std::lock_guard<std::mutex> lock(mutex);
+		if(!buffer) {
+			throw std::logic_error("DirectSegment: append() after close()");
+		}
+		auto* src = (const uint8_t*)data;
+		while(length) {
+			const size_t count = std::min(length, kBufferSize - num_buffered);
+			::memcpy(buffer.get() + num_buffered, src, count);
+			num_buffered += count;
+			src += count;
+			length -= count;
+			end += count;
+			if(num_buffered == kBufferSize) {
+				pwrite_ex(fd, buffer.get(), kBufferSize, end - kBufferSize);
+				num_buffered = 0;
+			}
+		}
+		return AsyncIO::kDone;
+	}
+	
+	uint64_t read(AsyncIO& io, void* data, size_t length, uint64_t offset) override {
+		const uint64_t begin = offset & ~uint64_t(kAlign - 1);
+		const size_t aligned = ((offset + length - begin) + kAlign - 1) & ~(kAlign - 1);
+		const auto bounce = alloc(aligned);
+		size_t done = 0;
+		while(done < offset + length - begin) {
+			const auto ret = ::pread(fd, bounce.get() + done, aligned - done, begin + done);
+			if(ret < 0 && errno == EINTR) {
+				continue;
+			}
+			if(ret < 0) {
+				throw std::runtime_error("pread(O_DIRECT) failed with: " + std::string(std::strerror(errno)));
+			}
+			if(ret == 0) {
+				throw std::runtime_error("pread(O_DIRECT) failed with: unexpected end of file");
+			}
+			done += ret;
+		}
+		::memcpy(data, bounce.get() + (offset - begin), length);
+		return AsyncIO::kDone;
+	}
+	
+	// writes the last partial block padded, then truncates to the actual size
+	void close() override {
+		std::lock_guard<std::mutex> lock(mutex);
+		if(!buffer) {
+			return;
+		}
+		if(num_buffered) {
+			const size_t padded = (num_buffered + kAlign - 1) & ~(kAlign - 1);
+			::memset(buffer.get() + num_buffered, 0, padded - num_buffered);
+			pwrite_ex(fd, buffer.get(), padded, end - num_buffered);
+			if(ftruncate(fd, end)) {
+				throw std::runtime_error("ftruncate() failed with: " + std::string(std::strerror(errno)));
+			}
+			num_buffered = 0;
+		}
+		buffer = nullptr;
+	}
+	
+	using Segment::append;
+	using Segment::read;
+
+private:
+	struct free_t {
+		void operator()(uint8_t* ptr) const { ::free(ptr); }
+	};
+	typedef std::unique_ptr<uint8_t, free_t> aligned_ptr_t;
+	
+	static aligned_ptr_t alloc(const size_t size) {
+		void* ptr = nullptr;
+		if(posix_memalign(&ptr, kAlign, size)) {
+			throw std::bad_alloc();
+		}
+		return aligned_ptr_t((uint8_t*)ptr);
+	}
+
+private:
+	int fd = -1;
+	std::mutex mutex;
+	uint64_t end = 0;
+	aligned_ptr_t buffer;
+	size_t num_buffered = 0;
+
+};
+
+class DirectStorage : public FileStorage {
+public:
+	DirectStorage() : FileStorage(false) {}
+	
+	std::string name() const override {
+		return "direct";
+	}
+	std::shared_ptr<Segment> create(const std::string& file_name) override {
+		return std::make_shared<DirectSegment>(file_name, true);
+	}
+	std::shared_ptr<Segment> open(const std::string& file_name) override {
+		return std::make_shared<DirectSegment>(file_name, false);
+	}
+
+};
+#endif // O_DIRECT
+
+
+/*
+ * Process memory, as a list of chunks which grow from kMinChunkSize to kMaxChunkSize.
+ */
+class RamSegment : public Segment {
+public:
+	static constexpr size_t kMinChunkSize = size_t(64) << 10;
+	static constexpr size_t kMaxChunkSize = size_t(16) << 20;
+	
+	uint64_t size() const override {
+		std::lock_guard<std::mutex> lock(mutex);
+		return end;
+	}
+	
+	uint64_t append(AsyncIO& io, const void* data, size_t length) override {
+		std::lock_guard<std::mutex> lock(mutex);
+		while(capacity < end + length) {
+			const size_t size = std::min(std::max(kMinChunkSize, size_t(capacity)), kMaxChunkSize);
+			chunks.emplace_back(capacity, std::unique_ptr<uint8_t[]>(new uint8_t[size]));
+			capacity += size;
+		}
+		copy((const uint8_t*)data, length, end, true);
+		end += length;
+		return AsyncIO::kDone;
+	}
+	
+	uint64_t read(AsyncIO& io, void* data, size_t length, uint64_t offset) override {
+		std::lock_guard<std::mutex> lock(mutex);
+		if(offset + length > end) {
+			throw std::runtime_error("RamSegment: read beyond end");
+		}
+		copy((uint8_t*)data, length, offset, false);
+		return AsyncIO::kDone;
+	}
+	
+	const uint8_t* map(uint64_t offset, size_t length) const override {
+		std::lock_guard<std::mutex> lock(mutex);
+		if(chunks.empty() || offset + length > end) {
+			return nullptr;
+		}
+		const size_t i = find(offset);
+		if(offset + length > chunk_end(i)) {
+			return nullptr;		// crosses chunk boundary
+		}
+		return chunks[i].second.get() + (offset - chunks[i].first);
+	}
+	
+	using Segment::append;
+	using Segment::read;
+
+private:
+	// index of chunk containing offset
+	size_t find(const uint64_t offset) const {
+		const auto iter = std::upper_bound(chunks.begin(), chunks.end(), offset,
+			[](const uint64_t offset, const chunk_t& chunk) -> bool {
+				return offset < chunk.first;
+			});
+		return (iter - chunks.begin()) - 1;
+	}
+	
+	uint64_t chunk_end(const size_t i) const {
+		return i + 1 < chunks.size() ? chunks[i + 1].first : capacity;
+	}
+	
+	void copy(uint8_t* data, size_t length, uint64_t offset, const bool write) const {
+		for(size_t i = find(offset); length; ++i) {
+			const size_t count = std::min<uint64_t>(length, chunk_end(i) - offset);
+			uint8_t* ptr = chunks[i].second.get() + (offset - chunks[i].first);
+			if(write) {
+				::memcpy(ptr, data, count);
+			} else {
+				::memcpy(data, ptr, count);
+			}
+			data += count;
+			offset += count;
+			length -= count;
+		}
+	}
+	
+	void copy(const uint8_t* data, size_t length, uint64_t offset, const bool write) const {
+		copy((uint8_t*)data, length, offset, write);
+	}
+
+private:
+	typedef std::pair<uint64_t, std::unique_ptr<uint8_t[]>> chunk_t;	// [offset, data]
+	
+	mutable std::mutex mutex;
+	uint64_t end = 0;
+	uint64_t capacity = 0;
+	std::vector<chunk_t> chunks;
+
+};
+
+class RamStorage : public Storage {
+public:
+	std::string name() const override {
+		return "ram";
+	}
+	std::shared_ptr<Segment> create(const std::string& file_name) override {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto segment = std::make_shared<RamSegment>();
+		segments[file_name] = segment;
+		return segment;
+	}
+	std::shared_ptr<Segment> open(const std::string& file_name) override {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto iter = segments.find(file_name);
+		if(iter == segments.end()) {
+			throw std::runtime_error("RamStorage: no such segment: " + file_name);
+		}
+		return iter->second;
+	}
+	// memory is freed once the last user of the segment is gone
+	void remove(const std::string& file_name) override {
+		std::lock_guard<std::mutex> lock(mutex);
+		segments.erase(file_name);
+	}
+	uint64_t size(const std::string& file_name) override {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto iter = segments.find(file_name);
+		return iter != segments.end() ? iter->second->size() : 0;
+	}
+
+private:
+	std::mutex mutex;
+	std::map<std::string, std::shared_ptr<RamSegment>> segments;
+
+};
+
+
+/*
+ * Spreads the segments below prefix across several directories, each with its own backend.
+ * Placement is by smooth weighted round robin, where DiskSort buckets use their bucket index,
+ * so consecutive buckets are on different devices, and other segments a hash of their name.
+ * Placement only depends on the name, so no bookkeeping is needed to find a segment again.
+ */
+class StripedStorage : public Storage {
+public:
+	struct member_t {
+		std::string dir;
+		std::shared_ptr<Storage> storage;
+		double weight = 1;		// ie. bandwidth
+	};
+	
+	static constexpr int kMaxWeight = 8;		// resolution of weights
+	
+	StripedStorage(const std::string& prefix, const std::vector<member_t>& members)
+		:	prefix(prefix), members(members)
+	{
+		if(members.empty()) {
+			throw std::logic_error("StripedStorage: no members");
+		}
+		double max_weight = 0;
+		for(const auto& member : members) {
+			if(!(member.weight > 0)) {
+				throw std::logic_error("StripedStorage: weight <= 0");
+			}
+			max_weight = std::max(member.weight, max_weight);
+		}
+		int total = 0;
+		std::vector<int> weight;
+		for(const auto& member : members) {
+			weight.push_back(std::max(int(member.weight / max_weight * kMaxWeight + 0.5), 1));
+			total += weight.back();
+		}
+		std::vector<int> current(members.size());
+		for(int i = 0; i < total; ++i) {
+			size_t best = 0;
+			for(size_t k = 0; k < members.size(); ++k) {
+				current[k] += weight[k];
+				if(current[k] > current[best]) {
+					best = k;
+				}
+			}
+			current[best] -= total;
+			sequence.push_back(best);
+		}
+	}
+	
+	std::string name() const override {
+		return "striped(" + std::to_string(members.size()) + "x " + members[0].storage->name() + ")";
+	}
+	std::shared_ptr<Segment> create(const std::string& file_name) override {
+		const auto& member = place(file_name);
+		return member.storage->create(path(member, file_name));
+	}
+	std::shared_ptr<Segment> open(const std::string& file_name) override {
+		const auto& member = place(file_name);
+		return member.storage->open(path(member, file_name));
+	}
+	void remove(const std::string& file_name) override {
+		const auto& member = place(file_name);
+		member.storage->remove(path(member, file_name));
+	}
+	uint64_t size(const std::string& file_name) override {
+		const auto& member = place(file_name);
+		return member.storage->size(path(member, file_name));
+	}
+	
+	// index into members
+	size_t get_index(const std::string& file_name) const {
+		if(file_name.compare(0, prefix.size(), prefix)) {
+			throw std::logic_error("StripedStorage: invalid file name: " + file_name);
+		}
+		uint64_t index = 0;
+		const std::string key = ".sort_bucket_";
+		const auto pos = file_name.rfind(key);
+		if(pos != std::string::npos) {
+			index = std::strtoull(file_name.c_str() + pos + key.size(), nullptr, 10);
+		} else {
+			index = 14695981039346656037ull;		// FNV-1a
+			for(const char c : file_name) {
+				index = (index ^ uint8_t(c)) * 1099511628211ull;
+			}
+		}
+		return sequence[index % sequence.size()];
+	}
+	
+private:
+	const member_t& place(const std::string& file_name) const {
+		return members[get_index(file_name)];
+	}
+	
+	std::string path(const member_t& member, const std::string& file_name) const {
+		return member.dir + file_name.substr(prefix.size());
+	}
+	
+private:
+	const std::string prefix;
+	const std::vector<member_t> members;
+	std::vector<size_t> sequence;
+	
+};
+
+/*
+ * Returns the write speed of dir in MB/s, by writing num_bytes.
+ */
+inline
+double measure_write_speed(const std::string& dir, const size_t num_bytes = size_t(64) << 20)
+{
+	const std::string file_name = dir + ".chia_plot_speed_test";
+	const size_t block_size = size_t(4) << 20;
+	std::vector<uint8_t> block(block_size, 0xA5);
+	
+	const int fd = open_file(file_name, true);
+	const auto begin = std::chrono::steady_clock::now();
+	try {
+		for(size_t offset = 0; offset < num_bytes; offset += block_size) {
+			pwrite_ex(fd, block.data(), block_size, offset);
+		}
+#ifdef _WIN32
+		_commit(fd);
+#else
+		fsync(fd);
+#endif
+	} catch(...) {
+		close_file(fd);
+		std::remove(file_name.c_str());
+		throw;
+	}
+	const auto end = std::chrono::steady_clock::now();
+	close_file(fd);
+	std::remove(file_name.c_str());
+	
+	const double secs = std::chrono::duration<double>(end - begin).count();
+	return num_bytes / std::max(secs, 1e-6) / 1e6;
+}
+
+
+/*
+ * Creates a backend by name: uring, pread, stdio, direct, ram
+ */
+inline
+std::shared_ptr<Storage> create_storage(const std::string& name)
+{
+	if(name == "uring") {
+		return std::make_shared<FileStorage>(true);
+	}
+	if(name == "pread") {
+		return std::make_shared<FileStorage>(false);
+	}
+	if(name == "stdio") {
+		return std::make_shared<StdioStorage>();
+	}
+#ifdef O_DIRECT
+	if(name == "direct") {
+		return std::make_shared<DirectStorage>();
+	}
+#endif
+	if(name == "ram") {
+		return std::make_shared<RamStorage>();
+	}
+	throw std::invalid_argument("invalid storage backend: " + name);
+}
+
+struct storage_registry_t {
+	std::mutex mutex;
+	std::map<std::string, std::shared_ptr<Storage>> map;		// [path prefix => storage]
+	std::shared_ptr<Storage> fallback = std::make_shared<FileStorage>(true);
+};
+
+inline
+storage_registry_t& get_storage_registry()
+{
+	static storage_registry_t registry;
+	return registry;
+}
+
+/*
+ * Selects the backend for all segments whose file name starts with path_prefix (ie. a tmpdir).
+ */
+inline
+void set_storage(const std::string& path_prefix, std::shared_ptr<Storage> storage)
+{
+	auto& registry = get_storage_registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	registry.map[path_prefix] = storage;
+}
+
+/*
+ * Returns the backend with the longest matching prefix, default is io_uring on files.
+ */
+inline
+std::shared_ptr<Storage> get_storage(const std::string& file_name)
+{
+	auto& registry = get_storage_registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	std::shared_ptr<Storage> out = registry.fallback;
+	size_t best = 0;
+	for(const auto& entry : registry.map) {
+		const auto& prefix = entry.first;
+		if(prefix.size() >= best && file_name.compare(0, prefix.size(), prefix) == 0) {
+			out = entry.second;
+			best = prefix.size();
+		}
+	}
+	return out;
+}
+
+inline
+void remove_segment(const std::string& file_name)
+{
+	get_storage(file_name)->remove(file_name);
+}
+
+
+#endif /* INCLUDE_CHIA_STORAGE_H_ */
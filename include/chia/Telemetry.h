@@ -0,0 +1,234 @@
+/*
+ * Telemetry.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INCLUDE_CHIA_TELEMETRY_H_
+#define INCLUDE_CHIA_TELEMETRY_H_
+
+#include <chia/settings.h>
+#include <chia/Trace.h>
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+
+/*
+ * Time spent by all threads of one stage, in usec:
+ * busy = executing, idle = waiting for input, blocked = waiting in a downstream take().
+ */
+struct stage_stats_t {
+	std::atomic<uint64_t> num_items {0};
+	std::atomic<uint64_t> busy {0};
+	std::atomic<uint64_t> idle {0};
+	std::atomic<uint64_t> blocked {0};
+};
+
+/*
+ * Per-stage counters keyed by thread name, enabled via g_telemetry.
+ * Counters are global and reset by report(), so only one plot can be in flight.
+ */
+class Telemetry {
+public:
+	static int64_t now() {
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	
+	// returns nullptr if disabled or unnamed [thread-safe]
+	static stage_stats_t* get(const std::string& name)
+	{
+		if(!g_telemetry || name.empty()) {
+			return nullptr;
+		}
+		auto& inst = instance();
+		std::lock_guard<std::mutex> lock(inst.mutex);
+		auto& entry = inst.stages[name];
+		if(!entry) {
+			entry = std::make_shared<stage_stats_t>();
+		}
+		return entry.get();
+	}
+	
+	// time the calling thread was blocked in take(), subtracted from busy time
+	static uint64_t& blocked() {
+		static thread_local uint64_t value = 0;
+		return value;
+	}
+	
+	/*
+	 * Prints the stages which were active since the last call, resets the counters.
+	 * The summary is kept for write_json().
+	 */
+	static void report(const std::string& title)
+	{
+		if(!g_telemetry) {
+			return;
+		}
+		auto& inst = instance();
+		std::lock_guard<std::mutex> lock(inst.mutex);
+		table_t table;
+		table.title = title;
+		for(const auto& entry : inst.stages) {
+			auto& stats = *entry.second;
+			row_t row;
+			row.name = entry.first;
+			row.num_items = stats.num_items.exchange(0);
+			row.busy = stats.busy.exchange(0);
+			row.idle = stats.idle.exchange(0);
+			row.blocked = stats.blocked.exchange(0);
+			if(row.num_items || row.busy || row.blocked) {
+				table.rows.push_back(row);
+			}
+		}
+		inst.tables.push_back(table);
+		
+		char line[256];
+		std::cout << title << " pipeline:" << std::endl;
+		snprintf(line, sizeof(line), "  %-16s %10s %10s %10s %12s", "stage", "items", "busy [s]", "idle [s]", "blocked [s]");
+		std::cout << line << std::endl;
+		for(const auto& row : table.rows) {
+			snprintf(line, sizeof(line), "  %-16s %10llu %10.3f %10.3f %12.3f", row.name.c_str(),
+					(unsigned long long)row.num_items, row.busy / 1e6, row.idle / 1e6, row.blocked / 1e6);
+			std::cout << line << std::endl;
+		}
+	}
+	
+	// writes all summaries since the last call as JSON
+	static void write_json(const std::string& file_name)
+	{
+		if(!g_telemetry) {
+			return;
+		}
+		auto& inst = instance();
+		std::lock_guard<std::mutex> lock(inst.mutex);
+		std::ofstream out(file_name, std::ios::trunc);
+		out << "{\"tables\": [";
+		for(size_t i = 0; i < inst.tables.size(); ++i) {
+			const auto& table = inst.tables[i];
+			out << (i ? "," : "") << "\n  {\"title\": \"" << table.title << "\", \"stages\": [";
+			for(size_t k = 0; k < table.rows.size(); ++k) {
+				const auto& row = table.rows[k];
+				out << (k ? "," : "") << "\n    {\"name\": \"" << row.name << "\", \"items\": " << row.num_items
+					<< ", \"busy_us\": " << row.busy << ", \"idle_us\": " << row.idle
+					<< ", \"blocked_us\": " << row.blocked << "}";
+			}
+			out << "\n  ]}";
+		}
+		out << "\n]}" << std::endl;
+		if(!out) {
+			std::cout << "Failed to write " << file_name << std::endl;
+		}
+		inst.tables.clear();
+	}
+	
+private:
+	struct row_t {
+		std::string name;
+		uint64_t num_items = 0;
+		uint64_t busy = 0;
+		uint64_t idle = 0;
+		uint64_t blocked = 0;
+	};
+	
+	struct table_t {
+		std::string title;
+		std::vector<row_t> rows;
+	};
+	
+	std::mutex mutex;
+	std::map<std::string, std::shared_ptr<stage_stats_t>> stages;
+	std::vector<table_t> tables;
+	
+	static Telemetry& instance() {
+		static Telemetry inst;
+		return inst;
+	}
+	
+};
+
+/*
+ * Measures one blocking take(), to be subtracted from the caller's busy time.
+ */
+class blocked_timer_t {
+public:
+	blocked_timer_t()
+		:	begin(g_telemetry ? Telemetry::now() : 0)
+	{
+	}
+	
+	~blocked_timer_t() {
+		if(begin) {
+			Telemetry::blocked() += Telemetry::now() - begin;
+		}
+	}
+	
+private:
+	const int64_t begin;
+	
+};
+
+/*
+ * Accounting of one worker thread, starts waiting for input when constructed:
+ * call input() when it arrives and done() after it has been processed.
+ * Time blocked in take() is moved to blocked, wherever it happens.
+ * With a trace_id from Trace::get_id() each input() to done() is recorded as a span.
+ */
+class stage_timer_t {
+public:
+	stage_timer_t(stage_stats_t* stats, const int trace_id = -1)
+		:	stats(stats),
+			trace_id(trace_id),
+			time(stats || trace_id >= 0 ? Telemetry::now() : 0),
+			blocked(Telemetry::blocked())
+	{
+	}
+	
+	void input() {
+		if(stats) {
+			account(stats->idle);
+		} else if(trace_id >= 0) {
+			time = Telemetry::now();
+		}
+	}
+	
+	void done() {
+		if(trace_id >= 0) {
+			Trace::span(trace_id, time, Telemetry::now());
+		}
+		if(stats) {
+			account(stats->busy);
+			stats->num_items++;
+		}
+	}
+	
+private:
+	void account(std::atomic<uint64_t>& field) {
+		const auto now = Telemetry::now();
+		const auto total = uint64_t(now - time);
+		const auto blocked_ = Telemetry::blocked() - blocked;
+		field += total > blocked_ ? total - blocked_ : 0;
+		stats->blocked += blocked_;
+		time = now;
+		blocked += blocked_;
+	}
+	
+private:
+	stage_stats_t* const stats;
+	const int trace_id;
+	int64_t time = 0;
+	uint64_t blocked = 0;
+	
+};
+
+#endif /* INCLUDE_CHIA_TELEMETRY_H_ */
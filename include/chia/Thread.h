@@ -9,17 +9,38 @@
 #define INCLUDE_CHIA_THREAD_H_
 
 #include <mutex>
+#include <string>
 #include <thread>
 #include <atomic>
 #include <iostream>
 #include <functional>
-#include <condition_variable>
+
+#include <chia/settings.h>
+#include <chia/RingQueue.h>
+#include <chia/Telemetry.h>
 
 #ifdef _GNU_SOURCE
 #include <pthread.h>
 #endif
 
 
+// limits the name to 15 chars, otherwise pthread_setname_np() fails
+inline
+void set_thread_name(const std::string& name)
+{
+	if(!name.empty()) {
+		std::string thread_name = name;
+		if(thread_name.size() > 15) {
+			thread_name.resize(15);
+		}
+#ifdef _GNU_SOURCE
+		pthread_setname_np(pthread_self(), thread_name.c_str());
+#endif
+		Trace::set_thread_name(name);
+	}
+}
+
+
 template<typename T>
 class Processor {
 public:
@@ -33,118 +54,123 @@ public:
 	}
 };
 
+/*
+ * Runs func on a dedicated thread, inputs are passed via a lock-free ring.
+ * take() returns when at most <depth> inputs are pending, including the one in progress,
+ * so depth = 1 means no triple buffering. Default depth is get_queue_depth(name).
+ */
 template<typename T>
 class Thread : public Processor<T> {
 public:
-	Thread(const std::function<void(T&)>& func, const std::string& name = "")
-		:	execute(func)
+	Thread(const std::function<void(T&)>& func, const std::string& name = "", const int depth = 0)
+		:	depth(depth > 0 ? depth : get_queue_depth(name)),
+			queue(this->depth),
+			execute(func),
+			stats(Telemetry::get(name)),
+			trace_id(Trace::get_id(name))
 	{
 		thread = std::thread(&Thread::loop, this, name);
 	}
 	
 	virtual ~Thread() {
-		close();
+		try {
+			close();
+		} catch(...) {
+			// failure was already reported by wait() or close()
+		}
 	}
 	
 	// thread-safe
 	void take(T& data) override {
-		std::unique_lock<std::mutex> lock(mutex);
-		while(do_run && is_avail) {
-			signal.wait(lock);
-		}
 		if(!do_run) {
 			return;
 		}
-		is_avail = true;
-		input = std::move(data);
-		
-		if(is_busy) {
-			// wait for thread to take new input (no triple buffering)
-			while(do_run && is_avail && is_busy) {
-				signal.notify_all();
-				signal.wait(lock);
-			}
-		} else {
-			// simple notify since thread is just waiting for new input
-			lock.unlock();
-			signal.notify_all();
+		blocked_timer_t timer;
+		num_pending++;
+		parker.await([this, &data]() -> bool {
+			return !do_run || queue.try_push(data);
+		});
+		if(!do_run) {
+			num_pending--;
+			return;
 		}
+		parker.wake();
+		parker.await([this]() -> bool {
+			return !do_run || num_pending <= depth;
+		});
 	}
 	
 	// wait for thread to finish all pending input [thread-safe]
 	void wait() {
-		std::unique_lock<std::mutex> lock(mutex);
-		while(do_run && (is_avail || is_busy)) {
-			signal.wait(lock);
-		}
+		parker.await([this]() -> bool {
+			return !do_run || !num_pending;
+		});
 		if(is_fail) {
+			std::lock_guard<std::mutex> lock(mutex);
 			throw std::runtime_error("thread failed with: " + ex_what);
 		}
 	}
 	
 	// NOT thread-safe
 	void close() {
-		wait();
-		std::unique_lock<std::mutex> lock(mutex);
+		parker.await([this]() -> bool {
+			return !do_run || !num_pending;
+		});
 		do_run = false;
+		parker.wake();
 		if(thread.joinable()) {
-			lock.unlock();
-			signal.notify_all();
 			thread.join();
 		}
+		if(is_fail) {
+			throw std::runtime_error("thread failed with: " + ex_what);
+		}
 	}
 	
 private:
 	void loop(const std::string& name) noexcept
 	{
-		if(!name.empty()) {
-			std::string thread_name = name;
-			// limit the name to 15 chars, otherwise pthread_setname_np() fails
-			if(thread_name.size() > 15) {
-				thread_name.resize(15);
-			}
-#ifdef _GNU_SOURCE
-			pthread_setname_np(pthread_self(), thread_name.c_str());
-#endif
-		}
-		std::unique_lock<std::mutex> lock(mutex);
+		set_thread_name(name);
+		
+		T tmp;
+		stage_timer_t timer(stats, trace_id);
 		while(true) {
-			while(do_run && !is_avail) {
-				signal.notify_all();	// notify about is_busy change
-				signal.wait(lock);
-			}
+			parker.await([this, &tmp]() -> bool {
+				return !do_run || queue.try_pop(tmp);
+			});
 			if(!do_run) {
 				break;
 			}
-			T tmp = std::move(input);
-			is_avail = false;
-			is_busy = true;
-			lock.unlock();
-			signal.notify_all();		// notify about is_busy + is_avail change
+			parker.wake();		// notify about free slot
+			timer.input();
 			try {
 				execute(tmp);
-				lock.lock();
+				timer.done();
 			} catch(const std::exception& ex) {
-				lock.lock();
-				do_run = false;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					ex_what = ex.what();
+				}
 				is_fail = true;
-				ex_what = ex.what();
+				do_run = false;
 			}
-			is_busy = false;
+			tmp = T();
+			num_pending--;
+			parker.wake();		// notify about num_pending + do_run change
 		}
-		signal.notify_all();		// notify about do_run + is_fail + is_busy change
 	}
 	
 private:
-	T input;
-	bool do_run = true;
-	bool is_fail = false;
-	bool is_busy = false;
-	bool is_avail = false;
+	const uint64_t depth;
+	RingQueue<T> queue;
+	Parker parker;
+	std::atomic<bool> do_run {true};
+	std::atomic<bool> is_fail {false};
+	std::atomic<uint64_t> num_pending {0};		// queued or in progress
 	std::mutex mutex;
 	std::thread thread;
-	std::condition_variable signal;
 	std::function<void(T&)> execute;
+	stage_stats_t* stats = nullptr;
+	int trace_id = -1;
 	std::string ex_what;
 	
 };
@@ -9,126 +9,453 @@
 #define INCLUDE_CHIA_THREADPOOL_H_
 
 #include <chia/Thread.h>
+#include <chia/numa.h>
 
+#include <map>
+#include <deque>
 #include <vector>
 #include <memory>
 
 
+/*
+ * Any idle worker takes the next job, results are passed to output in order of take().
+ * At most max_window jobs are in flight, so one slow job only stalls the pool once
+ * the others are that far ahead.
+ *
+ * With NUMA enabled workers are bound to nodes round-robin, there is one job queue per node
+ * and workers only take from another node's queue when their own is empty.
+ * Locals are constructed by the worker, so they are allocated on its node.
+ *
+ * With is_round_robin job i always goes to worker i % num_threads instead, for stages
+ * where each worker's local state expects to see every n-th job (ie. phase3/merge).
+ */
 template<typename T, typename S, typename L = size_t>
 class ThreadPool : public Processor<T> {
 private:
-	struct thread_t {
-		uint64_t job = -1;
-		std::mutex mutex;
-		std::condition_variable signal;
-		std::shared_ptr<Thread<T>> thread;
-		L local;
+	struct worker_t {
+		std::thread thread;
+		std::unique_ptr<L> local;
+		int index = 0;
+		int node = -1;
 	};
 	
 public:
 	ThreadPool(	const std::function<void(T&, S&, L&)>& func, Processor<S>* output,
-				const int num_threads, const std::string& name = "")
-		:	output(output),
-			execute(func)
+				const int num_threads, const std::string& name = "", const int max_window = 0,
+				const bool is_round_robin = false)
+		:	max_window(max_window > 0 ? max_window : 2 * num_threads),
+			is_round_robin(is_round_robin),
+			output(output),
+			execute(func),
+			stats(Telemetry::get(name)),
+			trace_id(Trace::get_id(name)),
+			jobs(is_round_robin ? std::max(num_threads, 1) : Numa::num_nodes())
 	{
 		if(num_threads < 1) {
 			throw std::logic_error("num_threads < 1");
 		}
 		for(int i = 0; i < num_threads; ++i) {
-			threads.push_back(std::make_shared<thread_t>());
+			auto worker = std::make_shared<worker_t>();
+			worker->index = i;
+			if(Numa::num_nodes() > 1) {
+				worker->node = Numa::node_of(i);
+			}
+			workers.push_back(worker);
 		}
 		for(int i = 0; i < num_threads; ++i) {
-			threads[i]->thread = std::make_shared<Thread<T>>(
-					std::bind(&ThreadPool::wrapper, this,
-							threads[i].get(),
-							threads[((i + num_threads) - 1) % num_threads].get(),
-							std::placeholders::_1),
+			workers[i]->thread = std::thread(&ThreadPool::loop, this, workers[i].get(),
 					name.empty() ? name : name + "/" + std::to_string(i));
 		}
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while(num_ready < workers.size()) {
+				signal.wait(lock);
+			}
+		}
+		if(is_fail) {
+			close();	// joins the workers and throws
+		}
 	}
 	
 	~ThreadPool() {
-		close();
+		try {
+			close();
+		} catch(...) {
+			// failure was already reported by take() or wait()
+		}
 	}
 	
 	// NOT thread-safe
 	void take(T& data) override {
-		const auto& state = threads[next % threads.size()];
-		state->thread->wait();
-		{
-			std::lock_guard<std::mutex> lock(state->mutex);
-			state->job = next;
+		take_on(data, -1);
+	}
+	
+	// prefers workers on node, any if node < 0, ignored when round-robin [NOT thread-safe]
+	void take_on(T& data, const int node) {
+		blocked_timer_t timer;
+		std::unique_lock<std::mutex> lock(mutex);
+		while(do_run && next - num_emitted >= max_window) {
+			signal.wait(lock);
 		}
-		state->thread->take(data);
+		check_fail();
+		if(!do_run) {
+			return;
+		}
+		jobs[(node >= 0 && !is_round_robin ? node : next) % jobs.size()].emplace_back(next, std::move(data));
 		next++;
+		num_jobs++;
+		lock.unlock();
+		signal.notify_all();
 	}
 	
 	// NOT thread-safe
 	void wait() {
-		for(const auto& state : threads) {
-			state->thread->wait();
+		std::unique_lock<std::mutex> lock(mutex);
+		while(do_run && num_emitted < next) {
+			signal.wait(lock);
 		}
+		check_fail();
 	}
 	
 	// NOT thread-safe
 	void close() {
-		wait();
-		for(const auto& state : threads) {
-			state->thread->close();
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while(do_run && num_emitted < next) {
+				signal.wait(lock);
+			}
+			do_run = false;
 		}
-		threads.clear();
+		signal.notify_all();
+		for(const auto& worker : workers) {
+			if(worker->thread.joinable()) {
+				worker->thread.join();
+			}
+		}
+		workers.clear();
+		
+		std::lock_guard<std::mutex> lock(mutex);
+		check_fail();
 	}
 	
 	// NOT thread-safe
 	size_t num_threads() const {
-		return threads.size();
+		return workers.size();
 	}
 	
 	// NOT thread-safe
 	L& get_local(size_t index) {
-		const auto& state = threads[index];
-		state->thread->wait();
-		return state->local;
+		wait();
+		return *workers[index]->local;
 	}
 	
 	// NOT thread-safe
 	void set_local(size_t index, L&& value) {
-		const auto& state = threads[index];
-		state->thread->wait();
-		state->local = value;
+		wait();
+		*workers[index]->local = value;
 	}
 	
 private:
-	void wrapper(thread_t* state, thread_t* prev, T& input)
+	void loop(worker_t* worker, const std::string& name) noexcept
 	{
-		uint64_t job = -1;
-		{
-			std::lock_guard<std::mutex> lock(state->mutex);
-			job = state->job;
+		set_thread_name(name);
+		Numa::bind_thread(worker->node);
+		
+		std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+		try {
+			worker->local = std::make_unique<L>();
+			lock.lock();
+		} catch(const std::exception& ex) {
+			lock.lock();
+			fail(ex.what());
 		}
-		S out;
-		execute(input, out, state->local);
-		{
-			std::unique_lock<std::mutex> lock(prev->mutex);
-			while(prev->job < job) {
-				prev->signal.wait(lock);
+		num_ready++;
+		signal.notify_all();
+		
+		stage_timer_t timer(stats, trace_id);
+		while(true) {
+			while(do_run && !has_job(worker)) {
+				signal.wait(lock);
+			}
+			if(!do_run) {
+				break;
+			}
+			auto job = pop_job(worker);
+			lock.unlock();
+			timer.input();
+			
+			S out;
+			try {
+				execute(job.second, out, *worker->local);
+				timer.done();
+				lock.lock();
+			} catch(const std::exception& ex) {
+				lock.lock();
+				fail(ex.what());
+				break;
+			}
+			done.emplace(job.first, std::move(out));
+			if(is_emitting) {
+				continue;		// will be picked up by the emitting thread
 			}
+			is_emitting = true;
+			
+			// only one thread can be here at a time
+			while(do_run && !done.empty() && done.begin()->first == num_emitted) {
+				S tmp = std::move(done.begin()->second);
+				done.erase(done.begin());
+				lock.unlock();
+				try {
+					if(output) {
+						output->take(tmp);
+					}
+					lock.lock();
+				} catch(const std::exception& ex) {
+					lock.lock();
+					fail(ex.what());
+					break;
+				}
+				num_emitted++;
+				signal.notify_all();		// notify about num_emitted change
+			}
+			is_emitting = false;
 		}
-		if(output) {
-			output->take(out);	// only one thread can be at this position
+		lock.unlock();
+		signal.notify_all();
+	}
+	
+	// expects lock on mutex
+	bool has_job(const worker_t* worker) const {
+		return is_round_robin ? !jobs[worker->index].empty() : num_jobs > 0;
+	}
+	
+	// own queue first, expects lock on mutex and has_job()
+	std::pair<uint64_t, T> pop_job(const worker_t* worker) {
+		const int first = is_round_robin ? worker->index : std::max(worker->node, 0);
+		for(size_t i = 0; i < (is_round_robin ? 1 : jobs.size()); ++i) {
+			auto& queue = jobs[(first + i) % jobs.size()];
+			if(!queue.empty()) {
+				auto job = std::move(queue.front());
+				queue.pop_front();
+				num_jobs--;
+				return job;
+			}
 		}
-		{
-			std::lock_guard<std::mutex> lock(state->mutex);
-			state->job = -1;
+		throw std::logic_error("pop_job(): no jobs");
+	}
+	
+	// expects lock on mutex
+	void fail(const std::string& what) {
+		if(!is_fail) {
+			ex_what = what;
+		}
+		is_fail = true;
+		do_run = false;
+		signal.notify_all();
+	}
+	
+	// expects lock on mutex
+	void check_fail() const {
+		if(is_fail) {
+			throw std::runtime_error("thread failed with: " + ex_what);
 		}
-		state->signal.notify_all();
 	}
 	
 private:
+	const uint64_t max_window;
+	const bool is_round_robin;
+	Processor<S>* output = nullptr;
+	std::function<void(T&, S&, L&)> execute;
+	stage_stats_t* stats = nullptr;
+	int trace_id = -1;
+	std::vector<std::shared_ptr<worker_t>> workers;
+	
+	std::mutex mutex;
+	std::condition_variable signal;
+	bool do_run = true;
+	bool is_fail = false;
+	bool is_emitting = false;
 	uint64_t next = 0;
+	uint64_t num_emitted = 0;
+	uint64_t num_jobs = 0;
+	size_t num_ready = 0;
+	std::vector<std::deque<std::pair<uint64_t, T>>> jobs;		// per node, or per worker when round-robin
+	std::map<uint64_t, S> done;		// reorder buffer
+	std::string ex_what;
+	
+};
+
+
+
+/*
+ * For sinks where order does not matter: no reorder buffer, each worker passes its result
+ * to output directly, which therefore needs to be thread-safe (ie. Thread or another
+ * UnorderedThreadPool). At most max_queue jobs are waiting.
+ * Workers are bound to NUMA nodes like in ThreadPool, with a single queue.
+ */
+template<typename T, typename S = size_t, typename L = size_t>
+class UnorderedThreadPool : public Processor<T> {
+private:
+	struct worker_t {
+		std::thread thread;
+		int node = -1;
+	};
+	
+public:
+	UnorderedThreadPool(const std::function<void(T&, S&, L&)>& func, Processor<S>* output,
+						const int num_threads, const std::string& name = "", const int max_queue = 0)
+		:	max_queue(max_queue > 0 ? max_queue : 2 * num_threads),
+			output(output),
+			execute(func),
+			stats(Telemetry::get(name)),
+			trace_id(Trace::get_id(name))
+	{
+		if(num_threads < 1) {
+			throw std::logic_error("num_threads < 1");
+		}
+		for(int i = 0; i < num_threads; ++i) {
+			auto worker = std::make_shared<worker_t>();
+			if(Numa::num_nodes() > 1) {
+				worker->node = Numa::node_of(i);
+			}
+			workers.push_back(worker);
+		}
+		for(int i = 0; i < num_threads; ++i) {
+			workers[i]->thread = std::thread(&UnorderedThreadPool::loop, this, workers[i].get(),
+					name.empty() ? name : name + "/" + std::to_string(i));
+		}
+	}
+	
+	~UnorderedThreadPool() {
+		try {
+			close();
+		} catch(...) {
+			// failure was already reported by take() or wait()
+		}
+	}
+	
+	// thread-safe
+	void take(T& data) override {
+		blocked_timer_t timer;
+		std::unique_lock<std::mutex> lock(mutex);
+		while(do_run && jobs.size() >= max_queue) {
+			signal.wait(lock);
+		}
+		check_fail();
+		if(!do_run) {
+			return;
+		}
+		jobs.push_back(std::move(data));
+		num_pending++;
+		lock.unlock();
+		signal.notify_all();
+	}
+	
+	// thread-safe
+	void wait() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while(do_run && num_pending) {
+			signal.wait(lock);
+		}
+		check_fail();
+	}
+	
+	// NOT thread-safe
+	void close() {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while(do_run && num_pending) {
+				signal.wait(lock);
+			}
+			do_run = false;
+		}
+		signal.notify_all();
+		for(const auto& worker : workers) {
+			if(worker->thread.joinable()) {
+				worker->thread.join();
+			}
+		}
+		workers.clear();
+		
+		std::lock_guard<std::mutex> lock(mutex);
+		check_fail();
+	}
+	
+	// NOT thread-safe
+	size_t num_threads() const {
+		return workers.size();
+	}
+	
+private:
+	void loop(worker_t* worker, const std::string& name) noexcept
+	{
+		set_thread_name(name);
+		Numa::bind_thread(worker->node);
+		
+		L local;		// allocated on this node
+		stage_timer_t timer(stats, trace_id);
+		std::unique_lock<std::mutex> lock(mutex);
+		while(true) {
+			while(do_run && jobs.empty()) {
+				signal.wait(lock);
+			}
+			if(!do_run) {
+				break;
+			}
+			T input = std::move(jobs.front());
+			jobs.pop_front();
+			lock.unlock();
+			signal.notify_all();		// notify about jobs.size() change
+			timer.input();
+			
+			try {
+				S out;
+				execute(input, out, local);
+				if(output) {
+					output->take(out);
+				}
+				timer.done();
+				lock.lock();
+			} catch(const std::exception& ex) {
+				lock.lock();
+				if(!is_fail) {
+					ex_what = ex.what();
+				}
+				is_fail = true;
+				do_run = false;
+				break;
+			}
+			num_pending--;
+			if(!num_pending) {
+				signal.notify_all();
+			}
+		}
+		lock.unlock();
+		signal.notify_all();
+	}
+	
+	// expects lock on mutex
+	void check_fail() const {
+		if(is_fail) {
+			throw std::runtime_error("thread failed with: " + ex_what);
+		}
+	}
+	
+private:
+	const size_t max_queue;
 	Processor<S>* output = nullptr;
 	std::function<void(T&, S&, L&)> execute;
-	std::vector<std::shared_ptr<thread_t>> threads;
+	stage_stats_t* stats = nullptr;
+	int trace_id = -1;
+	std::vector<std::shared_ptr<worker_t>> workers;
+	
+	std::mutex mutex;
+	std::condition_variable signal;
+	bool do_run = true;
+	bool is_fail = false;
+	uint64_t num_pending = 0;		// queued or in progress
+	std::deque<T> jobs;
+	std::string ex_what;
 	
 };
 
@@ -0,0 +1,160 @@
+/*
+ * Trace.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INCLUDE_CHIA_TRACE_H_
+#define INCLUDE_CHIA_TRACE_H_
+
+#include <chia/settings.h>
+
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+
+
+/*
+ * Chrome trace format recorder (chrome://tracing, ui.perfetto.dev), enabled via g_trace.
+ * Events are buffered per thread until the next write(), which starts a new file.
+ */
+class Trace {
+public:
+	static int64_t now() {
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	
+	// returns id for span(), -1 if disabled [thread-safe]
+	static int get_id(const std::string& name)
+	{
+		if(!g_trace || name.empty()) {
+			return -1;
+		}
+		auto& inst = instance();
+		std::lock_guard<std::mutex> lock(inst.mutex);
+		const auto iter = inst.name_map.find(name);
+		if(iter != inst.name_map.end()) {
+			return iter->second;
+		}
+		const int id = inst.names.size();
+		inst.names.push_back(name);
+		inst.name_map[name] = id;
+		return id;
+	}
+	
+	// records [begin, end) on the calling thread
+	static void span(const int id, const int64_t begin, const int64_t end, const bool is_marker = false)
+	{
+		if(id < 0) {
+			return;
+		}
+		auto& buffer = local();
+		std::lock_guard<std::mutex> lock(buffer.mutex);
+		buffer.events.push_back(event_t{begin, end - begin, id, is_marker});
+	}
+	
+	// records a table / phase marker, which ends now
+	static void mark(const std::string& name, const int64_t duration)
+	{
+		if(g_trace) {
+			const auto end = now();
+			span(get_id(name), end - duration, end, true);
+		}
+	}
+	
+	static void set_thread_name(const std::string& name)
+	{
+		if(g_trace) {
+			auto& buffer = local();
+			std::lock_guard<std::mutex> lock(buffer.mutex);
+			buffer.name = name;
+		}
+	}
+	
+	// writes and drops the events since the last call, timestamps stay relative to the first [thread-safe]
+	static void write(const std::string& file_name)
+	{
+		auto& inst = instance();
+		std::lock_guard<std::mutex> lock(inst.mutex);
+		std::ofstream out(file_name, std::ios::trunc);
+		out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+		bool is_first = true;
+		for(auto iter = inst.buffers.begin(); iter != inst.buffers.end();) {
+			auto& buffer = **iter;
+			std::unique_lock<std::mutex> lock(buffer.mutex);
+			const bool is_exited = iter->use_count() == 1;		// no more events to come
+			if(!buffer.events.empty()) {
+				out << (is_first ? "" : ",") << "\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer.tid
+					<< ", \"args\": {\"name\": \"" << (buffer.name.empty() ? "main" : buffer.name) << "\"}}";
+				is_first = false;
+				for(const auto& event : buffer.events) {
+					out << ",\n{\"name\": \"" << inst.names[event.id] << "\", \"cat\": \"" << (event.is_marker ? "table" : "job")
+						<< "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer.tid
+						<< ", \"ts\": " << event.begin - inst.start << ", \"dur\": " << event.duration << "}";
+				}
+				std::vector<event_t>().swap(buffer.events);
+			}
+			lock.unlock();
+			if(is_exited) {
+				iter = inst.buffers.erase(iter);
+			} else {
+				iter++;
+			}
+		}
+		out << "\n]}" << std::endl;
+		if(!out) {
+			std::cout << "Failed to write " << file_name << std::endl;
+		}
+	}
+	
+private:
+	struct event_t {
+		int64_t begin;
+		int64_t duration;
+		int id;
+		bool is_marker;
+	};
+	
+	struct buffer_t {
+		std::mutex mutex;
+		int tid = 0;
+		std::string name;
+		std::vector<event_t> events;
+	};
+	
+	std::mutex mutex;
+	const int64_t start = now();
+	std::vector<std::string> names;
+	std::map<std::string, int> name_map;
+	int num_threads = 0;
+	std::vector<std::shared_ptr<buffer_t>> buffers;		// kept after thread exit, until written
+	
+	static Trace& instance() {
+		static Trace inst;
+		return inst;
+	}
+	
+	static buffer_t& local()
+	{
+		static thread_local std::shared_ptr<buffer_t> buffer;
+		if(!buffer) {
+			buffer = std::make_shared<buffer_t>();
+			auto& inst = instance();
+			std::lock_guard<std::mutex> lock(inst.mutex);
+			buffer->tid = ++inst.num_threads;
+			inst.buffers.push_back(buffer);
+		}
+		return *buffer;
+	}
+	
+};
+
+
+#endif /* INCLUDE_CHIA_TRACE_H_ */
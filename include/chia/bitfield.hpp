@@ -37,6 +37,14 @@ struct bitfield
         buffer_[bit / 64] |= uint64_t(1) << (bit % 64);
     }
 
+    // plain read-modify-write instead of an atomic OR, the caller needs exclusive access to the word
+    void set_owned(int64_t const bit)
+    {
+        assert(bit / 64 < size_);
+        auto& word = buffer_[bit / 64];
+        word.store(word.load(std::memory_order_relaxed) | (uint64_t(1) << (bit % 64)), std::memory_order_relaxed);
+    }
+
     bool get(int64_t const bit) const
     {
         assert(bit / 64 < size_);
@@ -52,6 +60,13 @@ struct bitfield
 
     int64_t size() const { return size_ * 64; }
 
+    // raw words, only while nobody is setting bits
+    const uint64_t* data() const
+    {
+        static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "atomic<uint64_t> not lock-free");
+        return reinterpret_cast<const uint64_t*>(buffer_.get());
+    }
+
     void swap(bitfield& rhs)
     {
         using std::swap;
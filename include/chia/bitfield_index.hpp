@@ -14,50 +14,122 @@
 
 #pragma once
 
+#include <vector>
 #include <algorithm>
 #include "bitfield.hpp"
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BITFIELD_INDEX_SIMD
+#include <immintrin.h>
+#endif
+
 struct bitfield_index
 {
-    // Cache the number of set bits every kIndexBucket bits.
-    // For a bitfield of size 2^32, this means a 32 MiB index
-    static constexpr int64_t kIndexBucket = 1024;
+    // rank9 layout: two counters for every block of 8 words (one cache line of bits),
+    // the number of set bits before the block and 7 x 9 bits for the words 1 to 7 within the block.
+    // For a bitfield of size 2^32, this means a 128 MiB index
+    static constexpr int64_t kBlockWords = 8;
 
-    bitfield_index(bitfield const& b) : bitfield_(b)
+    // use_simd = false forces the scalar build, for testing
+    bitfield_index(bitfield const& b, bool use_simd = true) : words_(b.data()), size_(b.size())
     {
-        uint64_t counter = 0;
-        index_.reserve(bitfield_.size() / kIndexBucket);
-
-        for (int64_t idx = 0; idx < int64_t(bitfield_.size()); idx += kIndexBucket) {
-            index_.push_back(counter);
-            int64_t const left = std::min(int64_t(bitfield_.size()) - idx, kIndexBucket);
-            counter += bitfield_.count(idx, idx + left);
+        const int64_t num_words = size_ / 64;
+        const int64_t num_full = num_words / kBlockWords;
+        counts_.resize((num_words + kBlockWords - 1) / kBlockWords * 2);
+
+        uint64_t counter = (use_simd ? get_build_blocks() : &build_blocks)(words_, num_full, counts_.data(), 0);
+        if (num_words % kBlockWords) {
+            uint64_t tail[kBlockWords] = {};
+            std::copy(words_ + num_full * kBlockWords, words_ + num_words, tail);
+            build_blocks(tail, 1, counts_.data() + num_full * 2, counter);
         }
     }
 
+    // number of set bits before pos
+    uint64_t rank(uint64_t pos) const
+    {
+        assert(pos < uint64_t(size_));
+        uint64_t const word = pos / 64;
+        uint64_t const* entry = &counts_[(word / kBlockWords) * 2];
+        int64_t const sub = int64_t(word % kBlockWords) - 1;    // -1 shifts to bit 63, which is zero
+        return entry[0] + ((entry[1] >> ((sub + (sub >> 60 & 8)) * 9)) & 0x1FF)
+                + Util::PopCount(words_[word] & ((uint64_t(1) << (pos % 64)) - 1));
+    }
+
     std::pair<uint64_t, uint64_t> lookup(uint64_t pos, uint64_t offset) const
     {
-        uint64_t const bucket = pos / kIndexBucket;
+        assert(pos + offset < uint64_t(size_));
+        assert(get(pos) && get(pos + offset));
 
-        assert(bucket < index_.size());
-        assert(pos < uint64_t(bitfield_.size()));
-        assert(pos + offset < uint64_t(bitfield_.size()));
-        assert(bitfield_.get(pos) && bitfield_.get(pos + offset));
+        uint64_t const pos_count = rank(pos);
+        return { pos_count, rank(pos + offset) - pos_count };
+    }
 
-        uint64_t const base = index_[bucket];
+    // true if the index is built with AVX-512
+    static bool has_simd()
+    {
+        return get_build_blocks() != &build_blocks;
+    }
 
-        int64_t const aligned_pos = pos & ~uint64_t(63);
+private:
+    bool get(uint64_t bit) const
+    {
+        return (words_[bit / 64] >> (bit % 64)) & 1;
+    }
 
-        uint64_t const aligned_pos_count = bitfield_.count(bucket * kIndexBucket, aligned_pos);
-        uint64_t const offset_count = aligned_pos_count + bitfield_.count(aligned_pos, pos + offset);
-        uint64_t const pos_count = aligned_pos_count + bitfield_.count(aligned_pos, pos);
+    // stores the counters of one block, returns the number of set bits up to its end
+    static uint64_t add_block(const uint64_t* count, uint64_t* counts, uint64_t counter)
+    {
+        uint64_t packed = 0;
+        uint64_t sum = 0;
+        for (int i = 1; i < kBlockWords; ++i) {
+            sum += count[i - 1];
+            packed |= sum << (9 * (i - 1));
+        }
+        counts[0] = counter;
+        counts[1] = packed;
+        return counter + sum + count[kBlockWords - 1];
+    }
 
-        assert(offset_count >= pos_count);
+    typedef uint64_t (*build_blocks_t)(const uint64_t* words, int64_t num_blocks, uint64_t* counts, uint64_t counter);
 
-        return { base + pos_count, offset_count - pos_count };
+    static uint64_t build_blocks(const uint64_t* words, int64_t num_blocks, uint64_t* counts, uint64_t counter)
+    {
+        for (int64_t block = 0; block < num_blocks; ++block) {
+            uint64_t count[kBlockWords];
+            for (int i = 0; i < kBlockWords; ++i) {
+                count[i] = Util::PopCount(words[block * kBlockWords + i]);
+            }
+            counter = add_block(count, counts + block * 2, counter);
+        }
+        return counter;
     }
-private:
-    bitfield const& bitfield_;
-    std::vector<uint64_t> index_;
-};
 
+#ifdef BITFIELD_INDEX_SIMD
+    __attribute__((target("avx512f,avx512vpopcntdq")))
+    static uint64_t build_blocks_avx512(const uint64_t* words, int64_t num_blocks, uint64_t* counts, uint64_t counter)
+    {
+        for (int64_t block = 0; block < num_blocks; ++block) {
+            alignas(64) uint64_t count[kBlockWords];
+            _mm512_store_si512(count, _mm512_popcnt_epi64(_mm512_loadu_si512(words + block * kBlockWords)));
+            counter = add_block(count, counts + block * 2, counter);
+        }
+        return counter;
+    }
+#endif
+
+    static build_blocks_t get_build_blocks()
+    {
+#ifdef BITFIELD_INDEX_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512vpopcntdq")) {
+            return &build_blocks_avx512;
+        }
+#endif
+        return &build_blocks;
+    }
+
+    uint64_t const* words_;
+    int64_t size_;
+    std::vector<uint64_t> counts_;
+};
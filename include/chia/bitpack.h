@@ -0,0 +1,200 @@
+/*
+ * bitpack.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INCLUDE_CHIA_BITPACK_H_
+#define INCLUDE_CHIA_BITPACK_H_
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+
+/*
+ * Sequential little-endian bit packing of fields into a byte buffer.
+ * Field values must fit into the given number of bits, at most 64.
+ */
+class bit_writer_t {
+public:
+	bit_writer_t(uint8_t* out) : out(out) {}
+
+	void write(const uint64_t value, const int bits) {
+		if(bits > 56) {
+			write(value & 0xFFFFFFFF, 32);
+			write(value >> 32, bits - 32);
+			return;
+		}
+		buffer |= value << num_bits;
+		num_bits += bits;
+		while(num_bits >= 8) {
+			*out++ = buffer;
+			buffer >>= 8;
+			num_bits -= 8;
+		}
+	}
+
+	void write_bytes(const uint8_t* data, const size_t count) {
+		if(num_bits == 0) {
+			memcpy(out, data, count);
+			out += count;
+			return;
+		}
+		for(size_t i = 0; i < count; ++i) {
+			write(data[i], 8);
+		}
+	}
+
+	// writes the last partial byte, returns end of output
+	uint8_t* flush() {
+		if(num_bits) {
+			*out++ = buffer;
+			buffer = 0;
+			num_bits = 0;
+		}
+		return out;
+	}
+
+private:
+	uint8_t* out = nullptr;
+	uint64_t buffer = 0;
+	int num_bits = 0;
+
+};
+
+class bit_reader_t {
+public:
+	bit_reader_t(const uint8_t* in) : in(in) {}
+
+	uint64_t read(const int bits) {
+		if(bits > 56) {
+			const uint64_t low = read(32);
+			return low | (read(bits - 32) << 32);
+		}
+		while(num_bits < bits) {
+			buffer |= uint64_t(*in++) << num_bits;
+			num_bits += 8;
+		}
+		const uint64_t value = bits < 64 ? buffer & ((uint64_t(1) << bits) - 1) : buffer;
+		buffer >>= bits;
+		num_bits -= bits;
+		return value;
+	}
+
+	void read_bytes(uint8_t* data, const size_t count) {
+		if(num_bits == 0) {
+			memcpy(data, in, count);
+			in += count;
+			return;
+		}
+		for(size_t i = 0; i < count; ++i) {
+			data[i] = read(8);
+		}
+	}
+
+private:
+	const uint8_t* in = nullptr;
+	uint64_t buffer = 0;
+	int num_bits = 0;
+
+};
+
+// number of bytes needed for bits
+constexpr size_t bitpack_size(const size_t bits) {
+	return (bits + 7) / 8;
+}
+
+/*
+ * Compile-time description of an on-disk entry, as a list of fields packed in order:
+ *   typedef bit_layout_t<bit_field_t<&entry_t::y, 38>, byte_field_t<&entry_t::meta>> layout;
+ * The first field is the sort key, see bucket_key_layout_t.
+ */
+template<auto Member, int Bits>
+struct bit_field_t {
+	static_assert(Bits > 0 && Bits <= 64, "invalid field width");
+	
+	static constexpr int bits = Bits;
+	
+	template<typename T>
+	static uint64_t get(const T& entry) {
+		return entry.*Member;
+	}
+	template<typename T>
+	static void set(T& entry, const uint64_t value) {
+		entry.*Member = value;
+	}
+	template<typename T>
+	static void write(const T& entry, bit_writer_t& out) {
+		out.write(get(entry), Bits);
+	}
+	template<typename T>
+	static void read(T& entry, bit_reader_t& in) {
+		set(entry, in.read(Bits));
+	}
+};
+
+template<typename M>
+struct byte_array_size;
+
+template<typename C, size_t N>
+struct byte_array_size<std::array<uint8_t, N> C::*> {
+	static constexpr size_t value = N;
+};
+
+template<auto Member>
+struct byte_field_t {
+	static constexpr size_t num_bytes = byte_array_size<decltype(Member)>::value;
+	static constexpr int bits = num_bytes * 8;
+	
+	template<typename T>
+	static void write(const T& entry, bit_writer_t& out) {
+		out.write_bytes((entry.*Member).data(), num_bytes);
+	}
+	template<typename T>
+	static void read(T& entry, bit_reader_t& in) {
+		in.read_bytes((entry.*Member).data(), num_bytes);
+	}
+};
+
+template<typename... Fields>
+struct bit_layout_t {
+	static constexpr int num_bits = (0 + ... + Fields::bits);
+	static constexpr size_t disk_size = bitpack_size(num_bits);
+	
+	template<typename T>
+	static void write(const T& entry, bit_writer_t& out) {
+		(Fields::write(entry, out), ...);
+	}
+	template<typename T>
+	static void read(T& entry, bit_reader_t& in) {
+		(Fields::read(entry, in), ...);
+	}
+	template<typename T>
+	static size_t write(const T& entry, uint8_t* buf) {
+		bit_writer_t out(buf);
+		write(entry, out);
+		out.flush();
+		return disk_size;
+	}
+	template<typename T>
+	static size_t read(T& entry, const uint8_t* buf) {
+		bit_reader_t in(buf);
+		read(entry, in);
+		return disk_size;
+	}
+};
+
+// first field and the rest
+template<typename Layout>
+struct bit_layout_split;
+
+template<typename First, typename... Rest>
+struct bit_layout_split<bit_layout_t<First, Rest...>> {
+	typedef First head;
+	typedef bit_layout_t<Rest...> tail;
+};
+
+
+#endif /* INCLUDE_CHIA_BITPACK_H_ */
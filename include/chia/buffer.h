@@ -10,13 +10,15 @@
 
 #include <chia/settings.h>
 
+#include <vector>
+
 
 template<typename T>
 struct byte_buffer_t {
 	size_t count = 0;
 	const size_t capacity;
 	uint8_t* data = nullptr;
-	static constexpr size_t entry_size = T::disk_size;
+	size_t entry_size = T::disk_size;		// can be reduced, see bucket_layout_t
 	
 	byte_buffer_t(const size_t capacity) : capacity(capacity) {
 		data = new uint8_t[capacity * entry_size];
@@ -41,5 +43,24 @@ struct write_buffer_t : byte_buffer_t<T> {
 	write_buffer_t() : byte_buffer_t<T>(g_write_chunk_size) {}
 };
 
+/*
+ * Read-only view of count entries owned by someone else.
+ */
+template<typename T>
+struct span_t {
+	const T* data = nullptr;
+	size_t count = 0;
+	
+	span_t() = default;
+	span_t(const T* data, const size_t count) : data(data), count(count) {}
+	span_t(const std::vector<T>& vec) : data(vec.data()), count(vec.size()) {}
+	
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	const T* begin() const { return data; }
+	const T* end() const { return data + count; }
+	const T& operator[](const size_t i) const { return data[i]; }
+};
+
 
 #endif /* INCLUDE_CHIA_BUFFER_H_ */
@@ -0,0 +1,252 @@
+/*
+ * checkpoint.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INCLUDE_CHIA_CHECKPOINT_H_
+#define INCLUDE_CHIA_CHECKPOINT_H_
+
+#include <chia/phase1.h>
+#include <chia/Storage.h>
+#include <chia/util.hpp>
+
+#include <array>
+#include <string>
+#include <memory>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+
+
+/*
+ * Manifest of a plot in progress, saved after each table is completed.
+ * Everything else is derived from plot_name and the tmp dirs, same as in a fresh run.
+ *
+ * Tables are counted per phase by the R table they produce:
+ * phase 1: 1 .. 7, phase 2: 7 .. 2 (backwards), phase 3: 2 .. 7.
+ */
+struct checkpoint_t {
+	static constexpr int version = 1;
+	
+	std::string file_name;				// of manifest
+	
+	int phase = 0;						// phase of last completed table
+	int table = 0;						// last completed table
+	int log_num_buckets = 0;
+	int log_num_buckets_3 = 0;
+	std::string tmp_dir;
+	std::string tmp_dir_2;
+	phase1::input_t params;
+	
+	std::array<table_t, 7> table_1;		// phase 1 output
+	table_t table_7;					// phase 2 output
+	std::string bitfield_file;			// phase 2 marks for next table, bitfield_1 in the end
+	
+	std::string plot_file_name;			// phase 3 output
+	int header_size = 0;
+	uint64_t num_written_final = 0;
+	uint64_t num_written_7 = 0;
+	std::array<uint64_t, 8> final_pointers = {};
+	
+	bool is_done(int phase_, int table_) const {
+		if(phase_ != phase) {
+			return phase_ < phase;
+		}
+		return phase_ == 2 ? table_ >= table : table_ <= table;
+	}
+	
+	// called after the next save(), to delete inputs which are not needed anymore
+	void after_save(const std::function<void()>& func) {
+		pending.push_back(func);
+	}
+	
+	void save(int phase_, int table_)
+	{
+		phase = phase_;
+		table = table_;
+		
+		const std::string tmp_name = file_name + ".tmp";
+		{
+			std::ofstream out(tmp_name, std::ios::trunc);
+			out << "version " << version << std::endl;
+			out << "phase " << phase << std::endl;
+			out << "table " << table << std::endl;
+			out << "log_num_buckets " << log_num_buckets << std::endl;
+			out << "log_num_buckets_3 " << log_num_buckets_3 << std::endl;
+			out << "tmp_dir " << tmp_dir << std::endl;
+			out << "tmp_dir_2 " << tmp_dir_2 << std::endl;
+			out << "plot_name " << params.plot_name << std::endl;
+			out << "id " << Util::HexStr(params.id.data(), params.id.size()) << std::endl;
+			out << "memo " << Util::HexStr(params.memo.data(), params.memo.size()) << std::endl;
+			for(size_t i = 0; i < table_1.size(); ++i) {
+				out << "p1.table" << (i + 1) << " " << table_1[i].num_entries << " " << table_1[i].file_name << std::endl;
+			}
+			out << "p2.table7 " << table_7.num_entries << " " << table_7.file_name << std::endl;
+			out << "p2.bitfield " << bitfield_file << std::endl;
+			out << "p3.plot_file " << plot_file_name << std::endl;
+			out << "p3.header_size " << header_size << std::endl;
+			out << "p3.num_written_final " << num_written_final << std::endl;
+			out << "p3.num_written_7 " << num_written_7 << std::endl;
+			out << "p3.final_pointers";
+			for(const auto& value : final_pointers) {
+				out << " " << value;
+			}
+			out << std::endl;
+			if(!out) {
+				throw std::runtime_error("failed to write " + tmp_name);
+			}
+		}
+#ifdef _WIN32
+		std::remove(file_name.c_str());
+#endif
+		if(std::rename(tmp_name.c_str(), file_name.c_str())) {
+			throw std::runtime_error("failed to rename " + tmp_name);
+		}
+		const auto list = std::move(pending);
+		pending.clear();
+		for(const auto& func : list) {
+			func();
+		}
+	}
+	
+	void load(const std::string& file_name_)
+	{
+		std::ifstream in(file_name_);
+		if(!in) {
+			throw std::runtime_error("failed to open " + file_name_);
+		}
+		*this = checkpoint_t();
+		file_name = file_name_;
+		
+		int version_ = 0;
+		std::string line;
+		while(std::getline(in, line)) {
+			const auto pos = line.find(' ');
+			const std::string key = line.substr(0, pos);
+			const std::string value = pos != std::string::npos ? line.substr(pos + 1) : std::string();
+			std::istringstream stream(value);
+			
+			if(key == "version") {
+				stream >> version_;
+			} else if(key == "phase") {
+				stream >> phase;
+			} else if(key == "table") {
+				stream >> table;
+			} else if(key == "log_num_buckets") {
+				stream >> log_num_buckets;
+			} else if(key == "log_num_buckets_3") {
+				stream >> log_num_buckets_3;
+			} else if(key == "tmp_dir") {
+				tmp_dir = value;
+			} else if(key == "tmp_dir_2") {
+				tmp_dir_2 = value;
+			} else if(key == "plot_name") {
+				params.plot_name = value;
+			} else if(key == "id") {
+				const auto bytes = hex_to_bytes(value);
+				if(bytes.size() != params.id.size()) {
+					throw std::runtime_error("invalid id in " + file_name);
+				}
+				std::copy(bytes.begin(), bytes.end(), params.id.begin());
+			} else if(key == "memo") {
+				params.memo = hex_to_bytes(value);
+			} else if(key.compare(0, 8, "p1.table") == 0) {
+				const int index = std::atoi(key.c_str() + 8);
+				if(index < 1 || index > int(table_1.size())) {
+					throw std::runtime_error("invalid key in " + file_name + ": " + key);
+				}
+				read_table(value, table_1[index - 1]);
+			} else if(key == "p2.table7") {
+				read_table(value, table_7);
+			} else if(key == "p2.bitfield") {
+				bitfield_file = value;
+			} else if(key == "p3.plot_file") {
+				plot_file_name = value;
+			} else if(key == "p3.header_size") {
+				stream >> header_size;
+			} else if(key == "p3.num_written_final") {
+				stream >> num_written_final;
+			} else if(key == "p3.num_written_7") {
+				stream >> num_written_7;
+			} else if(key == "p3.final_pointers") {
+				for(auto& value : final_pointers) {
+					stream >> value;
+				}
+			}
+		}
+		if(version_ != version) {
+			throw std::runtime_error("unsupported manifest version: " + std::to_string(version_));
+		}
+		if(params.plot_name.empty()) {
+			throw std::runtime_error("invalid manifest: " + file_name);
+		}
+	}
+	
+	// deletes the manifest, when the plot is finished
+	void remove() const {
+		std::remove(file_name.c_str());
+		std::remove((file_name + ".tmp").c_str());
+	}
+	
+private:
+	static void read_table(const std::string& value, table_t& table) {
+		const auto pos = value.find(' ');
+		table.num_entries = std::strtoull(value.c_str(), nullptr, 10);
+		table.file_name = pos != std::string::npos ? value.substr(pos + 1) : std::string();
+	}
+	
+private:
+	std::vector<std::function<void()>> pending;
+	
+};
+
+
+/*
+ * Creates a new sort, or opens the files of a sort that was finished before the checkpoint.
+ * When checkpointing, files are kept until released.
+ */
+template<typename DS>
+std::shared_ptr<DS> open_sort(	const checkpoint_t* checkpoint, bool is_done,
+								int key_size, int log_num_buckets, const std::string& file_prefix)
+{
+	auto sort = std::make_shared<DS>(key_size, log_num_buckets, file_prefix, is_done);
+	sort->set_keep_files(checkpoint);
+	return sort;
+}
+
+/*
+ * Drops a sort which has been read, its files are deleted after the next checkpoint.
+ */
+template<typename DS>
+void release_sort(checkpoint_t* checkpoint, std::shared_ptr<DS>& sort)
+{
+	if(checkpoint && sort) {
+		const auto tmp = sort;
+		checkpoint->after_save([tmp]() {
+			tmp->set_keep_files(false);
+			tmp->close();
+		});
+	}
+	sort = nullptr;
+}
+
+/*
+ * Deletes a segment which has been read, after the next checkpoint.
+ */
+inline
+void release_segment(checkpoint_t* checkpoint, const std::string& file_name)
+{
+	if(checkpoint) {
+		checkpoint->after_save([file_name]() {
+			remove_segment(file_name);
+		});
+	} else {
+		remove_segment(file_name);
+	}
+}
+
+
+#endif /* INCLUDE_CHIA_CHECKPOINT_H_ */
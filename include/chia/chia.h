@@ -38,7 +38,7 @@ static constexpr uint16_t kBC = kB * kC;
 // This (times k) is the length of the metadata that must be kept for each entry. For example,
 // for a table 4 entry, we must keep 4k additional bits for each entry, which is used to
 // compute f5.
-static const uint8_t kVectorLens[] = {0, 0, 1, 2, 4, 4, 3, 2};
+static constexpr uint8_t kVectorLens[] = {0, 0, 1, 2, 4, 4, 3, 2};
 
 // The number of bits in the stub is k minus this value
 static constexpr uint8_t kStubMinusBits = 3;
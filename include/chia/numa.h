@@ -0,0 +1,128 @@
+/*
+ * numa.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INCLUDE_CHIA_NUMA_H_
+#define INCLUDE_CHIA_NUMA_H_
+
+#include <chia/settings.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdlib>
+
+#if defined(__linux__) && defined(_GNU_SOURCE)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+/*
+ * NUMA topology from /sys/devices/system/node (no libnuma needed).
+ * Memory is placed by first touch, so buffers allocated by a bound thread stay on its node.
+ */
+class Numa {
+public:
+	// CPUs per node, empty if unknown [thread-safe]
+	static const std::vector<std::vector<int>>& get_nodes()
+	{
+		static const std::vector<std::vector<int>> nodes = parse_nodes();
+		return nodes;
+	}
+	
+	// number of nodes to spread over, 1 unless enabled via g_numa [thread-safe]
+	static int num_nodes()
+	{
+		if(!g_numa) {
+			return 1;
+		}
+		const auto& nodes = get_nodes();
+		return nodes.empty() ? 1 : int(nodes.size());
+	}
+	
+	// round-robin assignment, ie. of workers or buckets
+	static int node_of(const size_t index) {
+		return int(index % num_nodes());
+	}
+	
+	// pins the calling thread to the CPUs of node, if enabled
+	static void bind_thread(const int node)
+	{
+		if(node < 0 || num_nodes() < 2) {
+			return;
+		}
+#if defined(__linux__) && defined(_GNU_SOURCE)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for(const int cpu : get_nodes()[node]) {
+			if(cpu < CPU_SETSIZE) {
+				CPU_SET(cpu, &set);
+			}
+		}
+		if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+			current() = node;
+		}
+#endif
+	}
+	
+	// node of the calling thread, -1 if not bound
+	static int current_node() {
+		return current();
+	}
+	
+	// parses "0-3,8,10-11"
+	static std::vector<int> parse_list(const std::string& str)
+	{
+		std::vector<int> out;
+		size_t pos = 0;
+		while(pos < str.size()) {
+			auto end = str.find(',', pos);
+			if(end == std::string::npos) {
+				end = str.size();
+			}
+			const auto range = str.substr(pos, end - pos);
+			const auto dash = range.find('-');
+			const int first = std::atoi(range.c_str());
+			const int last = dash != std::string::npos ? std::atoi(range.c_str() + dash + 1) : first;
+			if(!range.empty() && range[0] >= '0' && range[0] <= '9') {
+				for(int i = first; i <= last; ++i) {
+					out.push_back(i);
+				}
+			}
+			pos = end + 1;
+		}
+		return out;
+	}
+	
+private:
+	static int& current() {
+		static thread_local int node = -1;
+		return node;
+	}
+	
+	static std::vector<std::vector<int>> parse_nodes()
+	{
+		std::vector<std::vector<int>> nodes;
+#ifdef __linux__
+		const std::string path = "/sys/devices/system/node/";
+		std::string online;
+		std::ifstream(path + "online") >> online;
+		for(const int id : parse_list(online)) {
+			std::string cpus;
+			std::ifstream(path + "node" + std::to_string(id) + "/cpulist") >> cpus;
+			const auto list = parse_list(cpus);
+			if(!list.empty()) {
+				nodes.push_back(list);		// memory-only nodes are skipped
+			}
+		}
+#endif
+		return nodes;
+	}
+	
+};
+
+
+#endif /* INCLUDE_CHIA_NUMA_H_ */
@@ -12,8 +12,10 @@
 #include <chia/entries.h>
 #include <chia/DiskSort.h>
 #include <chia/util.hpp>
+#include <chia/bitpack.h>
 
 #include <array>
+#include <memory>
 #include <vector>
 #include <cstdio>
 #include <cstdint>
@@ -34,18 +36,18 @@ struct entry_1 {
 	
 	static constexpr uint32_t pos = 0;		// dummy
 	static constexpr uint16_t off = 0;		// dummy
-	static constexpr size_t disk_size = 9;
+	
+	typedef bit_layout_t<
+		bit_field_t<&entry_1::y, 38>,
+		bit_field_t<&entry_1::x, 32>> layout;
+	
+	static constexpr size_t disk_size = layout::disk_size;
 	
 	size_t read(const uint8_t* buf) {
-		y = 0;
-		memcpy(&y, buf, 5);
-		memcpy(&x, buf + 5, 4);
-		return disk_size;
+		return layout::read(*this, buf);
 	}
 	size_t write(uint8_t* buf) const {
-		memcpy(buf, &y, 5);
-		memcpy(buf + 5, &x, 4);
-		return disk_size;
+		return layout::write(*this, buf);
 	}
 };
 
@@ -59,25 +61,19 @@ template<int N>
 struct entry_xm : entry_x {
 	std::array<uint8_t, N * 4> meta;
 	
-	static constexpr size_t disk_size = 10 + N * 4;
+	typedef bit_layout_t<
+		bit_field_t<&entry_xm::y, 38>,
+		bit_field_t<&entry_xm::off, 10>,
+		bit_field_t<&entry_xm::pos, 32>,
+		byte_field_t<&entry_xm::meta>> layout;
+	
+	static constexpr size_t disk_size = layout::disk_size;
 	
 	size_t read(const uint8_t* buf) {
-		memcpy(&y, buf, 5);
-		y &= 0x3FFFFFFFFFull;
-		off = 0;
-		off |= buf[4] >> 6;
-		off |= uint16_t(buf[5]) << 2;
-		memcpy(&pos, buf + 6, 4);
-		memcpy(meta.data(), buf + 10, sizeof(meta));
-		return disk_size;
+		return layout::read(*this, buf);
 	}
 	size_t write(uint8_t* buf) const {
-		memcpy(buf, &y, 5);
-		buf[4] = (off << 6) | (buf[4] & 0x3F);
-		buf[5] = off >> 2;
-		memcpy(buf + 6, &pos, 4);
-		memcpy(buf + 10, meta.data(), sizeof(meta));
-		return disk_size;
+		return layout::write(*this, buf);
 	}
 };
 
@@ -92,40 +88,40 @@ struct entry_7 {
 	uint32_t pos;		// 32 bit
 	uint16_t off;		// 10 bit
 	
-	static constexpr size_t disk_size = 10;
+	typedef bit_layout_t<
+		bit_field_t<&entry_7::y, 32>,
+		bit_field_t<&entry_7::pos, 32>,
+		bit_field_t<&entry_7::off, 10>> layout;
+	
+	static constexpr size_t disk_size = layout::disk_size;
 	
 	void assign(const entry_7& entry) {
 		*this = entry;
 	}
 	size_t read(const uint8_t* buf) {
-		memcpy(&y, buf, 4);
-		memcpy(&pos, buf + 4, 4);
-		memcpy(&off, buf + 8, 2);
-		return disk_size;
+		return layout::read(*this, buf);
 	}
 	size_t write(uint8_t* buf) const {
-		memcpy(buf, &y, 4);
-		memcpy(buf + 4, &pos, 4);
-		memcpy(buf + 8, &off, 2);
-		return disk_size;
+		return layout::write(*this, buf);
 	}
 };
 
 struct tmp_entry_1 {
 	uint32_t x;			// 32 bit
 	
-	static constexpr size_t disk_size = 4;
+	typedef bit_layout_t<
+		bit_field_t<&tmp_entry_1::x, 32>> layout;
+	
+	static constexpr size_t disk_size = layout::disk_size;
 	
 	void assign(const entry_1& entry) {
 		x = entry.x;
 	}
 	size_t read(const uint8_t* buf) {
-		memcpy(&x, buf, 4);
-		return disk_size;
+		return layout::read(*this, buf);
 	}
 	size_t write(uint8_t* buf) const {
-		memcpy(buf, &x, 4);
-		return disk_size;
+		return layout::write(*this, buf);
 	}
 };
 
@@ -133,21 +129,21 @@ struct tmp_entry_x {
 	uint32_t pos;		// 32 bit
 	uint16_t off;		// 10 bit
 	
-	static constexpr size_t disk_size = 6;
+	typedef bit_layout_t<
+		bit_field_t<&tmp_entry_x::pos, 32>,
+		bit_field_t<&tmp_entry_x::off, 10>> layout;
+	
+	static constexpr size_t disk_size = layout::disk_size;
 	
 	void assign(const entry_x& entry) {
 		pos = entry.pos;
 		off = entry.off;
 	}
 	size_t read(const uint8_t* buf) {
-		memcpy(&pos, buf, 4);
-		memcpy(&off, buf + 4, 2);
-		return disk_size;
+		return layout::read(*this, buf);
 	}
 	size_t write(uint8_t* buf) const {
-		memcpy(buf, &pos, 4);
-		memcpy(buf + 4, &off, 2);
-		return disk_size;
+		return layout::write(*this, buf);
 	}
 };
 
@@ -200,13 +196,33 @@ struct match_t {
 	uint16_t off = 0;
 };
 
-typedef DiskSort<entry_1, get_y<entry_1>> DiskSort1;
-typedef DiskSort<entry_2, get_y<entry_2>> DiskSort2;
-typedef DiskSort<entry_3, get_y<entry_3>> DiskSort3;
-typedef DiskSort<entry_4, get_y<entry_4>> DiskSort4;
-typedef DiskSort<entry_5, get_y<entry_5>> DiskSort5;
-typedef DiskSort<entry_6, get_y<entry_6>> DiskSort6;
-typedef DiskSort<entry_7, get_y<entry_7>> DiskSort7;
+/*
+ * Two adjacent BC groups of table L, shared by all matches between them.
+ * The entries are owned by the chunks they were sliced from.
+ */
+template<typename T>
+struct match_group_t {
+	uint64_t L_offset = 0;			// position of bucket_L[0] in table L
+	span_t<T> bucket_L;
+	span_t<T> bucket_R;
+};
+
+/*
+ * Match by index into a match_group_t, instead of a copy of both entries.
+ */
+struct match_idx_t {
+	uint32_t group = 0;
+	uint16_t idx_L = 0;
+	uint16_t idx_R = 0;
+};
+
+typedef DiskSort<entry_1, get_y<entry_1>, radix_sort_t<entry_1, get_y<entry_1>>> DiskSort1;
+typedef DiskSort<entry_2, get_y<entry_2>, radix_sort_t<entry_2, get_y<entry_2>>> DiskSort2;
+typedef DiskSort<entry_3, get_y<entry_3>, radix_sort_t<entry_3, get_y<entry_3>>> DiskSort3;
+typedef DiskSort<entry_4, get_y<entry_4>, radix_sort_t<entry_4, get_y<entry_4>>> DiskSort4;
+typedef DiskSort<entry_5, get_y<entry_5>, radix_sort_t<entry_5, get_y<entry_5>>> DiskSort5;
+typedef DiskSort<entry_6, get_y<entry_6>, radix_sort_t<entry_6, get_y<entry_6>>> DiskSort6;
+typedef DiskSort<entry_7, get_y<entry_7>, radix_sort_t<entry_7, get_y<entry_7>>> DiskSort7;
 
 struct output_t {
 	input_t params;
@@ -216,4 +232,14 @@ struct output_t {
 
 } // phase1
 
+
+/*
+ * Bucket files store y without the upper bits implied by the bucket index.
+ */
+template<>
+struct bucket_layout_t<phase1::entry_1, phase1::get_y<phase1::entry_1>> : bucket_key_layout_t<phase1::entry_1> {};
+
+template<int N>
+struct bucket_layout_t<phase1::entry_xm<N>, phase1::get_y<phase1::entry_xm<N>>> : bucket_key_layout_t<phase1::entry_xm<N>> {};
+
 #endif /* INCLUDE_CHIA_PHASE1_H_ */
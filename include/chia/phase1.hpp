@@ -11,18 +11,36 @@
 #include <chia/phase1.h>
 #include <chia/ThreadPool.h>
 #include <chia/DiskTable.h>
-#include <chia/bits.hpp>
+#include <chia/checkpoint.h>
+#include <chia/BufferPool.h>
 
 #include "blake3.h"
+#include "blake3_batch.h"
 #include "chacha8.h"
 
+#include <mutex>
+#include <algorithm>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define PHASE1_MATCH_SIMD
+#include <immintrin.h>
+#endif
+
 
 namespace phase1 {
 
 static uint16_t L_targets[2][kBC][kExtraBitsPow];
 
+// (2m + parity)^2 % kC
+static uint32_t L_target_sq[2][kExtraBitsPow];
+
 static void load_tables()
 {
+    for (uint8_t parity = 0; parity < 2; parity++) {
+        for (uint16_t m = 0; m < kExtraBitsPow; m++) {
+            L_target_sq[parity][m] = ((2 * m + parity) * (2 * m + parity)) % kC;
+        }
+    }
     for (uint8_t parity = 0; parity < 2; parity++) {
         for (uint16_t i = 0; i < kBC; i++) {
             uint16_t indJ = i / kC;
@@ -36,7 +54,8 @@ static void load_tables()
 }
 
 static void initialize() {
-	load_tables();
+	static std::once_flag flag;		// plots may run in parallel
+	std::call_once(flag, load_tables);
 }
 
 class F1Calculator {
@@ -54,20 +73,29 @@ public:
 	}
 
 	/*
-	 * x = [index * 16 .. index * 16 + 15]
-	 * block = entry_1[16]
+	 * x = [index * 16 .. (index + num_blocks) * 16 - 1]
+	 * block = entry_1[num_blocks * 16]
 	 */
-	void compute_block(const uint64_t index, entry_1* block)
+	void compute_block(const uint64_t index, const uint32_t num_blocks, entry_1* block)
 	{
-		uint8_t buf[64];
-		chacha8_get_keystream(&enc_ctx_, index, 1, buf);
+		static constexpr uint32_t N = 64;	// ChaCha8 blocks per keystream call
 		
-		for(uint64_t i = 0; i < 16; ++i)
+		uint32_t buf[N * 16];
+		for(uint32_t k = 0; k < num_blocks; k += N)
 		{
-			const uint64_t x = index * 16 + i;
-			const uint64_t y = Util::SliceInt64FromBytes(buf, i * 32, 32);
-			block[i].x = x;
-			block[i].y = (y << kExtraBits) | (x >> (32 - kExtraBits));
+			const uint32_t count = std::min(num_blocks - k, N);
+			chacha8_get_keystream(&enc_ctx_, index + k, count, (uint8_t*)buf);
+			
+			// y = 32-bit big-endian slices of the keystream
+			const uint64_t x_begin = (index + k) * 16;
+			entry_1* out = block + k * 16;
+			for(uint32_t i = 0; i < count * 16; ++i)
+			{
+				const uint64_t x = x_begin + i;
+				const uint64_t y = bswap_32(buf[i]);
+				out[i].x = x;
+				out[i].y = (y << kExtraBits) | (x >> (32 - kExtraBits));
+			}
 		}
 	}
 
@@ -76,14 +104,26 @@ private:
 };
 
 // Class to evaluate F2 .. F7.
-template<typename T, typename S>
+template<int R_index, typename T, typename S>
 class FxCalculator {
 public:
 	static constexpr uint8_t k_ = 32;
+	static constexpr size_t kBatchSize = 64;	// inputs per blake3_hash_single_blocks()
 	
-    FxCalculator(int table_index) {
-        table_index_ = table_index;
-    }
+	// hash input = y + L_meta + R_meta (big-endian bit string)
+	static constexpr int kBitsY = k_ + kExtraBits;
+	static constexpr int kBitsMetaIn = k_ * kVectorLens[R_index];
+	static constexpr int kBitsInput = kBitsY + 2 * kBitsMetaIn;
+	static constexpr int kBytesInput = cdiv(kBitsInput, 8);
+	
+	// hash output = y + meta (only for tables 4 to 6)
+	static constexpr int kBitsOutY = k_ + (R_index < 7 ? kExtraBits : 0);
+	static constexpr int kBitsMetaOut = R_index < 7 ? k_ * kVectorLens[R_index + 1] : 0;
+	
+	static_assert(R_index >= 2 && R_index <= 7, "invalid table index");
+	static_assert(kBitsInput <= 512, "input exceeds one block");
+	
+    FxCalculator() = default;
 
     // Disable copying
     FxCalculator(const FxCalculator&) = delete;
@@ -91,59 +131,273 @@ public:
     // Performs one evaluation of the f function.
     void evaluate(const T& L, const T& R, S& entry) const
     {
-        Bits C;
-        Bits input;
         uint8_t input_bytes[64];
         uint8_t hash_bytes[32];
-        uint8_t L_meta[16];
-        uint8_t R_meta[16];
-        
-        size_t L_meta_bytes = 0;
-        size_t R_meta_bytes = 0;
-        get_meta<T>{}(L, L_meta, &L_meta_bytes);
-        get_meta<T>{}(R, R_meta, &R_meta_bytes);
         
-        const Bits Y_1(L.y, k_ + kExtraBits);
-        const Bits L_c(L_meta, L_meta_bytes, L_meta_bytes * 8);
-        const Bits R_c(R_meta, R_meta_bytes, R_meta_bytes * 8);
-
-        if (table_index_ < 4) {
-            C = L_c + R_c;
-            input = Y_1 + C;
-        } else {
-            input = Y_1 + L_c + R_c;
-        }
-        input.ToBytes(input_bytes);
+        pack_input(L, R, input_bytes);
 
         blake3_hasher hasher;
         blake3_hasher_init(&hasher);
-        blake3_hasher_update(&hasher, input_bytes, cdiv(input.GetSize(), 8));
+        blake3_hasher_update(&hasher, input_bytes, kBytesInput);
         blake3_hasher_finalize(&hasher, hash_bytes, sizeof(hash_bytes));
 
-        entry.y = Util::EightBytesToInt(hash_bytes) >> (64 - (k_ + (table_index_ < 7 ? kExtraBits : 0)));
+        unpack_output(L, R, hash_bytes, entry);
+    }
 
-        if (table_index_ < 4) {
-            // c is already computed
-        } else if (table_index_ < 7) {
-            uint8_t len = kVectorLens[table_index_ + 1];
-            uint8_t start_byte = (k_ + kExtraBits) / 8;
-            uint8_t end_bit = k_ + kExtraBits + k_ * len;
-            uint8_t end_byte = cdiv(end_bit, 8);
+    // Performs count evaluations, hashing kBatchSize inputs at a time in SIMD lanes.
+    // Sets y, meta, pos and off of out[0 .. count-1].
+    void evaluate_batch(const match_t<T>* matches, const size_t count, S* out) const
+    {
+        evaluate_batch_ex(count, out,
+            [matches](const size_t i, match_ref_t& ref) {
+                const auto& match = matches[i];
+                ref.left = &match.left;
+                ref.right = &match.right;
+                ref.pos = match.pos;
+                ref.off = match.off;
+            });
+    }
 
-            // TODO: proper support for partial bytes in Bits ctor
-            C = Bits(hash_bytes + start_byte, end_byte - start_byte, (end_byte - start_byte) * 8);
+    // Same as above, with entries read directly from the groups they were matched in.
+    void evaluate_batch(const match_group_t<T>* groups, const match_idx_t* matches, const size_t count, S* out) const
+    {
+        evaluate_batch_ex(count, out,
+            [groups, matches](const size_t i, match_ref_t& ref) {
+                const auto& match = matches[i];
+                const auto& group = groups[match.group];
+                ref.left = &group.bucket_L[match.idx_L];
+                ref.right = &group.bucket_R[match.idx_R];
+                ref.pos = group.L_offset + match.idx_L;
+                ref.off = match.idx_R + (group.bucket_L.size() - match.idx_L);
+            });
+    }
 
-            C = C.Slice((k_ + kExtraBits) % 8, end_bit - start_byte * 8);
+private:
+    struct match_ref_t {
+        const T* left;
+        const T* right;
+        uint32_t pos;
+        uint16_t off;
+    };
+
+    template<typename F>
+    void evaluate_batch_ex(const size_t count, S* out, const F& get_match) const
+    {
+        match_ref_t refs[kBatchSize];
+        uint8_t input_bytes[kBatchSize * 64];
+        uint8_t hash_bytes[kBatchSize * 32];
+        
+        for(size_t i = 0; i < count; i += kBatchSize)
+        {
+            const size_t num_inputs = std::min(count - i, kBatchSize);
+            
+            for(size_t k = 0; k < num_inputs; ++k) {
+                auto& ref = refs[k];
+                get_match(i + k, ref);
+                pack_input(*ref.left, *ref.right, input_bytes + k * 64);
+            }
+            blake3_hash_single_blocks(input_bytes, num_inputs, kBytesInput, hash_bytes);
+            
+            for(size_t k = 0; k < num_inputs; ++k) {
+                const auto& ref = refs[k];
+                auto& entry = out[i + k];
+                entry.pos = ref.pos;
+                entry.off = ref.off;
+                unpack_output(*ref.left, *ref.right, hash_bytes + k * 32, entry);
+            }
         }
-        uint8_t C_bytes[16];
-        C.ToBytes(C_bytes);
-        set_meta<S>{}(entry, C_bytes, C.GetSize() / 8);
     }
 
-private:
-    int table_index_ = 0;
+    // ORs the top num_bits of value into words at bit offset pos.
+    static void append(uint64_t* words, const int pos, const int num_bits, const uint64_t value)
+    {
+        const int shift = pos % 64;
+        words[pos / 64] |= value >> shift;
+        if(shift && shift + num_bits > 64) {
+            words[pos / 64 + 1] |= value << (64 - shift);
+        }
+    }
+
+    // Returns the 64 bits at bit offset pos.
+    static uint64_t slice(const uint64_t* words, const int pos)
+    {
+        const int shift = pos % 64;
+        if(shift) {
+            return (words[pos / 64] << shift) | (words[pos / 64 + 1] >> (64 - shift));
+        }
+        return words[pos / 64];
+    }
+
+    // Loads the meta data of entry as two big-endian words, zero padded.
+    static void load_meta(const T& entry, uint64_t* words)
+    {
+        uint8_t bytes[16] = {};
+        size_t num_bytes = 0;
+        get_meta<T>{}(entry, bytes, &num_bytes);
+        memcpy(words, bytes, 16);
+        words[0] = bswap_64(words[0]);
+        words[1] = bswap_64(words[1]);
+    }
+
+    // Writes the 64-byte (zero padded) hash input.
+    static void pack_input(const T& L, const T& R, uint8_t* input_bytes)
+    {
+        uint64_t words[8] = {};
+        uint64_t L_meta[2];
+        uint64_t R_meta[2];
+        load_meta(L, L_meta);
+        load_meta(R, R_meta);
+        
+        append(words, 0, kBitsY, L.y << (64 - kBitsY));
+        for(int i = 0; i * 64 < kBitsMetaIn; ++i) {
+            const int num_bits = std::min(kBitsMetaIn - i * 64, 64);
+            append(words, kBitsY + i * 64, num_bits, L_meta[i]);
+            append(words, kBitsY + kBitsMetaIn + i * 64, num_bits, R_meta[i]);
+        }
+        for(int i = 0; i < 8; ++i) {
+            words[i] = bswap_64(words[i]);
+        }
+        memcpy(input_bytes, words, 64);
+    }
+
+    // Computes y and meta of entry from the hash output.
+    static void unpack_output(const T& L, const T& R, const uint8_t* hash_bytes, S& entry)
+    {
+        uint64_t hash[4];
+        memcpy(hash, hash_bytes, 32);
+        for(int i = 0; i < 4; ++i) {
+            hash[i] = bswap_64(hash[i]);
+        }
+        entry.y = hash[0] >> (64 - kBitsOutY);
+        
+        uint8_t C_bytes[32];
+        if constexpr(R_index < 4) {
+            // meta = L_meta + R_meta
+            size_t L_meta_bytes = 0;
+            size_t R_meta_bytes = 0;
+            get_meta<T>{}(L, C_bytes, &L_meta_bytes);
+            get_meta<T>{}(R, C_bytes + L_meta_bytes, &R_meta_bytes);
+            set_meta<S>{}(entry, C_bytes, L_meta_bytes + R_meta_bytes);
+        } else if constexpr(R_index < 7) {
+            // meta = hash bits following y
+            for(int i = 0; i * 64 < kBitsMetaOut; ++i) {
+                const uint64_t tmp = bswap_64(slice(hash, kBitsY + i * 64));
+                memcpy(C_bytes + i * 8, &tmp, 8);
+            }
+            set_meta<S>{}(entry, C_bytes, kBitsMetaOut / 8);
+        }
+    }
 };
 
+/*
+ * Computes the kExtraBitsPow targets of a left entry at r = y % kBC and stores the ones present
+ * in the right BC group bitmap to hits[], in order of m. Returns the number of hits.
+ */
+typedef int (*probe_targets_t)(const uint64_t* bitmap, const uint32_t* target_sq, uint32_t r, uint32_t* hits);
+
+static int probe_targets(const uint64_t* bitmap, const uint32_t* target_sq, uint32_t r, uint32_t* hits)
+{
+	const uint32_t indJ = r / kC;
+	const uint32_t rc = r % kC;
+	int count = 0;
+	for(uint32_t m = 0; m < kExtraBitsPow; ++m) {
+		uint32_t a = indJ + m;
+		uint32_t b = rc + target_sq[m];
+		a = a >= kB ? a - kB : a;
+		b = b >= kC ? b - kC : b;
+		const uint32_t target = a * kC + b;
+		hits[count] = target;
+		count += (bitmap[target / 64] >> (target % 64)) & 1;
+	}
+	return count;
+}
+
+#ifdef PHASE1_MATCH_SIMD
+
+__attribute__((target("avx2")))
+static int probe_targets_avx2(const uint64_t* bitmap, const uint32_t* target_sq, uint32_t r, uint32_t* hits)
+{
+	const __m256i indJ = _mm256_set1_epi32(r / kC);
+	const __m256i rc = _mm256_set1_epi32(r % kC);
+	const __m256i vB = _mm256_set1_epi32(kB);
+	const __m256i vC = _mm256_set1_epi32(kC);
+	const __m256i bit_mask = _mm256_set1_epi32(31);
+	
+	int count = 0;
+	alignas(32) uint32_t targets[8];
+	for(int i = 0; i < kExtraBitsPow; i += 8) {
+		const __m256i m = _mm256_add_epi32(_mm256_set1_epi32(i), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+		__m256i a = _mm256_add_epi32(indJ, m);
+		__m256i b = _mm256_add_epi32(rc, _mm256_loadu_si256((const __m256i*)(target_sq + i)));
+		a = _mm256_min_epu32(a, _mm256_sub_epi32(a, vB));
+		b = _mm256_min_epu32(b, _mm256_sub_epi32(b, vC));
+		const __m256i target = _mm256_add_epi32(_mm256_mullo_epi32(a, vC), b);
+		const __m256i word = _mm256_i32gather_epi32((const int*)bitmap, _mm256_srli_epi32(target, 5), 4);
+		const __m256i bit = _mm256_slli_epi32(_mm256_srlv_epi32(word, _mm256_and_si256(target, bit_mask)), 31);
+		
+		int mask = _mm256_movemask_ps(_mm256_castsi256_ps(bit));
+		if(mask) {
+			_mm256_store_si256((__m256i*)targets, target);
+			while(mask) {
+				hits[count++] = targets[__builtin_ctz(mask)];
+				mask &= mask - 1;
+			}
+		}
+	}
+	return count;
+}
+
+// GCC 12 warns about _mm512_undefined_epi32() inside the intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+
+__attribute__((target("avx512f")))
+static int probe_targets_avx512(const uint64_t* bitmap, const uint32_t* target_sq, uint32_t r, uint32_t* hits)
+{
+	const __m512i indJ = _mm512_set1_epi32(r / kC);
+	const __m512i rc = _mm512_set1_epi32(r % kC);
+	const __m512i vB = _mm512_set1_epi32(kB);
+	const __m512i vC = _mm512_set1_epi32(kC);
+	const __m512i bit_mask = _mm512_set1_epi32(31);
+	const __m512i one = _mm512_set1_epi32(1);
+	
+	int count = 0;
+	for(int i = 0; i < kExtraBitsPow; i += 16) {
+		const __m512i m = _mm512_add_epi32(_mm512_set1_epi32(i),
+				_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+		__m512i a = _mm512_add_epi32(indJ, m);
+		__m512i b = _mm512_add_epi32(rc, _mm512_loadu_si512(target_sq + i));
+		a = _mm512_min_epu32(a, _mm512_sub_epi32(a, vB));
+		b = _mm512_min_epu32(b, _mm512_sub_epi32(b, vC));
+		const __m512i target = _mm512_add_epi32(_mm512_mullo_epi32(a, vC), b);
+		const __m512i word = _mm512_i32gather_epi32(_mm512_srli_epi32(target, 5), bitmap, 4);
+		const __mmask16 mask = _mm512_test_epi32_mask(
+				_mm512_srlv_epi32(word, _mm512_and_si512(target, bit_mask)), one);
+		
+		_mm512_mask_compressstoreu_epi32(hits + count, mask, target);
+		count += __builtin_popcount(mask);
+	}
+	return count;
+}
+
+#pragma GCC diagnostic pop
+
+#endif // PHASE1_MATCH_SIMD
+
+static probe_targets_t get_probe_targets()
+{
+#ifdef PHASE1_MATCH_SIMD
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f")) {
+		return &probe_targets_avx512;
+	}
+	if(__builtin_cpu_supports("avx2")) {
+		return &probe_targets_avx2;
+	}
+#endif
+	return &probe_targets;
+}
+
 template<typename T>
 class FxMatcher {
 public:
@@ -152,8 +406,10 @@ public:
 		uint16_t count;
 	};
 	
+	static constexpr int kBitmapWords = (kBC + 63) / 64;
+	
     FxMatcher() {
-        rmap.resize(kBC);
+        probe = get_probe_targets();
     }
 
     // Disable copying
@@ -168,13 +424,76 @@ public:
     //   (yr % kBC) / kC - (yl % kBC) / kC = m   (mod kB)  AND
     //   (yr % kBC) % kC - (yl % kBC) % kC = (2m + (yl/kBC) % 2)^2   (mod kC)
     //
+    // The right bucket is stored as a presence bitmap over its kBC y values, plus the first
+    // position of every distinct y. The targets of each left entry are computed arithmetically
+    // (with SIMD if available) and probed against the bitmap, so the working set stays in L1.
+    // Output is identical to find_matches_ex_ref(), including the order of matches.
+    int find_matches_ex(
+        const span_t<T>& bucket_L,
+        const span_t<T>& bucket_R,
+        uint16_t* idx_L,
+        uint16_t* idx_R)
+    {
+        if(bucket_L.empty() || bucket_R.empty()) {
+        	return 0;
+        }
+    	const uint16_t parity = (bucket_L[0].y / kBC) % 2;
+
+        memset(bitmap, 0, sizeof(bitmap));
+        if(R_first.size() <= bucket_R.size()) {
+        	R_first.resize(bucket_R.size() + 1);
+        }
+        size_t num_distinct = 0;
+        
+        const uint64_t offset = (bucket_R[0].y / kBC) * kBC;
+        for (size_t pos_R = 0; pos_R < bucket_R.size(); pos_R++) {
+            const uint64_t r_y = bucket_R[pos_R].y - offset;
+            const uint64_t bit = uint64_t(1) << (r_y % 64);
+            
+            if (!(bitmap[r_y / 64] & bit)) {
+            	bitmap[r_y / 64] |= bit;
+            	R_first[num_distinct++] = pos_R;
+            }
+        }
+        R_first[num_distinct] = bucket_R.size();
+        
+        uint16_t num_set = 0;
+        for (int i = 0; i < kBitmapWords; i++) {
+        	bitmap_rank[i] = num_set;
+        	num_set += Util::PopCount(bitmap[i]);
+        }
+
+        int idx_count = 0;
+        uint32_t hits[kExtraBitsPow];
+        const uint64_t offset_y = offset - kBC;
+        for (size_t pos_L = 0; pos_L < bucket_L.size(); pos_L++) {
+            const uint64_t r = bucket_L[pos_L].y - offset_y;
+            const int num_hits = probe(bitmap, L_target_sq[parity], r, hits);
+            
+            for (int i = 0; i < num_hits; i++) {
+            	const uint32_t target = hits[i];
+            	const uint64_t below = bitmap[target / 64] & ((uint64_t(1) << (target % 64)) - 1);
+            	const size_t rank = bitmap_rank[target / 64] + Util::PopCount(below);
+            	
+            	for (size_t j = R_first[rank]; j < R_first[rank + 1]; j++) {
+					idx_L[idx_count] = pos_L;
+					idx_R[idx_count] = j;
+                    idx_count++;
+                }
+            }
+        }
+        return idx_count;
+    }
+    
+    // Reference implementation via the L_targets table, as used by chiapos.
+    //
     // Instead of doing the naive algorithm, which is an O(kExtraBitsPow * N^2) comparisons on
     // bucket length, we can store all the R values and lookup each of our 32 candidates to see if
     // any R value matches. This function can be further optimized by removing the inner loop, and
     // being more careful with memory allocation.
-    int find_matches_ex(
-        const std::vector<T>& bucket_L,
-        const std::vector<T>& bucket_R,
+    int find_matches_ex_ref(
+        const span_t<T>& bucket_L,
+        const span_t<T>& bucket_R,
         uint16_t* idx_L,
         uint16_t* idx_R)
     {
@@ -183,6 +502,9 @@ public:
         }
     	const uint16_t parity = (bucket_L[0].y / kBC) % 2;
 
+        if(rmap.empty()) {
+        	rmap.resize(kBC);
+        }
         for (auto yl : rmap_clean) {
             rmap[yl].count = 0;
         }
@@ -215,23 +537,22 @@ public:
         return idx_count;
     }
     
-    int find_matches(	const uint64_t& L_pos_begin,
-						const std::vector<T>& bucket_L,
-						const std::vector<T>& bucket_R,
-						std::vector<match_t<T>>& out)
+    // Appends the matches between group.bucket_L and group.bucket_R to out, skipping positions >= 2^32.
+    // Returns the number of matches found.
+    int find_matches(	const uint32_t group_index,
+						const match_group_t<T>& group,
+						std::vector<match_idx_t>& out)
 	{
     	uint16_t idx_L[kBC];
 		uint16_t idx_R[kBC];
-		const int count = find_matches_ex(bucket_L, bucket_R, idx_L, idx_R);
+		const int count = find_matches_ex(group.bucket_L, group.bucket_R, idx_L, idx_R);
 		
 		for(int i = 0; i < count; ++i) {
-			const auto pos = L_pos_begin + idx_L[i];
-			if(pos < (uint64_t(1) << 32)) {
-				match_t<T> match;
-				match.left = bucket_L[idx_L[i]];
-				match.right = bucket_R[idx_R[i]];
-				match.pos = pos;
-				match.off = idx_R[i] + (bucket_L.size() - idx_L[i]);
+			if(group.L_offset + idx_L[i] < (uint64_t(1) << 32)) {
+				match_idx_t match;
+				match.group = group_index;
+				match.idx_L = idx_L[i];
+				match.idx_R = idx_R[i];
 				out.push_back(match);
 			}
 		}
@@ -239,6 +560,11 @@ public:
 	}
 
 private:
+    probe_targets_t probe = nullptr;
+    uint64_t bitmap[kBitmapWords];			// presence of y % kBC in bucket_R
+    uint16_t bitmap_rank[kBitmapWords];		// number of bits set before each word
+    std::vector<uint16_t> R_first;			// first position of each distinct y in bucket_R
+    
     std::vector<rmap_item> rmap;
     std::vector<uint16_t> rmap_clean;
 };
@@ -255,23 +581,25 @@ void compute_f1(const uint8_t* id, int num_threads, DS* T1_sort)
 	
 	typedef typename DS::WriteCache WriteCache;
 	
-	ThreadPool<std::vector<entry_1>, size_t, std::shared_ptr<WriteCache>> output(
-		[T1_sort](std::vector<entry_1>& input, size_t&, std::shared_ptr<WriteCache>& cache) {
+	BufferPool<std::vector<entry_1>> buffers("phase1/F1");
+	
+	UnorderedThreadPool<std::vector<entry_1>, size_t, std::shared_ptr<WriteCache>> output(
+		[T1_sort, &buffers](std::vector<entry_1>& input, size_t&, std::shared_ptr<WriteCache>& cache) {
 			if(!cache) {
 				cache = T1_sort->add_cache();
 			}
 			for(auto& entry : input) {
 				cache->add(entry);
 			}
+			buffers.take(input);
 		}, nullptr, std::max(num_threads / 2, 1), "phase1/add");
 	
-	ThreadPool<uint64_t, std::vector<entry_1>> pool(
-		[id](uint64_t& block, std::vector<entry_1>& out, size_t&) {
+	UnorderedThreadPool<uint64_t, std::vector<entry_1>> pool(
+		[id, &buffers](uint64_t& block, std::vector<entry_1>& out, size_t&) {
+			out = buffers.get();
 			out.resize(M * 16);
 			F1Calculator F1(id);
-			for(size_t i = 0; i < M; ++i) {
-				F1.compute_block(block * M + i, &out[i * 16]);
-			}
+			F1.compute_block(block * M, M, out.data());
 		}, &output, num_threads, "phase1/F1");
 	
 	for(uint64_t k = 0; k < (uint64_t(1) << 28) / M; ++k) {
@@ -282,36 +610,50 @@ void compute_f1(const uint8_t* id, int num_threads, DS* T1_sort)
 	T1_sort->finish();
 	
 	std::cout << "[P1] Table 1 took " << (get_wall_time_micros() - begin) / 1e6 << " sec" << std::endl;
+	Telemetry::report("[P1] Table 1");
+	Trace::mark("[P1] Table 1", get_wall_time_micros() - begin);
 }
 
-template<typename T, typename S, typename R, typename DS_L, typename DS_R>
-uint64_t compute_matches(	int R_index, int num_threads,
+template<int R_index, typename T, typename S, typename R, typename DS_L, typename DS_R>
+uint64_t compute_matches(	int num_threads,
 							DS_L* L_sort, DS_R* R_sort,
-							Processor<std::vector<T>>* L_tmp_out,
-							Processor<std::vector<S>>* R_tmp_out)
+							Processor<std::shared_ptr<const std::vector<T>>>* L_tmp_out,
+							Processor<std::vector<S>>* R_tmp_out,
+							BufferPool<std::vector<S>>* R_buffers)
 {
+	typedef std::shared_ptr<const std::vector<T>> chunk_t;
+	
 	std::atomic<uint64_t> num_found {};
 	std::atomic<uint64_t> num_written {};
 	std::array<uint64_t, 2> L_index = {};
 	std::array<uint64_t, 2> L_offset = {};
-	std::array<std::shared_ptr<std::vector<T>>, 2> L_bucket;
-	double avg_bucket_size = 0;
+	std::array<span_t<T>, 2> L_bucket;
+	std::array<chunk_t, 2> L_chunk;		// owner of L_bucket
 	
 	struct match_input_t {
-		std::array<uint64_t, 2> L_offset = {};
-		std::array<std::shared_ptr<std::vector<T>>, 2> L_bucket;
+		std::vector<match_group_t<T>> groups;
+		std::vector<chunk_t> chunks;		// keeps the groups alive
+	};
+	
+	struct match_batch_t {
+		std::vector<match_group_t<T>> groups;
+		std::vector<chunk_t> chunks;
+		std::vector<match_idx_t> matches;
 	};
 	
 	typedef typename DS_R::WriteCache WriteCache;
 	
-	ThreadPool<std::vector<S>, size_t, std::shared_ptr<WriteCache>> R_add(
-		[R_sort](std::vector<S>& input, size_t&, std::shared_ptr<WriteCache>& cache) {
+	BufferPool<std::vector<match_idx_t>> match_buffers("phase1/match");
+	
+	UnorderedThreadPool<std::vector<S>, size_t, std::shared_ptr<WriteCache>> R_add(
+		[R_sort, R_buffers](std::vector<S>& input, size_t&, std::shared_ptr<WriteCache>& cache) {
 			if(!cache) {
 				cache = R_sort->add_cache();
 			}
 			for(auto& entry : input) {
 				cache->add(entry);
 			}
+			R_buffers->take(input);
 		}, nullptr, std::max(num_threads / 2, 1), "phase1/add");
 	
 	Processor<std::vector<S>>* R_out = &R_add;
@@ -319,80 +661,105 @@ uint64_t compute_matches(	int R_index, int num_threads,
 		R_out = R_tmp_out;
 	}
 	
-	ThreadPool<std::vector<match_t<T>>, std::vector<S>> eval_pool(
-		[R_index](std::vector<match_t<T>>& matches, std::vector<S>& out, size_t&) {
-			out.reserve(matches.size());
-			FxCalculator<T, S> Fx(R_index);
-			for(const auto& match : matches) {
-				S entry;
-				entry.pos = match.pos;
-				entry.off = match.off;
-				Fx.evaluate(match.left, match.right, entry);
-				out.push_back(entry);
-			}
+	ThreadPool<match_batch_t, std::vector<S>> eval_pool(
+		[R_buffers, &match_buffers](match_batch_t& input, std::vector<S>& out, size_t&) {
+			out = R_buffers->get();
+			out.resize(input.matches.size());
+			FxCalculator<R_index, T, S> Fx;
+			Fx.evaluate_batch(input.groups.data(), input.matches.data(), input.matches.size(), out.data());
+			match_buffers.take(input.matches);
 		}, R_out, num_threads, "phase1/eval");
 	
-	ThreadPool<std::vector<match_input_t>, std::vector<match_t<T>>, FxMatcher<T>> match_pool(
-		[&num_found, &num_written]
-		 (std::vector<match_input_t>& input, std::vector<match_t<T>>& out, FxMatcher<T>& Fx) {
-			out.reserve(64 * 1024);
-			for(const auto& pair : input) {
-				num_found += Fx.find_matches(pair.L_offset[1], *pair.L_bucket[1], *pair.L_bucket[0], out);
+	ThreadPool<match_input_t, match_batch_t, FxMatcher<T>> match_pool(
+		[&num_found, &num_written, &match_buffers]
+		 (match_input_t& input, match_batch_t& out, FxMatcher<T>& Fx) {
+			out.matches = match_buffers.get();
+			out.matches.reserve(64 * 1024);
+			for(size_t i = 0; i < input.groups.size(); ++i) {
+				num_found += Fx.find_matches(i, input.groups[i], out.matches);
 			}
-			num_written += out.size();
+			num_written += out.matches.size();
+			out.groups = std::move(input.groups);
+			out.chunks = std::move(input.chunks);
 		}, &eval_pool, num_threads, "phase1/match");
 	
+	const auto add_group =
+		[&L_offset, &L_bucket, &L_chunk](match_input_t& out) {
+			match_group_t<T> group;
+			group.L_offset = L_offset[1];
+			group.bucket_L = L_bucket[1];
+			group.bucket_R = L_bucket[0];
+			out.groups.push_back(group);
+			for(const auto& chunk : L_chunk) {
+				if(std::find(out.chunks.begin(), out.chunks.end(), chunk) == out.chunks.end()) {
+					out.chunks.push_back(chunk);
+				}
+			}
+		};
+	
 	Thread<std::pair<std::vector<T>, size_t>> read_thread(
-		[&L_index, &L_offset, &L_bucket, &avg_bucket_size, &match_pool, L_tmp_out]
+		[&L_index, &L_offset, &L_bucket, &L_chunk, &add_group, &match_pool, L_tmp_out]
 		 (std::pair<std::vector<T>, size_t>& input) {
-			std::vector<match_input_t> out;
-			out.reserve(1024);
-			for(const auto& entry : input.first) {
-				const uint64_t index = entry.y / kBC;
+			const chunk_t chunk = std::make_shared<const std::vector<T>>(std::move(input.first));
+			const T* entries = chunk->data();
+			const size_t num_entries = chunk->size();
+			
+			match_input_t out;
+			out.groups.reserve(1024);
+			for(size_t i = 0; i < num_entries;)
+			{
+				const uint64_t index = entries[i].y / kBC;
 				if(index < L_index[0]) {
 					throw std::logic_error("input not sorted");
 				}
+				size_t end = i + 1;
+				while(end < num_entries && entries[end].y / kBC == index) {
+					end++;
+				}
 				if(index > L_index[0]) {
 					if(L_index[1] + 1 == L_index[0]) {
-						match_input_t pair;
-						pair.L_offset = L_offset;
-						pair.L_bucket = L_bucket;
-						out.push_back(pair);
+						add_group(out);
 					}
 					L_index[1] = L_index[0];
 					L_index[0] = index;
 					L_offset[1] = L_offset[0];
-					if(auto bucket = L_bucket[0]) {
-						L_offset[0] += bucket->size();
-						avg_bucket_size = avg_bucket_size * 0.99 + bucket->size() * 0.01;
-					}
+					L_offset[0] += L_bucket[0].size();
 					L_bucket[1] = L_bucket[0];
-					L_bucket[0] = nullptr;
+					L_chunk[1] = L_chunk[0];
+					L_bucket[0] = span_t<T>();
+					L_chunk[0] = nullptr;
 				}
-				if(!L_bucket[0]) {
-					L_bucket[0] = std::make_shared<std::vector<T>>();
-					L_bucket[0]->reserve(avg_bucket_size * 1.2);
+				if(L_bucket[0].empty()) {
+					L_bucket[0] = span_t<T>(entries + i, end - i);
+					L_chunk[0] = chunk;
+				} else {
+					// group straddles chunk boundary
+					auto copy = std::make_shared<std::vector<T>>(L_bucket[0].begin(), L_bucket[0].end());
+					copy->insert(copy->end(), entries + i, entries + end);
+					L_bucket[0] = span_t<T>(*copy);
+					L_chunk[0] = copy;
 				}
-				L_bucket[0]->push_back(entry);
+				i = end;
+			}
+			if(!out.groups.empty()) {
+				match_pool.take(out);
 			}
-			match_pool.take(out);
 			if(L_tmp_out) {
-				L_tmp_out->take(input.first);
+				auto tmp = chunk;
+				L_tmp_out->take(tmp);
 			}
 		}, "phase1/slice");
 	
 	L_sort->read(&read_thread, std::max(num_threads / 2, 2));
 	
 	read_thread.close();
-	match_pool.close();
 	
 	if(L_index[1] + 1 == L_index[0]) {
-		FxMatcher<T> Fx;
-		std::vector<match_t<T>> matches;
-		num_found += Fx.find_matches(L_offset[1], *L_bucket[1], *L_bucket[0], matches);
-		num_written += matches.size();
-		eval_pool.take(matches);
+		match_input_t last;
+		add_group(last);
+		match_pool.take(last);
 	}
+	match_pool.close();
 	eval_pool.close();
 	R_add.close();
 	
@@ -406,33 +773,37 @@ uint64_t compute_matches(	int R_index, int num_threads,
 	return num_written;
 }
 
-template<typename T, typename S, typename R, typename DS_L, typename DS_R>
-uint64_t compute_table(	int R_index, int num_threads,
+template<int R_index, typename T, typename S, typename R, typename DS_L, typename DS_R>
+uint64_t compute_table(	int num_threads,
 						DS_L* L_sort, DS_R* R_sort,
 						DiskTable<R>* L_tmp, DiskTable<S>* R_tmp = nullptr)
 {
-	Thread<std::vector<T>> L_write(
-		[L_tmp](std::vector<T>& input) {
-			for(const auto& entry : input) {
+	Thread<std::shared_ptr<const std::vector<T>>> L_write(
+		[L_tmp](std::shared_ptr<const std::vector<T>>& input) {
+			for(const auto& entry : *input) {
 				R tmp;
 				tmp.assign(entry);
 				L_tmp->write(tmp);
 			}
 		}, "phase1/write/L");
 	
+	BufferPool<std::vector<S>> R_buffers("phase1/eval");
+	
 	Thread<std::vector<S>> R_write(
-		[R_tmp](std::vector<S>& input) {
+		[R_tmp, &R_buffers](std::vector<S>& input) {
 			for(const auto& entry : input) {
 				R_tmp->write(entry);
 			}
+			R_buffers.take(input);
 		}, "phase1/write/R");
 	
 	const auto begin = get_wall_time_micros();
 	const auto num_matches =
-			phase1::compute_matches<T, S, R>(
-					R_index, num_threads, L_sort, R_sort,
+			phase1::compute_matches<R_index, T, S, R>(
+					num_threads, L_sort, R_sort,
 					L_tmp ? &L_write : nullptr,
-					R_tmp ? &R_write : nullptr);
+					R_tmp ? &R_write : nullptr,
+					&R_buffers);
 	
 	L_write.close();
 	R_write.close();
@@ -445,6 +816,8 @@ uint64_t compute_table(	int R_index, int num_threads,
 	}
 	std::cout << "[P1] Table " << R_index << " took " << (get_wall_time_micros() - begin) / 1e6 << " sec"
 			<< ", found " << num_matches << " matches" << std::endl;
+	Telemetry::report("[P1] Table " + std::to_string(R_index));
+	Trace::mark("[P1] Table " + std::to_string(R_index), get_wall_time_micros() - begin);
 	return num_matches;
 }
 
@@ -453,7 +826,8 @@ void compute(	const input_t& input, output_t& out,
 				const int num_threads, const int log_num_buckets,
 				const std::string plot_name,
 				const std::string tmp_dir,
-				const std::string tmp_dir_2)
+				const std::string tmp_dir_2,
+				checkpoint_t* checkpoint = nullptr)
 {
 	const auto total_begin = get_wall_time_micros();
 	
@@ -462,52 +836,111 @@ void compute(	const input_t& input, output_t& out,
 	const std::string prefix = tmp_dir + plot_name + ".p1.";
 	const std::string prefix_2 = tmp_dir_2 + plot_name + ".p1.";
 	
-	DiskSort1 sort_1(32 + kExtraBits, log_num_buckets, prefix_2 + "t1");
-	compute_f1(input.id.data(), num_threads, &sort_1);
+	out.params = input;
+	if(checkpoint) {
+		out.table = checkpoint->table_1;
+	}
+	auto is_done = [checkpoint](int table) -> bool {
+		return checkpoint && checkpoint->is_done(1, table);
+	};
+	// sort of table i is needed until table i + 1 is done
+	auto open = [&](auto& sort, int i) {
+		typedef typename std::remove_reference<decltype(*sort)>::type DS;
+		if(!is_done(i + 1)) {
+			sort = open_sort<DS>(checkpoint, is_done(i), 32 + kExtraBits, log_num_buckets, prefix_2 + "t" + std::to_string(i));
+		}
+	};
+	auto commit = [&](int i) {
+		if(checkpoint) {
+			checkpoint->table_1 = out.table;
+			checkpoint->save(1, i);
+		}
+	};
+	if(checkpoint && checkpoint->phase == 1) {
+		std::cout << "[P1] Resuming after table " << checkpoint->table << std::endl;
+	}
+	
+	std::shared_ptr<DiskSort1> sort_1;
+	std::shared_ptr<DiskSort2> sort_2;
+	std::shared_ptr<DiskSort3> sort_3;
+	std::shared_ptr<DiskSort4> sort_4;
+	std::shared_ptr<DiskSort5> sort_5;
+	std::shared_ptr<DiskSort6> sort_6;
+	
+	open(sort_1, 1);
+	if(!is_done(1)) {
+		compute_f1(input.id.data(), num_threads, sort_1.get());
+		commit(1);
+	}
 	
-	DiskTable<tmp_entry_1> tmp_1(prefix + "table1.tmp");
-	DiskSort2 sort_2(32 + kExtraBits, log_num_buckets, prefix_2 + "t2");
-	compute_table<entry_1, entry_2, tmp_entry_1>(
-			2, num_threads, &sort_1, &sort_2, &tmp_1);
+	open(sort_2, 2);
+	if(!is_done(2)) {
+		DiskTable<tmp_entry_1> tmp_1(prefix + "table1.tmp");
+		compute_table<2, entry_1, entry_2, tmp_entry_1>(
+				num_threads, sort_1.get(), sort_2.get(), &tmp_1);
+		out.table[0] = tmp_1.get_info();
+		release_sort(checkpoint, sort_1);
+		commit(2);
+	}
 	
-	DiskTable<tmp_entry_x> tmp_2(prefix + "table2.tmp");
-	DiskSort3 sort_3(32 + kExtraBits, log_num_buckets, prefix_2 + "t3");
-	compute_table<entry_2, entry_3, tmp_entry_x>(
-			3, num_threads, &sort_2, &sort_3, &tmp_2);
+	open(sort_3, 3);
+	if(!is_done(3)) {
+		DiskTable<tmp_entry_x> tmp_2(prefix + "table2.tmp");
+		compute_table<3, entry_2, entry_3, tmp_entry_x>(
+				num_threads, sort_2.get(), sort_3.get(), &tmp_2);
+		out.table[1] = tmp_2.get_info();
+		release_sort(checkpoint, sort_2);
+		commit(3);
+	}
 	
-	DiskTable<tmp_entry_x> tmp_3(prefix + "table3.tmp");
-	DiskSort4 sort_4(32 + kExtraBits, log_num_buckets, prefix_2 + "t4");
-	compute_table<entry_3, entry_4, tmp_entry_x>(
-			4, num_threads, &sort_3, &sort_4, &tmp_3);
+	open(sort_4, 4);
+	if(!is_done(4)) {
+		DiskTable<tmp_entry_x> tmp_3(prefix + "table3.tmp");
+		compute_table<4, entry_3, entry_4, tmp_entry_x>(
+				num_threads, sort_3.get(), sort_4.get(), &tmp_3);
+		out.table[2] = tmp_3.get_info();
+		release_sort(checkpoint, sort_3);
+		commit(4);
+	}
 	
-	DiskTable<tmp_entry_x> tmp_4(prefix + "table4.tmp");
-	DiskSort5 sort_5(32 + kExtraBits, log_num_buckets, prefix_2 + "t5");
-	compute_table<entry_4, entry_5, tmp_entry_x>(
-			5, num_threads, &sort_4, &sort_5, &tmp_4);
+	open(sort_5, 5);
+	if(!is_done(5)) {
+		DiskTable<tmp_entry_x> tmp_4(prefix + "table4.tmp");
+		compute_table<5, entry_4, entry_5, tmp_entry_x>(
+				num_threads, sort_4.get(), sort_5.get(), &tmp_4);
+		out.table[3] = tmp_4.get_info();
+		release_sort(checkpoint, sort_4);
+		commit(5);
+	}
 	
-	DiskTable<tmp_entry_x> tmp_5(prefix + "table5.tmp");
-	DiskSort6 sort_6(32 + kExtraBits, log_num_buckets, prefix_2 + "t6");
-	compute_table<entry_5, entry_6, tmp_entry_x>(
-			6, num_threads, &sort_5, &sort_6, &tmp_5);
+	open(sort_6, 6);
+	if(!is_done(6)) {
+		DiskTable<tmp_entry_x> tmp_5(prefix + "table5.tmp");
+		compute_table<6, entry_5, entry_6, tmp_entry_x>(
+				num_threads, sort_5.get(), sort_6.get(), &tmp_5);
+		out.table[4] = tmp_5.get_info();
+		release_sort(checkpoint, sort_5);
+		commit(6);
+	}
 	
-	DiskTable<tmp_entry_x> tmp_6(prefix + "table6.tmp");
-	DiskTable<entry_7> tmp_7(prefix_2 + "table7.tmp");
-	compute_table<entry_6, entry_7, tmp_entry_x, DiskSort6, DiskSort7>(
-			7, num_threads, &sort_6, nullptr, &tmp_6, &tmp_7);
+	if(!is_done(7)) {
+		DiskTable<tmp_entry_x> tmp_6(prefix + "table6.tmp");
+		DiskTable<entry_7> tmp_7(prefix_2 + "table7.tmp");
+		compute_table<7, entry_6, entry_7, tmp_entry_x, DiskSort6, DiskSort7>(
+				num_threads, sort_6.get(), nullptr, &tmp_6, &tmp_7);
+		out.table[5] = tmp_6.get_info();
+		out.table[6] = tmp_7.get_info();
+		release_sort(checkpoint, sort_6);
+		commit(7);
+	}
 	
-	out.params = input;
-	out.table[0] = tmp_1.get_info();
-	out.table[1] = tmp_2.get_info();
-	out.table[2] = tmp_3.get_info();
-	out.table[3] = tmp_4.get_info();
-	out.table[4] = tmp_5.get_info();
-	out.table[5] = tmp_6.get_info();
-	out.table[6] = tmp_7.get_info();
+	BufferStats::print("[P1]", "phase1/");
+	Telemetry::write_json(prefix + "telemetry.json");
 	
 	std::cout << "Phase 1 took " << (get_wall_time_micros() - total_begin) / 1e6 << " sec" << std::endl;
+	Trace::mark("Phase 1", get_wall_time_micros() - total_begin);
 }
 
-
 } // phase1
 
 #endif /* INCLUDE_CHIA_PHASE1_HPP_ */
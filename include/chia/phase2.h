@@ -27,23 +27,22 @@ struct entry_x {
 	uint32_t pos;
 	uint16_t off;		// 10 bit
 	
-	static constexpr size_t disk_size = 10;
+	typedef bit_layout_t<
+		bit_field_t<&entry_x::pos, 32>,
+		bit_field_t<&entry_x::key, 32>,
+		bit_field_t<&entry_x::off, 10>> layout;
+	
+	static constexpr size_t disk_size = layout::disk_size;
 	
 	void assign(const phase1::tmp_entry_x& entry) {
 		pos = entry.pos;
 		off = entry.off;
 	}
 	size_t read(const uint8_t* buf) {
-		memcpy(&key, buf, 4);
-		memcpy(&pos, buf + 4, 4);
-		memcpy(&off, buf + 8, 2);
-		return disk_size;
+		return layout::read(*this, buf);
 	}
 	size_t write(uint8_t* buf) const {
-		memcpy(buf, &key, 4);
-		memcpy(buf + 4, &pos, 4);
-		memcpy(buf + 8, &off, 2);
-		return disk_size;
+		return layout::write(*this, buf);
 	}
 };
 
@@ -71,7 +70,7 @@ struct set_sort_key<entry_7> {
 	}
 };
 
-typedef DiskSort<entry_x, get_pos<entry_x>> DiskSortT;
+typedef DiskSort<entry_x, get_pos<entry_x>, radix_sort_t<entry_x, get_pos<entry_x>>> DiskSortT;
 typedef DiskSort<entry_7, get_pos<entry_7>> DiskSort7;		// dummy
 
 struct output_t {
@@ -85,4 +84,11 @@ struct output_t {
 
 } // phase2
 
+
+/*
+ * Bucket files store pos without the upper bits implied by the bucket index.
+ */
+template<>
+struct bucket_layout_t<phase2::entry_x, phase2::get_pos<phase2::entry_x>> : bucket_key_layout_t<phase2::entry_x> {};
+
 #endif /* INCLUDE_CHIA_PHASE2_H_ */
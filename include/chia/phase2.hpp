@@ -11,11 +11,95 @@
 #include <chia/phase2.h>
 #include <chia/DiskTable.h>
 #include <chia/ThreadPool.h>
+#include <chia/checkpoint.h>
+#include <chia/BufferPool.h>
 
 #include <chia/bitfield_index.hpp>
 
 
 namespace phase2 {
+	
+/*
+ * Sets bits of a bitfield without atomics: the bitfield is split into shards of 2^kShardBits bits,
+ * each with its own lock. Threads collect bits per shard in their Cache and set a full buffer
+ * under the lock of its shard, so the random writes of one buffer stay within 2 MiB.
+ */
+class Marker {
+public:
+	static constexpr int kShardBits = 24;
+	static constexpr size_t kBufferSize = 1024;		// bits per shard and thread
+	
+	// NOT thread-safe, flushed when destroyed
+	class Cache {
+	public:
+		Cache(Marker* marker)
+			:	marker(marker), buffers(marker->locks.size())
+		{
+		}
+		~Cache() {
+			flush();
+		}
+		void set(const uint64_t bit) {
+			const size_t shard = bit >> kShardBits;
+			auto& buffer = buffers[shard];
+			buffer.push_back(bit & ((uint64_t(1) << kShardBits) - 1));
+			if(buffer.size() >= kBufferSize) {
+				marker->set(shard, buffer);
+				buffer.clear();
+			}
+		}
+		void flush() {
+			for(size_t shard = 0; shard < buffers.size(); ++shard) {
+				if(buffers[shard].size()) {
+					marker->set(shard, buffers[shard]);
+					buffers[shard].clear();
+				}
+			}
+		}
+	private:
+		Marker* marker = nullptr;
+		std::vector<std::vector<uint32_t>> buffers;		// offsets within shard
+	};
+	
+	Marker(bitfield* field)
+		:	field(field),
+			locks((field->size() + (int64_t(1) << kShardBits) - 1) >> kShardBits)
+	{
+	}
+	
+	// thread-safe
+	std::shared_ptr<Cache> add_cache() {
+		return std::make_shared<Cache>(this);
+	}
+	
+private:
+	void set(const size_t shard, const std::vector<uint32_t>& bits) {
+		const uint64_t base = uint64_t(shard) << kShardBits;
+		std::lock_guard<std::mutex> lock(locks[shard]);
+		for(const auto bit : bits) {
+			field->set_owned(base + bit);
+		}
+	}
+	
+	bitfield* field = nullptr;
+	std::vector<std::mutex> locks;
+	
+};
+
+/*
+ * Marks pos and pos + off of all entries still used.
+ */
+template<typename T>
+void mark_used(const std::vector<T>& entries, const uint64_t offset, Marker::Cache& cache, const bitfield* R_used)
+{
+	for(size_t i = 0; i < entries.size(); ++i) {
+		if(R_used && !R_used->get(offset + i)) {
+			continue;	// drop it
+		}
+		cache.set(entries[i].pos);
+		cache.set(uint64_t(entries[i].pos) + entries[i].off);
+	}
+}
 
 template<typename T, typename S, typename DS>
 void compute_table(	int R_index, int num_threads,
@@ -30,16 +114,14 @@ void compute_table(	int R_index, int num_threads,
 	{
 		const auto begin = get_wall_time_micros();
 		
-		ThreadPool<std::pair<std::vector<T>, size_t>, size_t> pool(
-			[L_used, R_used](std::pair<std::vector<T>, size_t>& input, size_t&, size_t&) {
-				uint64_t offset = 0;
-				for(const auto& entry : input.first) {
-					if(R_used && !R_used->get(input.second + (offset++))) {
-						continue;	// drop it
-					}
-					L_used->set(entry.pos);
-					L_used->set(uint64_t(entry.pos) + entry.off);
+		Marker marker(L_used);
+		
+		UnorderedThreadPool<std::pair<std::vector<T>, size_t>, size_t, std::shared_ptr<Marker::Cache>> pool(
+			[&marker, R_used](std::pair<std::vector<T>, size_t>& input, size_t&, std::shared_ptr<Marker::Cache>& cache) {
+				if(!cache) {
+					cache = marker.add_cache();
 				}
+				mark_used(input.first, input.second, *cache, R_used);
 			}, nullptr, num_threads, "phase2/mark");
 		
 		L_used->clear();
@@ -48,6 +130,7 @@ void compute_table(	int R_index, int num_threads,
 		
 		std::cout << "[P2] Table " << R_index << " scan took "
 				<< (get_wall_time_micros() - begin) / 1e6 << " sec" << std::endl;
+		Trace::mark("[P2] Table " + std::to_string(R_index) + " scan", get_wall_time_micros() - begin);
 	}
 	const auto begin = get_wall_time_micros();
 	
@@ -56,21 +139,25 @@ void compute_table(	int R_index, int num_threads,
 	
 	typedef typename DS::WriteCache WriteCache;
 	
+	BufferPool<std::vector<S>> buffers("phase2/remap");
+	
 	Thread<std::vector<S>> R_write(
-		[R_file](std::vector<S>& input) {
+		[R_file, &buffers](std::vector<S>& input) {
 			for(auto& entry : input) {
 				R_file->write(entry);
 			}
+			buffers.take(input);
 		}, "phase2/write");
 	
-	ThreadPool<std::vector<S>, size_t, std::shared_ptr<WriteCache>> R_add(
-		[R_sort](std::vector<S>& input, size_t&, std::shared_ptr<WriteCache>& cache) {
+	UnorderedThreadPool<std::vector<S>, size_t, std::shared_ptr<WriteCache>> R_add(
+		[R_sort, &buffers](std::vector<S>& input, size_t&, std::shared_ptr<WriteCache>& cache) {
 			if(!cache) {
 				cache = R_sort->add_cache();
 			}
 			for(auto& entry : input) {
 				cache->add(entry);
 			}
+			buffers.take(input);
 		}, nullptr, std::max(num_threads / 2, 1), "phase2/add");
 	
 	Processor<std::vector<S>>* R_out = &R_add;
@@ -87,7 +174,8 @@ void compute_table(	int R_index, int num_threads,
 		}, "phase2/count");
 	
 	ThreadPool<std::pair<std::vector<T>, size_t>, std::vector<S>> map_pool(
-		[&index, R_used](std::pair<std::vector<T>, size_t>& input, std::vector<S>& out, size_t&) {
+		[&index, R_used, &buffers](std::pair<std::vector<T>, size_t>& input, std::vector<S>& out, size_t&) {
+			out = buffers.get();
 			out.reserve(input.first.size());
 			uint64_t offset = 0;
 			for(const auto& entry : input.first) {
@@ -120,6 +208,8 @@ void compute_table(	int R_index, int num_threads,
 				<< (get_wall_time_micros() - begin) / 1e6 << " sec"
 				<< ", dropped " << R_table.num_entries - num_written << " entries"
 				<< " (" << 100 * (1 - double(num_written) / R_table.num_entries) << " %)" << std::endl;
+	Telemetry::report("[P2] Table " + std::to_string(R_index));
+	Trace::mark("[P2] Table " + std::to_string(R_index) + " rewrite", get_wall_time_micros() - begin);
 }
 
 inline
@@ -127,7 +217,8 @@ void compute(	const phase1::output_t& input, output_t& out,
 				const int num_threads, const int log_num_buckets,
 				const std::string plot_name,
 				const std::string tmp_dir,
-				const std::string tmp_dir_2)
+				const std::string tmp_dir_2,
+				checkpoint_t* checkpoint = nullptr)
 {
 	const auto total_begin = get_wall_time_micros();
 	
@@ -140,37 +231,92 @@ void compute(	const phase1::output_t& input, output_t& out,
 	}
 	std::cout << "[P2] max_table_size = " << max_table_size << std::endl;
 	
+	auto is_done = [checkpoint](int table) -> bool {
+		return checkpoint && checkpoint->is_done(2, table);
+	};
+	// saves the marks for the next table along with the manifest
+	auto commit = [&](int i, const bitfield& next) {
+		if(checkpoint) {
+			const auto prev_file = checkpoint->bitfield_file;
+			const auto file_name = prefix + "bitfield" + std::to_string(i - 1) + ".tmp";
+			FILE* file = fopen(file_name.c_str(), "wb");
+			if(!file) {
+				throw std::runtime_error("fopen() failed");
+			}
+			next.write(file);
+			fclose(file);
+			if(!prev_file.empty()) {
+				checkpoint->after_save([prev_file]() {
+					std::remove(prev_file.c_str());
+				});
+			}
+			checkpoint->bitfield_file = file_name;
+			checkpoint->table_7 = out.table_7;
+			checkpoint->save(2, i);
+		}
+	};
+	
 	auto curr_bitfield = std::make_shared<bitfield>(max_table_size);
 	auto next_bitfield = std::make_shared<bitfield>(max_table_size);
 	
-	DiskTable<entry_7> table_7(prefix_2 + "table7.tmp");
-	
-	compute_table<entry_7, entry_7, DiskSort7>(
-			7, num_threads, nullptr, &table_7, input.table[6], next_bitfield.get(), nullptr);
-	
-	table_7.close();
-	remove(input.table[6].file_name);
+	if(is_done(7)) {
+		if(checkpoint->phase == 2) {
+			std::cout << "[P2] Resuming after table " << checkpoint->table << std::endl;
+		}
+		out.table_7 = checkpoint->table_7;
+		
+		// not needed anymore when phase 3 is done with table 2
+		if(!checkpoint->is_done(3, 2)) {
+			FILE* file = fopen(checkpoint->bitfield_file.c_str(), "rb");
+			if(!file) {
+				throw std::runtime_error("failed to open " + checkpoint->bitfield_file);
+			}
+			next_bitfield->read(file);
+			fclose(file);
+		}
+	} else {
+		DiskTable<entry_7> table_7(prefix_2 + "table7.tmp");
+		
+		compute_table<entry_7, entry_7, DiskSort7>(
+				7, num_threads, nullptr, &table_7, input.table[6], next_bitfield.get(), nullptr);
+		
+		table_7.close();
+		out.table_7 = table_7.get_info();
+		release_segment(checkpoint, input.table[6].file_name);
+		commit(7, *next_bitfield);
+	}
 	
 	for(int i = 5; i >= 1; --i)
 	{
+		if(checkpoint && checkpoint->is_done(3, i + 1)) {
+			continue;		// already used by phase 3
+		}
+		out.sort[i] = open_sort<DiskSortT>(
+				checkpoint, is_done(i + 1), 32, log_num_buckets, prefix + "t" + std::to_string(i + 1));
+		
+		if(is_done(i + 1)) {
+			continue;
+		}
 		std::swap(curr_bitfield, next_bitfield);
-		out.sort[i] = std::make_shared<DiskSortT>(32, log_num_buckets, prefix + "t" + std::to_string(i + 1));
 		
 		compute_table<phase1::tmp_entry_x, entry_x, DiskSortT>(
 			i + 1, num_threads, out.sort[i].get(), nullptr, input.table[i], next_bitfield.get(), curr_bitfield.get());
 		
-		remove(input.table[i].file_name);
+		release_segment(checkpoint, input.table[i].file_name);
+		commit(i + 1, *next_bitfield);
 	}
 	
 	out.params = input.params;
 	out.table_1 = input.table[0];
-	out.table_7 = table_7.get_info();
 	out.bitfield_1 = next_bitfield;
 	
+	BufferStats::print("[P2]", "phase2/");
+	Telemetry::write_json(prefix + "telemetry.json");
+	
 	std::cout << "Phase 2 took " << (get_wall_time_micros() - total_begin) / 1e6 << " sec" << std::endl;
+	Trace::mark("Phase 2", get_wall_time_micros() - total_begin);
 }
 
-
 } // phase2
 
 #endif /* INCLUDE_CHIA_PHASE2_HPP_ */
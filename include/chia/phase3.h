@@ -22,17 +22,17 @@ struct entry_lp {
 	uint64_t point;		// 63-bit (line_point)
 	uint32_t key;		// 32-bit (sort_key)
 	
-	static constexpr size_t disk_size = 12;
+	typedef bit_layout_t<
+		bit_field_t<&entry_lp::point, 63>,
+		bit_field_t<&entry_lp::key, 32>> layout;
+	
+	static constexpr size_t disk_size = layout::disk_size;
 	
 	size_t read(const uint8_t* buf) {
-		memcpy(&point, buf, 8);
-		memcpy(&key, buf + 8, 4);
-		return disk_size;
+		return layout::read(*this, buf);
 	}
 	size_t write(uint8_t* buf) const {
-		memcpy(buf, &point, 8);
-		memcpy(buf + 8, &key, 4);
-		return disk_size;
+		return layout::write(*this, buf);
 	}
 };
 
@@ -40,17 +40,17 @@ struct entry_np {
 	uint32_t key;		// 32-bit (sort_key)
 	uint32_t pos;		// 32-bit (new_pos)
 	
-	static constexpr size_t disk_size = 8;
+	typedef bit_layout_t<
+		bit_field_t<&entry_np::key, 32>,
+		bit_field_t<&entry_np::pos, 32>> layout;
+	
+	static constexpr size_t disk_size = layout::disk_size;
 	
 	size_t read(const uint8_t* buf) {
-		memcpy(&key, buf, 4);
-		memcpy(&pos, buf + 4, 4);
-		return disk_size;
+		return layout::read(*this, buf);
 	}
 	size_t write(uint8_t* buf) const {
-		memcpy(buf, &key, 4);
-		memcpy(buf + 4, &pos, 4);
-		return disk_size;
+		return layout::write(*this, buf);
 	}
 };
 
@@ -89,8 +89,8 @@ struct get_line_point {
 	}
 };
 
-typedef DiskSort<entry_lp, get_line_point<entry_lp>> DiskSortLP;
-typedef DiskSort<entry_np, get_sort_key<entry_np>> DiskSortNP;
+typedef DiskSort<entry_lp, get_line_point<entry_lp>, radix_sort_t<entry_lp, get_line_point<entry_lp>>> DiskSortLP;
+typedef DiskSort<entry_np, get_sort_key<entry_np>, radix_sort_t<entry_np, get_sort_key<entry_np>>> DiskSortNP;
 
 struct output_t {
 	int header_size = 0;
@@ -104,4 +104,14 @@ struct output_t {
 
 } // phase3
 
+
+/*
+ * Bucket files store the key without the upper bits implied by the bucket index.
+ */
+template<>
+struct bucket_layout_t<phase3::entry_lp, phase3::get_line_point<phase3::entry_lp>> : bucket_key_layout_t<phase3::entry_lp> {};
+
+template<>
+struct bucket_layout_t<phase3::entry_np, phase3::get_sort_key<phase3::entry_np>> : bucket_key_layout_t<phase3::entry_np> {};
+
 #endif /* INCLUDE_CHIA_PHASE3_H_ */
@@ -12,6 +12,8 @@
 #include <chia/phase3.h>
 #include <chia/encoding.hpp>
 #include <chia/DiskTable.h>
+#include <chia/checkpoint.h>
+#include <chia/BufferPool.h>
 
 #include <list>
 
@@ -85,8 +87,10 @@ void compute_stage1(int L_index, int num_threads,
 	
 	typedef DiskSortLP::WriteCache WriteCache;
 	
-	ThreadPool<std::vector<entry_kpp>, size_t, std::shared_ptr<WriteCache>> R_add_2(
-		[R_sort_2, &R_num_write]
+	BufferPool<std::vector<entry_kpp>> buffers("phase3/merge");
+	
+	UnorderedThreadPool<std::vector<entry_kpp>, size_t, std::shared_ptr<WriteCache>> R_add_2(
+		[R_sort_2, &R_num_write, &buffers]
 		 (std::vector<entry_kpp>& input, size_t&, std::shared_ptr<WriteCache>& cache) {
 			if(!cache) {
 				cache = R_sort_2->add_cache();
@@ -98,14 +102,16 @@ void compute_stage1(int L_index, int num_threads,
 				cache->add(tmp);
 			}
 			R_num_write += input.size();
+			buffers.take(input);
 		}, nullptr, std::max(num_threads / 2, 1), "phase3/add");
 	
 	ThreadPool<std::pair<std::vector<S>, size_t>, std::vector<entry_kpp>, merge_buffer_t> R_read(
-		[&mutex, &signal, &signal_1, &L_input, &L_is_end] (
+		[&mutex, &signal, &signal_1, &L_input, &L_is_end, &buffers] (
 			std::pair<std::vector<S>, size_t>& input,
 			std::vector<entry_kpp>& out,
 			merge_buffer_t& L_buffer)
 		{
+			out = buffers.get();
 			out.reserve(input.first.size());
 			uint64_t L_position = 0;
 			for(const auto& entry : input.first) {
@@ -161,7 +167,7 @@ void compute_stage1(int L_index, int num_threads,
 				L_buffer.offset += count;
 				L_buffer.new_pos.erase(L_buffer.new_pos.begin(), L_buffer.new_pos.begin() + count);
 			}
-		}, &R_add_2, num_threads_merge, "phase3/merge");
+		}, &R_add_2, num_threads_merge, "phase3/merge", 0, true);		// each worker needs to copy every L buffer
 	
 	std::thread R_sort_read(
 		[&mutex, &signal_1, num_threads, L_table, R_sort, R_table, &R_read, &R_is_end]() {
@@ -198,6 +204,8 @@ void compute_stage1(int L_index, int num_threads,
 	std::cout << "[P3-1] Table " << L_index + 1 << " took "
 				<< (get_wall_time_micros() - begin) / 1e6 << " sec"
 				<< ", wrote " << R_num_write << " right entries" << std::endl;
+	Telemetry::report("[P3-1] Table " + std::to_string(L_index + 1));
+	Trace::mark("[P3-1] Table " + std::to_string(L_index + 1), get_wall_time_micros() - begin);
 }
 
 static uint32_t CalculateLinePointSize(uint8_t k) {
@@ -352,7 +360,7 @@ uint64_t compute_stage2(int L_index, int num_threads,
 	
 	typedef DiskSortNP::WriteCache WriteCache;
 	
-	ThreadPool<std::pair<std::vector<entry_lp>, size_t>, size_t, std::shared_ptr<WriteCache>> L_add(
+	UnorderedThreadPool<std::pair<std::vector<entry_lp>, size_t>, size_t, std::shared_ptr<WriteCache>> L_add(
 		[L_sort, &L_num_write]
 		 (std::pair<std::vector<entry_lp>, size_t>& input, size_t&, std::shared_ptr<WriteCache>& cache) {
 			if(!cache) {
@@ -371,17 +379,21 @@ uint64_t compute_stage2(int L_index, int num_threads,
 			L_num_write += index - input.second;
 		}, nullptr, std::max(num_threads / 2, 1), "phase3/add");
 	
+	BufferPool<std::vector<uint64_t>> point_buffers("phase3/slice");
+	BufferPool<std::vector<uint8_t>> park_buffers("phase3/park");
+	
 	Thread<std::vector<park_out_t>> park_write(
-		[plot_file](std::vector<park_out_t>& input) {
-			for(const auto& park : input) {
+		[plot_file, &park_buffers](std::vector<park_out_t>& input) {
+			for(auto& park : input) {
 				fwrite_at(plot_file, park.offset, park.buffer.data(), park.buffer.size());
+				park_buffers.take(park.buffer);
 			}
 		}, "phase3/write");
 	
 	ThreadPool<std::vector<park_data_t>, std::vector<park_out_t>> park_threads(
-		[L_index, L_final_begin, park_size_bytes, &num_written_final]
+		[L_index, L_final_begin, park_size_bytes, &num_written_final, &point_buffers, &park_buffers]
 		 (std::vector<park_data_t>& input, std::vector<park_out_t>& out, size_t&) {
-			for(const auto& park : input) {
+			for(auto& park : input) {
 				const auto& points = park.points;
 				if(points.empty()) {
 					throw std::logic_error("empty park input");
@@ -400,6 +412,7 @@ uint64_t compute_stage2(int L_index, int num_threads,
 				}
 				park_out_t tmp;
 				tmp.offset = L_final_begin + park.index * park_size_bytes;
+				tmp.buffer = park_buffers.get();
 				tmp.buffer.resize(park_size_bytes);
 				WritePark(
 					points[0],
@@ -410,11 +423,12 @@ uint64_t compute_stage2(int L_index, int num_threads,
 					tmp.buffer.size());
 				out.emplace_back(std::move(tmp));
 				num_written_final += points.size();
+				point_buffers.take(park.points);
 			}
 		}, &park_write, std::max(num_threads / 2, 1), "phase3/park");
 	
 	Thread<std::pair<std::vector<entry_lp>, size_t>> R_read(
-		[&R_num_read, &L_add, &park, &park_threads](std::pair<std::vector<entry_lp>, size_t>& input) {
+		[&R_num_read, &L_add, &park, &park_threads, &point_buffers](std::pair<std::vector<entry_lp>, size_t>& input) {
 			std::vector<park_data_t> parks;
 			parks.reserve(input.first.size() / kEntriesPerPark + 2);
 			uint64_t index = input.second;
@@ -428,7 +442,7 @@ uint64_t compute_stage2(int L_index, int num_threads,
 						parks.emplace_back(std::move(park));
 						park.index++;
 					}
-					park.points.clear();
+					park.points = point_buffers.get();
 					park.points.reserve(kEntriesPerPark);
 				}
 				park.points.push_back(entry.point);
@@ -466,6 +480,8 @@ uint64_t compute_stage2(int L_index, int num_threads,
 				<< (get_wall_time_micros() - begin) / 1e6 << " sec"
 				<< ", wrote " << L_num_write << " left entries"
 				<< ", " << num_written_final << " final" << std::endl;
+	Telemetry::report("[P3-2] Table " + std::to_string(L_index + 1));
+	Trace::mark("[P3-2] Table " + std::to_string(L_index + 1), get_wall_time_micros() - begin);
 	return num_written_final;
 }
 
@@ -474,96 +490,173 @@ void compute(	phase2::output_t& input, output_t& out,
 				const int num_threads, const int log_num_buckets,
 				const std::string plot_name,
 				const std::string tmp_dir,
-				const std::string tmp_dir_2)
+				const std::string tmp_dir_2,
+				checkpoint_t* checkpoint = nullptr)
 {
 	const auto total_begin = get_wall_time_micros();
 	
 	const std::string prefix_2 = tmp_dir_2 + plot_name + ".";
 	
+	auto is_done = [checkpoint](int table) -> bool {
+		return checkpoint && checkpoint->is_done(3, table);
+	};
+	
 	out.params = input.params;
 	out.plot_file_name = tmp_dir + plot_name + ".plot.tmp";
 	
-	FILE* plot_file = fopen(out.plot_file_name.c_str(), "wb");
-	if(!plot_file) {
-		throw std::runtime_error("fopen() failed");
-	}
-	out.header_size = WriteHeader(	plot_file, 32, input.params.id.data(),
-									input.params.memo.data(), input.params.memo.size());
-	
 	std::vector<uint64_t> final_pointers(8, 0);
-	final_pointers[1] = out.header_size;
-	
 	uint64_t num_written_final = 0;
 	
-	DiskTable<phase2::entry_1> L_table_1(input.table_1);
-	
-	auto R_sort_lp = std::make_shared<DiskSortLP>(
-			63, log_num_buckets, prefix_2 + "p3s1.t2");
+	FILE* plot_file = nullptr;
+	if(is_done(2)) {
+		if(checkpoint->phase == 3) {
+			std::cout << "[P3] Resuming after table " << checkpoint->table << std::endl;
+		}
+		plot_file = fopen(out.plot_file_name.c_str(), "rb+");
+		if(!plot_file) {
+			throw std::runtime_error("fopen() failed");
+		}
+		out.header_size = checkpoint->header_size;
+		num_written_final = checkpoint->num_written_final;
+		final_pointers.assign(checkpoint->final_pointers.begin(), checkpoint->final_pointers.end());
+	} else {
+		plot_file = fopen(out.plot_file_name.c_str(), "wb");
+		if(!plot_file) {
+			throw std::runtime_error("fopen() failed");
+		}
+		out.header_size = WriteHeader(	plot_file, 32, input.params.id.data(),
+										input.params.memo.data(), input.params.memo.size());
+		final_pointers[1] = out.header_size;
+	}
 	
-	compute_stage1<phase2::entry_1, phase2::entry_x, DiskSortNP, phase2::DiskSortT>(
-			1, num_threads, nullptr, input.sort[1].get(), R_sort_lp.get(), &L_table_1, input.bitfield_1.get());
+	// plot file is flushed, so it's complete up to final_pointers[table]
+	auto commit = [&](int table) {
+		if(checkpoint) {
+			if(fflush(plot_file)) {
+				throw std::runtime_error("fflush() failed");
+			}
+			checkpoint->plot_file_name = out.plot_file_name;
+			checkpoint->header_size = out.header_size;
+			checkpoint->num_written_final = num_written_final;
+			checkpoint->num_written_7 = out.num_written_7;
+			std::copy(final_pointers.begin(), final_pointers.end(), checkpoint->final_pointers.begin());
+			checkpoint->save(3, table);
+		}
+	};
 	
-	input.bitfield_1 = nullptr;
-	remove(input.table_1.file_name);
+	std::shared_ptr<DiskSortNP> L_sort_np;
 	
-	auto L_sort_np = std::make_shared<DiskSortNP>(
-			32, log_num_buckets, prefix_2 + "p3s2.t2");
+	// output of table L_index when resuming
+	auto resume_L_sort = [&](int L_index) {
+		if(!L_sort_np) {
+			L_sort_np = open_sort<DiskSortNP>(
+					checkpoint, true, 32, log_num_buckets, prefix_2 + "p3s2.t" + std::to_string(L_index));
+		}
+	};
 	
-	num_written_final += compute_stage2(
-			1, num_threads, R_sort_lp.get(), L_sort_np.get(),
-			plot_file, final_pointers[1], &final_pointers[2]);
+	if(!is_done(2))
+	{
+		DiskTable<phase2::entry_1> L_table_1(input.table_1);
+		
+		auto R_sort_lp = std::make_shared<DiskSortLP>(
+				63, log_num_buckets, prefix_2 + "p3s1.t2");
+		
+		compute_stage1<phase2::entry_1, phase2::entry_x, DiskSortNP, phase2::DiskSortT>(
+				1, num_threads, nullptr, input.sort[1].get(), R_sort_lp.get(), &L_table_1, input.bitfield_1.get());
+		
+		input.bitfield_1 = nullptr;
+		release_sort(checkpoint, input.sort[1]);
+		release_segment(checkpoint, input.table_1.file_name);
+		if(checkpoint) {
+			const auto bitfield_file = checkpoint->bitfield_file;
+			checkpoint->after_save([bitfield_file]() {
+				std::remove(bitfield_file.c_str());
+			});
+		}
+		
+		L_sort_np = open_sort<DiskSortNP>(
+				checkpoint, false, 32, log_num_buckets, prefix_2 + "p3s2.t2");
+		
+		num_written_final += compute_stage2(
+				1, num_threads, R_sort_lp.get(), L_sort_np.get(),
+				plot_file, final_pointers[1], &final_pointers[2]);
+		
+		commit(2);
+	}
+	input.bitfield_1 = nullptr;		// when resuming
 	
 	for(int L_index = 2; L_index < 6; ++L_index)
 	{
+		if(is_done(L_index + 1)) {
+			continue;
+		}
 		const std::string R_t = "t" + std::to_string(L_index + 1);
 		
-		R_sort_lp = std::make_shared<DiskSortLP>(
+		resume_L_sort(L_index);
+		
+		auto R_sort_lp = std::make_shared<DiskSortLP>(
 				63, log_num_buckets, prefix_2 + "p3s1." + R_t);
 		
 		compute_stage1<entry_np, phase2::entry_x, DiskSortNP, phase2::DiskSortT>(
 				L_index, num_threads, L_sort_np.get(), input.sort[L_index].get(), R_sort_lp.get());
 		
-		L_sort_np = std::make_shared<DiskSortNP>(
-				32, log_num_buckets, prefix_2 + "p3s2." + R_t);
+		release_sort(checkpoint, L_sort_np);
+		release_sort(checkpoint, input.sort[L_index]);
+		
+		L_sort_np = open_sort<DiskSortNP>(
+				checkpoint, false, 32, log_num_buckets, prefix_2 + "p3s2." + R_t);
 		
 		num_written_final += compute_stage2(
 				L_index, num_threads, R_sort_lp.get(), L_sort_np.get(),
 				plot_file, final_pointers[L_index], &final_pointers[L_index + 1]);
+		
+		commit(L_index + 1);
 	}
 	
-	DiskTable<phase2::entry_7> R_table_7(input.table_7);
-	
-	R_sort_lp = std::make_shared<DiskSortLP>(63, log_num_buckets, prefix_2 + "p3s1.t7");
-	
-	compute_stage1<entry_np, phase2::entry_7, DiskSortNP, phase2::DiskSort7>(
-			6, num_threads, L_sort_np.get(), nullptr, R_sort_lp.get(), nullptr, nullptr, &R_table_7);
-	
-	remove(input.table_7.file_name);
-	
-	L_sort_np = std::make_shared<DiskSortNP>(32, log_num_buckets, prefix_2 + "p3s2.t7");
-	
-	const auto num_written_final_7 = compute_stage2(
-			6, num_threads, R_sort_lp.get(), L_sort_np.get(),
-			plot_file, final_pointers[6], &final_pointers[7]);
-	num_written_final += num_written_final_7;
-	
-	fseek_set(plot_file, out.header_size - 10 * 8);
-	for(size_t i = 1; i < final_pointers.size(); ++i) {
-		uint8_t tmp[8] = {};
-		Util::IntToEightBytes(tmp, final_pointers[i]);
-		fwrite_ex(plot_file, tmp, sizeof(tmp));
+	if(is_done(7)) {
+		resume_L_sort(7);
+		out.num_written_7 = checkpoint->num_written_7;
+	} else {
+		resume_L_sort(6);
+		
+		DiskTable<phase2::entry_7> R_table_7(input.table_7);
+		
+		auto R_sort_lp = std::make_shared<DiskSortLP>(63, log_num_buckets, prefix_2 + "p3s1.t7");
+		
+		compute_stage1<entry_np, phase2::entry_7, DiskSortNP, phase2::DiskSort7>(
+				6, num_threads, L_sort_np.get(), nullptr, R_sort_lp.get(), nullptr, nullptr, &R_table_7);
+		
+		release_sort(checkpoint, L_sort_np);
+		release_segment(checkpoint, input.table_7.file_name);
+		
+		L_sort_np = open_sort<DiskSortNP>(checkpoint, false, 32, log_num_buckets, prefix_2 + "p3s2.t7");
+		
+		out.num_written_7 = compute_stage2(
+				6, num_threads, R_sort_lp.get(), L_sort_np.get(),
+				plot_file, final_pointers[6], &final_pointers[7]);
+		num_written_final += out.num_written_7;
+		
+		fseek_set(plot_file, out.header_size - 10 * 8);
+		for(size_t i = 1; i < final_pointers.size(); ++i) {
+			uint8_t tmp[8] = {};
+			Util::IntToEightBytes(tmp, final_pointers[i]);
+			fwrite_ex(plot_file, tmp, sizeof(tmp));
+		}
+		commit(7);
 	}
 	fclose(plot_file);
 	
 	out.sort_7 = L_sort_np;
-	out.num_written_7 = num_written_final_7;
 	out.final_pointer_7 = final_pointers[7];
 	
+	BufferStats::print("[P3]", "phase3/");
+	Telemetry::write_json(tmp_dir + plot_name + ".p3.telemetry.json");
+	
 	std::cout << "Phase 3 took " << (get_wall_time_micros() - total_begin) / 1e6 << " sec"
 			", wrote " << num_written_final << " entries to final plot" << std::endl;
+	Trace::mark("Phase 3", get_wall_time_micros() - total_begin);
 }
 
-
 } // phase3
 
 #endif /* INCLUDE_CHIA_PHASE3_HPP_ */
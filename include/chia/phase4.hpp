@@ -7,6 +7,8 @@
 
 #include <chia/phase4.h>
 #include <chia/DiskSort.hpp>
+#include <chia/checkpoint.h>
+#include <chia/BufferPool.h>
 
 #include <chia/encoding.hpp>
 #include <chia/util.hpp>
@@ -96,18 +98,25 @@ uint64_t compute(	FILE* plot_file, const int header_size,
 		std::vector<uint8_t> buffer;
 	};
     
+	BufferPool<std::vector<uint32_t>> array_buffers("phase4/read/P7");
+	BufferPool<std::vector<uint8_t>> delta_buffers("phase4/read/C3");
+	BufferPool<std::vector<uint8_t>> write_buffers("phase4/park");
+	
     Thread<std::vector<write_data_t>> plot_write(
-		[plot_file](std::vector<write_data_t>& input) {
-			for(const auto& write : input) {
+		[plot_file, &write_buffers](std::vector<write_data_t>& input) {
+			for(auto& write : input) {
 				fwrite_at(plot_file, write.offset, write.buffer.data(), write.buffer.size());
+				write_buffers.take(write.buffer);
 			}
 		}, "phase4/write");
     
     ThreadPool<std::vector<park_data_t>, std::vector<write_data_t>> p7_threads(
-		[P7_park_size](std::vector<park_data_t>& input, std::vector<write_data_t>& out, size_t&) {
-			for(const auto& park : input) {
+		[P7_park_size, &array_buffers, &write_buffers]
+		 (std::vector<park_data_t>& input, std::vector<write_data_t>& out, size_t&) {
+			for(auto& park : input) {
 				write_data_t tmp;
 				tmp.offset = park.offset;
+				tmp.buffer = write_buffers.get();
 				tmp.buffer.resize(P7_park_size);
 				ParkBits bits;
 				for(uint64_t new_pos : park.array) {
@@ -115,13 +124,15 @@ uint64_t compute(	FILE* plot_file, const int header_size,
 				}
 				bits.ToBytes(tmp.buffer.data());
 				out.emplace_back(std::move(tmp));
+				array_buffers.take(park.array);
     		}
 		}, &plot_write, std::max(num_threads / 2, 1), "phase4/P7");
     
 	ThreadPool<park_deltas_t, std::vector<write_data_t>> park_threads(
-		[C3_size](park_deltas_t& park, std::vector<write_data_t>& out, size_t&) {
+		[C3_size, &delta_buffers, &write_buffers](park_deltas_t& park, std::vector<write_data_t>& out, size_t&) {
 			write_data_t tmp;
 			tmp.offset = park.offset;
+			tmp.buffer = write_buffers.get();
 			tmp.buffer.resize(C3_size);
 			const size_t num_bytes =
 					Encoding::ANSEncodeDeltas(park.deltas, kC3R, tmp.buffer.data() + 2);
@@ -131,6 +142,7 @@ uint64_t compute(	FILE* plot_file, const int header_size,
 			}
 			Util::IntToTwoBytes(tmp.buffer.data(), num_bytes);	// Write the size
 			out.emplace_back(std::move(tmp));
+			delta_buffers.take(park.deltas);
 		}, &plot_write, std::max(num_threads / 2, 1), "phase4/C3");
 
     // We read each table7 entry, which is sorted by f7, but we don't need f7 anymore. Instead,
@@ -138,7 +150,7 @@ uint64_t compute(	FILE* plot_file, const int header_size,
     Thread<std::pair<std::vector<phase3::entry_np>, size_t>> read_thread(
 	[begin_byte_C3, C3_size, P7_park_size, &num_C1_entries, &prev_y, &C2,
 	 &park_deltas, &park_data, &park_threads, &p7_threads, &plot_write,
-	 &final_file_writer_1, &final_file_writer_3]
+	 &final_file_writer_1, &final_file_writer_3, &array_buffers, &delta_buffers]
 	 (std::pair<std::vector<phase3::entry_np>, size_t>& input) {
 		std::vector<park_data_t> parks;
 		parks.reserve(input.first.size() / kEntriesPerPark + 2);
@@ -153,7 +165,7 @@ uint64_t compute(	FILE* plot_file, const int header_size,
 				
 				parks.emplace_back(std::move(park_data));
 				
-				park_data.array.clear();
+				park_data.array = array_buffers.get();
 				park_data.array.reserve(kEntriesPerPark);
 			}
 			park_data.array.push_back(entry.pos);
@@ -177,7 +189,7 @@ uint64_t compute(	FILE* plot_file, const int header_size,
 				if(index % (kCheckpoint1Interval * kCheckpoint2Interval) == 0) {
 					C2.push_back(entry_y);
 				}
-				park_deltas.deltas.clear();
+				park_deltas.deltas = delta_buffers.get();
 				park_deltas.deltas.reserve(kCheckpoint1Interval);
 				num_C1_entries++;
 			}
@@ -216,6 +228,7 @@ uint64_t compute(	FILE* plot_file, const int header_size,
     		fwrite_at(plot_file, final_file_writer_1, C1_entry_buf, sizeof(C1_entry_buf));
     
     std::cout << "[P4] Finished writing C1 and C3 tables" << std::endl;
+    Telemetry::report("[P4] C1 and C3 tables");
     std::cout << "[P4] Writing C2 table" << std::endl;
 
     for(const uint64_t C2_entry : C2) {
@@ -246,7 +259,8 @@ void compute(	const phase3::output_t& input, output_t& out,
 				const int num_threads, const int log_num_buckets,
 				const std::string plot_name,
 				const std::string tmp_dir,
-				const std::string tmp_dir_2)
+				const std::string tmp_dir_2,
+				checkpoint_t* checkpoint = nullptr)
 {
 	const auto total_begin = get_wall_time_micros();
 	
@@ -265,8 +279,18 @@ void compute(	const phase3::output_t& input, output_t& out,
 	
 	std::rename(input.plot_file_name.c_str(), out.plot_file_name.c_str());
 	
+	if(checkpoint) {
+		checkpoint->remove();
+		input.sort_7->set_keep_files(false);
+		input.sort_7->close();
+	}
+	
+	BufferStats::print("[P4]", "phase4/");
+	Telemetry::write_json(tmp_dir + plot_name + ".p4.telemetry.json");
+	
 	std::cout << "Phase 4 took " << (get_wall_time_micros() - total_begin) / 1e6 << " sec"
 			", final plot size is " << out.plot_size << " bytes" << std::endl;
+	Trace::mark("Phase 4", get_wall_time_micros() - total_begin);
 }
 
 
@@ -8,6 +8,7 @@
 #ifndef INCLUDE_CHIA_SETTINGS_H_
 #define INCLUDE_CHIA_SETTINGS_H_
 
+#include <string>
 #include <cstdint>
 #include <cstddef>
 
@@ -24,5 +25,44 @@ extern size_t g_read_chunk_size;
  */
 extern size_t g_write_chunk_size;
 
+/*
+ * Number of I/O requests in flight per reader / writer, see AsyncIO.
+ * 1 = synchronous pread() / pwrite()
+ * default = 8
+ */
+extern int g_io_queue_depth;
+
+/*
+ * Number of inputs a Thread can queue before take() blocks.
+ * default = 1, some bursty stages have more, see settings.cpp
+ */
+extern int g_queue_depth;
+
+/*
+ * Queue depth of a stage by thread name (ie. "phase1/slice"), g_queue_depth if not set.
+ * set_queue_depth() is NOT thread-safe, call it before plotting.
+ */
+int get_queue_depth(const std::string& stage);
+
+void set_queue_depth(const std::string& stage, int depth);
+
+/*
+ * Bind pool workers to NUMA nodes, see numa.h
+ * default = false
+ */
+extern bool g_numa;
+
+/*
+ * Record busy / idle / blocked time per pipeline stage, see Telemetry.h
+ * default = false
+ */
+extern bool g_telemetry;
+
+/*
+ * Record a span per pipeline job for chrome://tracing, see Trace.h
+ * default = false
+ */
+extern bool g_trace;
+
 
 #endif /* INCLUDE_CHIA_SETTINGS_H_ */
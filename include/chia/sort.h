@@ -0,0 +1,110 @@
+/*
+ * sort.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef INCLUDE_CHIA_SORT_H_
+#define INCLUDE_CHIA_SORT_H_
+
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+
+
+/*
+ * Sort engines for DiskSort, sorting count entries from input to output by Key{}.
+ * Only the lower key_bits of the key differ between entries, the rest is implied by the bucket.
+ * input may be overwritten, tmp is a per-thread scratch buffer that is kept between calls.
+ */
+
+template<typename T, typename Key>
+struct std_sort_t {
+	void operator()(T* input, T* output, const size_t count, const int key_bits, std::vector<T>& tmp) const
+	{
+		std::copy(input, input + count, output);
+		std::sort(output, output + count,
+			[](const T& lhs, const T& rhs) -> bool {
+				return Key{}(lhs) < Key{}(rhs);
+			});
+	}
+};
+
+/*
+ * LSD radix sort over the lower key_bits, the last pass writes to output.
+ * Stable, unlike std_sort_t.
+ */
+template<typename T, typename Key>
+struct radix_sort_t {
+	static constexpr int kMaxDigitBits = 12;
+	static constexpr int kMaxPasses = 6;
+	static constexpr size_t kMinCount = 256;		// below this std::sort is faster
+
+	void operator()(T* input, T* output, const size_t count, const int key_bits, std::vector<T>& tmp) const
+	{
+		if(count < kMinCount || key_bits <= 0) {
+			std_sort_t<T, Key>{}(input, output, count, key_bits, tmp);
+			return;
+		}
+		const int num_digits = (key_bits + kMaxDigitBits - 1) / kMaxDigitBits;
+		if(num_digits > kMaxPasses) {
+			throw std::logic_error("radix_sort_t: key_bits too large");
+		}
+		const int digit_bits = (key_bits + num_digits - 1) / num_digits;
+		const size_t num_bins = size_t(1) << digit_bits;
+		const uint64_t mask = num_bins - 1;
+
+		// histograms of all digits in one pass
+		std::vector<uint32_t> histogram(num_digits * num_bins);
+		for(size_t i = 0; i < count; ++i) {
+			const uint64_t key = Key{}(input[i]);
+			for(int k = 0; k < num_digits; ++k) {
+				histogram[k * num_bins + ((key >> (k * digit_bits)) & mask)]++;
+			}
+		}
+		// skip digits which are the same for all entries
+		int passes[kMaxPasses];
+		int num_passes = 0;
+		const uint64_t first_key = Key{}(input[0]);
+		for(int k = 0; k < num_digits; ++k) {
+			if(histogram[k * num_bins + ((first_key >> (k * digit_bits)) & mask)] != count) {
+				passes[num_passes++] = k;
+			}
+		}
+		if(num_passes == 0) {
+			std::copy(input, input + count, output);
+			return;
+		}
+		// ping-pong such that the last pass ends up in output
+		T* other = input;
+		if(num_passes % 2 == 0) {
+			if(tmp.size() < count) {
+				tmp.resize(count);
+			}
+			other = tmp.data();
+		}
+		const T* src = input;
+		for(int p = 0; p < num_passes; ++p)
+		{
+			const int shift = passes[p] * digit_bits;
+			uint32_t* offset = histogram.data() + passes[p] * num_bins;
+			T* dst = (num_passes - p) % 2 ? output : other;
+			
+			uint32_t sum = 0;
+			for(size_t i = 0; i < num_bins; ++i) {
+				const auto num = offset[i];
+				offset[i] = sum;
+				sum += num;
+			}
+			for(size_t i = 0; i < count; ++i) {
+				const auto& entry = src[i];
+				dst[offset[(Key{}(entry) >> shift) & mask]++] = entry;
+			}
+			src = dst;
+		}
+	}
+};
+
+
+#endif /* INCLUDE_CHIA_SORT_H_ */
@@ -0,0 +1,241 @@
+#include "blake3_batch.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BLAKE3_BATCH_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * The hash_many() kernels of lib/BLAKE3 always compress full 64-byte blocks,
+ * so they cannot be used for messages shorter than one block. The kernels
+ * below compress one (short) block per lane with CHUNK_START | CHUNK_END | ROOT,
+ * which is all that is needed to hash a message of up to 64 bytes.
+ */
+
+#define FLAGS (1 | 2 | 8)   /* CHUNK_START | CHUNK_END | ROOT */
+
+static const uint32_t IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+
+static const uint8_t MSG_SCHEDULE[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+#define G(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, a, b, c, d, x, y) \
+    v[a] = ADD(ADD(v[a], v[b]), x);                                \
+    v[d] = ROT16(XOR(v[d], v[a]));                                 \
+    v[c] = ADD(v[c], v[d]);                                        \
+    v[b] = ROT12(XOR(v[b], v[c]));                                 \
+    v[a] = ADD(ADD(v[a], v[b]), y);                                \
+    v[d] = ROT8(XOR(v[d], v[a]));                                  \
+    v[c] = ADD(v[c], v[d]);                                        \
+    v[b] = ROT7(XOR(v[b], v[c]))
+
+#define ROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, m, r)                                                \
+    G(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, 0, 4, 8, 12, m[MSG_SCHEDULE[r][0]], m[MSG_SCHEDULE[r][1]]);   \
+    G(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, 1, 5, 9, 13, m[MSG_SCHEDULE[r][2]], m[MSG_SCHEDULE[r][3]]);   \
+    G(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, 2, 6, 10, 14, m[MSG_SCHEDULE[r][4]], m[MSG_SCHEDULE[r][5]]);  \
+    G(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, 3, 7, 11, 15, m[MSG_SCHEDULE[r][6]], m[MSG_SCHEDULE[r][7]]);  \
+    G(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, 0, 5, 10, 15, m[MSG_SCHEDULE[r][8]], m[MSG_SCHEDULE[r][9]]);  \
+    G(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, 1, 6, 11, 12, m[MSG_SCHEDULE[r][10]], m[MSG_SCHEDULE[r][11]]); \
+    G(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, 2, 7, 8, 13, m[MSG_SCHEDULE[r][12]], m[MSG_SCHEDULE[r][13]]);  \
+    G(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, 3, 4, 9, 14, m[MSG_SCHEDULE[r][14]], m[MSG_SCHEDULE[r][15]])
+
+#define COMPRESS(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, m) \
+    ROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, m, 0);    \
+    ROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, m, 1);    \
+    ROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, m, 2);    \
+    ROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, m, 3);    \
+    ROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, m, 4);    \
+    ROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, m, 5);    \
+    ROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, m, 6)
+
+#define U8TO32_LITTLE(p) (*(const uint32_t *)(p))
+#define ROTR32(v, n) (((v) >> (n)) | ((v) << (32 - (n))))
+
+#define ADD32(a, b) ((a) + (b))
+#define XOR32(a, b) ((a) ^ (b))
+#define ROTR16(v) ROTR32(v, 16)
+#define ROTR12(v) ROTR32(v, 12)
+#define ROTR8(v) ROTR32(v, 8)
+#define ROTR7(v) ROTR32(v, 7)
+
+static void hash_block_1(const uint8_t *input, uint32_t block_len, uint8_t *out)
+{
+    uint32_t m[16], v[16];
+    int i;
+
+    for (i = 0; i < 16; ++i) {
+        m[i] = U8TO32_LITTLE(input + i * 4);
+    }
+    for (i = 0; i < 8; ++i) {
+        v[i] = IV[i];
+    }
+    v[8] = IV[0];
+    v[9] = IV[1];
+    v[10] = IV[2];
+    v[11] = IV[3];
+    v[12] = 0;
+    v[13] = 0;
+    v[14] = block_len;
+    v[15] = FLAGS;
+
+    COMPRESS(ADD32, XOR32, ROTR16, ROTR12, ROTR8, ROTR7, v, m);
+
+    for (i = 0; i < 8; ++i) {
+        const uint32_t h = v[i] ^ v[i + 8];
+        memcpy(out + i * 4, &h, 4);
+    }
+}
+
+#ifdef BLAKE3_BATCH_SIMD
+
+/*
+ * Lane i of every state vector belongs to message i. Message words are
+ * transposed in and hash words transposed out through small stack arrays.
+ */
+#define HASH_BLOCKS_N(N, VEC, SET1, LOAD, STORE, ADD, XOR, ROT16, ROT12, ROT8, ROT7) \
+    uint32_t tmp[16][N];                                                            \
+    VEC m[16], v[16];                                                               \
+    int i, k;                                                                       \
+                                                                                    \
+    for (k = 0; k < N; ++k) {                                                       \
+        for (i = 0; i < 16; ++i) {                                                  \
+            tmp[i][k] = U8TO32_LITTLE(inputs + k * 64 + i * 4);                     \
+        }                                                                           \
+    }                                                                               \
+    for (i = 0; i < 16; ++i) {                                                      \
+        m[i] = LOAD(tmp[i]);                                                        \
+    }                                                                               \
+    for (i = 0; i < 8; ++i) {                                                       \
+        v[i] = SET1(IV[i]);                                                         \
+    }                                                                               \
+    v[8] = SET1(IV[0]);                                                             \
+    v[9] = SET1(IV[1]);                                                             \
+    v[10] = SET1(IV[2]);                                                            \
+    v[11] = SET1(IV[3]);                                                            \
+    v[12] = SET1(0);                                                                \
+    v[13] = SET1(0);                                                                \
+    v[14] = SET1(block_len);                                                        \
+    v[15] = SET1(FLAGS);                                                            \
+                                                                                    \
+    COMPRESS(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v, m);                             \
+                                                                                    \
+    for (i = 0; i < 8; ++i) {                                                       \
+        STORE(tmp[i], XOR(v[i], v[i + 8]));                                         \
+    }                                                                               \
+    for (k = 0; k < N; ++k) {                                                       \
+        for (i = 0; i < 8; ++i) {                                                   \
+            memcpy(out + k * 32 + i * 4, &tmp[i][k], 4);                            \
+        }                                                                           \
+    }
+
+#define SSE_LOAD(p) _mm_loadu_si128((const __m128i *)(p))
+#define SSE_STORE(p, v) _mm_storeu_si128((__m128i *)(p), v)
+#define SSE_ROTR(v, n) _mm_or_si128(_mm_srli_epi32(v, n), _mm_slli_epi32(v, 32 - (n)))
+#define SSE_ROTR16(v) SSE_ROTR(v, 16)
+#define SSE_ROTR12(v) SSE_ROTR(v, 12)
+#define SSE_ROTR8(v) SSE_ROTR(v, 8)
+#define SSE_ROTR7(v) SSE_ROTR(v, 7)
+
+__attribute__((target("sse2")))
+static void hash_blocks_4(const uint8_t *inputs, uint32_t block_len, uint8_t *out)
+{
+    HASH_BLOCKS_N(4, __m128i, _mm_set1_epi32, SSE_LOAD, SSE_STORE,
+                  _mm_add_epi32, _mm_xor_si128, SSE_ROTR16, SSE_ROTR12, SSE_ROTR8, SSE_ROTR7)
+}
+
+#define AVX2_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define AVX2_STORE(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+#define AVX2_ROTR(v, n) _mm256_or_si256(_mm256_srli_epi32(v, n), _mm256_slli_epi32(v, 32 - (n)))
+#define AVX2_ROTR16(v) _mm256_shuffle_epi8(v, rot16)
+#define AVX2_ROTR12(v) AVX2_ROTR(v, 12)
+#define AVX2_ROTR8(v) _mm256_shuffle_epi8(v, rot8)
+#define AVX2_ROTR7(v) AVX2_ROTR(v, 7)
+
+__attribute__((target("avx2")))
+static void hash_blocks_8(const uint8_t *inputs, uint32_t block_len, uint8_t *out)
+{
+    const __m256i rot16 = _mm256_set_epi8(
+        13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+        13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+    const __m256i rot8 = _mm256_set_epi8(
+        12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1,
+        12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1);
+
+    HASH_BLOCKS_N(8, __m256i, _mm256_set1_epi32, AVX2_LOAD, AVX2_STORE,
+                  _mm256_add_epi32, _mm256_xor_si256, AVX2_ROTR16, AVX2_ROTR12, AVX2_ROTR8, AVX2_ROTR7)
+}
+
+#define AVX512_LOAD(p) _mm512_loadu_si512(p)
+#define AVX512_STORE(p, v) _mm512_storeu_si512(p, v)
+#define AVX512_ROTR16(v) _mm512_ror_epi32(v, 16)
+#define AVX512_ROTR12(v) _mm512_ror_epi32(v, 12)
+#define AVX512_ROTR8(v) _mm512_ror_epi32(v, 8)
+#define AVX512_ROTR7(v) _mm512_ror_epi32(v, 7)
+
+__attribute__((target("avx512f")))
+static void hash_blocks_16(const uint8_t *inputs, uint32_t block_len, uint8_t *out)
+{
+    HASH_BLOCKS_N(16, __m512i, _mm512_set1_epi32, AVX512_LOAD, AVX512_STORE,
+                  _mm512_add_epi32, _mm512_xor_si512, AVX512_ROTR16, AVX512_ROTR12, AVX512_ROTR8, AVX512_ROTR7)
+}
+
+static int simd_width(void)
+{
+    static int width = 0;
+    if (!width) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            width = 16;
+        } else if (__builtin_cpu_supports("avx2")) {
+            width = 8;
+        } else {
+            width = 4;
+        }
+    }
+    return width;
+}
+
+#endif /* BLAKE3_BATCH_SIMD */
+
+void blake3_hash_single_blocks(const uint8_t *inputs, size_t num_inputs, uint32_t block_len, uint8_t *out)
+{
+#ifdef BLAKE3_BATCH_SIMD
+    const int width = simd_width();
+
+    if (width >= 16) {
+        for (; num_inputs >= 16; num_inputs -= 16) {
+            hash_blocks_16(inputs, block_len, out);
+            inputs += 16 * 64;
+            out += 16 * 32;
+        }
+    }
+    if (width >= 8) {
+        for (; num_inputs >= 8; num_inputs -= 8) {
+            hash_blocks_8(inputs, block_len, out);
+            inputs += 8 * 64;
+            out += 8 * 32;
+        }
+    }
+    for (; num_inputs >= 4; num_inputs -= 4) {
+        hash_blocks_4(inputs, block_len, out);
+        inputs += 4 * 64;
+        out += 4 * 32;
+    }
+#endif
+    for (; num_inputs > 0; --num_inputs) {
+        hash_block_1(inputs, block_len, out);
+        inputs += 64;
+        out += 32;
+    }
+}
@@ -1,5 +1,10 @@
 #include "chacha8.h"
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CHACHA8_SIMD
+#include <immintrin.h>
+#endif
+
 #define U32TO32_LITTLE(v) (v)
 #define U8TO32_LITTLE(p) (*(const uint32_t *)(p))
 #define U32TO8_LITTLE(p, v) (((uint32_t *)(p))[0] = U32TO32_LITTLE(v))
@@ -54,7 +59,7 @@ void chacha8_keysetup(struct chacha8_ctx *x, const uint8_t *k, uint32_t kbits, c
     }
 }
 
-void chacha8_get_keystream(const struct chacha8_ctx *x, uint64_t pos, uint32_t n_blocks, uint8_t *c)
+static void chacha8_get_keystream_1(const struct chacha8_ctx *x, uint64_t pos, uint32_t n_blocks, uint8_t *c)
 {
     uint32_t x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
     uint32_t j0, j1, j2, j3, j4, j5, j6, j7, j8, j9, j10, j11, j12, j13, j14, j15;
@@ -147,3 +152,214 @@ void chacha8_get_keystream(const struct chacha8_ctx *x, uint64_t pos, uint32_t n
         c += 64;
     }
 }
+
+#ifdef CHACHA8_SIMD
+
+/*
+ * Multi-block kernels: lane i of every state vector holds block (pos + i).
+ * Results are transposed back to the scalar byte layout, so the output is
+ * identical to chacha8_get_keystream_1().
+ */
+
+#define VQUARTERROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, a, b, c, d) \
+    a = ADD(a, b);                                                   \
+    d = ROT16(XOR(d, a));                                            \
+    c = ADD(c, d);                                                   \
+    b = ROT12(XOR(b, c));                                            \
+    a = ADD(a, b);                                                   \
+    d = ROT8(XOR(d, a));                                             \
+    c = ADD(c, d);                                                   \
+    b = ROT7(XOR(b, c))
+
+#define VDOUBLEROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v)                        \
+    VQUARTERROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v[0], v[4], v[8], v[12]);  \
+    VQUARTERROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v[1], v[5], v[9], v[13]);  \
+    VQUARTERROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v[2], v[6], v[10], v[14]); \
+    VQUARTERROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v[3], v[7], v[11], v[15]); \
+    VQUARTERROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v[0], v[5], v[10], v[15]); \
+    VQUARTERROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v[1], v[6], v[11], v[12]); \
+    VQUARTERROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v[2], v[7], v[8], v[13]);  \
+    VQUARTERROUND(ADD, XOR, ROT16, ROT12, ROT8, ROT7, v[3], v[4], v[9], v[14])
+
+/* 4x4 transpose of 32-bit words within each 128-bit lane */
+#define VTRANSPOSE4(UNPACKLO32, UNPACKHI32, UNPACKLO64, UNPACKHI64, a0, a1, a2, a3) \
+    do {                                                                           \
+        t0 = UNPACKLO32(a0, a1);                                                   \
+        t1 = UNPACKLO32(a2, a3);                                                   \
+        t2 = UNPACKHI32(a0, a1);                                                   \
+        t3 = UNPACKHI32(a2, a3);                                                   \
+        a0 = UNPACKLO64(t0, t1);                                                   \
+        a1 = UNPACKHI64(t0, t1);                                                   \
+        a2 = UNPACKLO64(t2, t3);                                                   \
+        a3 = UNPACKHI64(t2, t3);                                                   \
+    } while (0)
+
+#define SSE_ROTL(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define SSE_ROT16(v) SSE_ROTL(v, 16)
+#define SSE_ROT12(v) SSE_ROTL(v, 12)
+#define SSE_ROT8(v) SSE_ROTL(v, 8)
+#define SSE_ROT7(v) SSE_ROTL(v, 7)
+
+__attribute__((target("sse2")))
+static void chacha8_blocks_4(const struct chacha8_ctx *x, uint64_t pos, uint8_t *c)
+{
+    __m128i j[16], v[16], t0, t1, t2, t3;
+    int i;
+
+    for (i = 0; i < 16; ++i) {
+        j[i] = _mm_set1_epi32(x->input[i]);
+    }
+    j[12] = _mm_set_epi32(pos + 3, pos + 2, pos + 1, pos);
+    j[13] = _mm_set_epi32((pos + 3) >> 32, (pos + 2) >> 32, (pos + 1) >> 32, pos >> 32);
+
+    for (i = 0; i < 16; ++i) {
+        v[i] = j[i];
+    }
+    for (i = 8; i > 0; i -= 2) {
+        VDOUBLEROUND(_mm_add_epi32, _mm_xor_si128, SSE_ROT16, SSE_ROT12, SSE_ROT8, SSE_ROT7, v);
+    }
+    for (i = 0; i < 16; ++i) {
+        v[i] = _mm_add_epi32(v[i], j[i]);
+    }
+    for (i = 0; i < 16; i += 4) {
+        VTRANSPOSE4(_mm_unpacklo_epi32, _mm_unpackhi_epi32, _mm_unpacklo_epi64, _mm_unpackhi_epi64,
+                    v[i], v[i + 1], v[i + 2], v[i + 3]);
+        _mm_storeu_si128((__m128i *)(c + 0 * 64 + i * 4), v[i]);
+        _mm_storeu_si128((__m128i *)(c + 1 * 64 + i * 4), v[i + 1]);
+        _mm_storeu_si128((__m128i *)(c + 2 * 64 + i * 4), v[i + 2]);
+        _mm_storeu_si128((__m128i *)(c + 3 * 64 + i * 4), v[i + 3]);
+    }
+}
+
+#define AVX2_ROTL(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+#define AVX2_ROT16(v) _mm256_shuffle_epi8(v, rot16)
+#define AVX2_ROT12(v) AVX2_ROTL(v, 12)
+#define AVX2_ROT8(v) _mm256_shuffle_epi8(v, rot8)
+#define AVX2_ROT7(v) AVX2_ROTL(v, 7)
+
+__attribute__((target("avx2")))
+static void chacha8_blocks_8(const struct chacha8_ctx *x, uint64_t pos, uint8_t *c)
+{
+    const __m256i rot16 = _mm256_set_epi8(
+        13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+        13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+    const __m256i rot8 = _mm256_set_epi8(
+        14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+        14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+    __m256i j[16], v[16], t0, t1, t2, t3;
+    int i, k;
+
+    for (i = 0; i < 16; ++i) {
+        j[i] = _mm256_set1_epi32(x->input[i]);
+    }
+    j[12] = _mm256_set_epi32(
+        pos + 7, pos + 6, pos + 5, pos + 4, pos + 3, pos + 2, pos + 1, pos);
+    j[13] = _mm256_set_epi32(
+        (pos + 7) >> 32, (pos + 6) >> 32, (pos + 5) >> 32, (pos + 4) >> 32,
+        (pos + 3) >> 32, (pos + 2) >> 32, (pos + 1) >> 32, pos >> 32);
+
+    for (i = 0; i < 16; ++i) {
+        v[i] = j[i];
+    }
+    for (i = 8; i > 0; i -= 2) {
+        VDOUBLEROUND(_mm256_add_epi32, _mm256_xor_si256, AVX2_ROT16, AVX2_ROT12, AVX2_ROT8, AVX2_ROT7, v);
+    }
+    for (i = 0; i < 16; ++i) {
+        v[i] = _mm256_add_epi32(v[i], j[i]);
+    }
+    for (i = 0; i < 16; i += 4) {
+        VTRANSPOSE4(_mm256_unpacklo_epi32, _mm256_unpackhi_epi32, _mm256_unpacklo_epi64, _mm256_unpackhi_epi64,
+                    v[i], v[i + 1], v[i + 2], v[i + 3]);
+        for (k = 0; k < 4; ++k) {
+            _mm_storeu_si128((__m128i *)(c + k * 64 + i * 4), _mm256_castsi256_si128(v[i + k]));
+            _mm_storeu_si128((__m128i *)(c + (k + 4) * 64 + i * 4), _mm256_extracti128_si256(v[i + k], 1));
+        }
+    }
+}
+
+#define AVX512_ROT16(v) _mm512_rol_epi32(v, 16)
+#define AVX512_ROT12(v) _mm512_rol_epi32(v, 12)
+#define AVX512_ROT8(v) _mm512_rol_epi32(v, 8)
+#define AVX512_ROT7(v) _mm512_rol_epi32(v, 7)
+
+__attribute__((target("avx512f")))
+static void chacha8_blocks_16(const struct chacha8_ctx *x, uint64_t pos, uint8_t *c)
+{
+    __m512i j[16], v[16], t0, t1, t2, t3;
+    uint32_t ctr_lo[16], ctr_hi[16];
+    int i, k;
+
+    for (i = 0; i < 16; ++i) {
+        j[i] = _mm512_set1_epi32(x->input[i]);
+        ctr_lo[i] = pos + i;
+        ctr_hi[i] = (pos + i) >> 32;
+    }
+    j[12] = _mm512_loadu_si512(ctr_lo);
+    j[13] = _mm512_loadu_si512(ctr_hi);
+
+    for (i = 0; i < 16; ++i) {
+        v[i] = j[i];
+    }
+    for (i = 8; i > 0; i -= 2) {
+        VDOUBLEROUND(_mm512_add_epi32, _mm512_xor_si512, AVX512_ROT16, AVX512_ROT12, AVX512_ROT8, AVX512_ROT7, v);
+    }
+    for (i = 0; i < 16; ++i) {
+        v[i] = _mm512_add_epi32(v[i], j[i]);
+    }
+    for (i = 0; i < 16; i += 4) {
+        VTRANSPOSE4(_mm512_unpacklo_epi32, _mm512_unpackhi_epi32, _mm512_unpacklo_epi64, _mm512_unpackhi_epi64,
+                    v[i], v[i + 1], v[i + 2], v[i + 3]);
+        for (k = 0; k < 4; ++k) {
+            _mm_storeu_si128((__m128i *)(c + k * 64 + i * 4), _mm512_extracti32x4_epi32(v[i + k], 0));
+            _mm_storeu_si128((__m128i *)(c + (k + 4) * 64 + i * 4), _mm512_extracti32x4_epi32(v[i + k], 1));
+            _mm_storeu_si128((__m128i *)(c + (k + 8) * 64 + i * 4), _mm512_extracti32x4_epi32(v[i + k], 2));
+            _mm_storeu_si128((__m128i *)(c + (k + 12) * 64 + i * 4), _mm512_extracti32x4_epi32(v[i + k], 3));
+        }
+    }
+}
+
+static int chacha8_simd_width(void)
+{
+    static int width = 0;
+    if (!width) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            width = 16;
+        } else if (__builtin_cpu_supports("avx2")) {
+            width = 8;
+        } else {
+            width = 4;
+        }
+    }
+    return width;
+}
+
+#endif /* CHACHA8_SIMD */
+
+void chacha8_get_keystream(const struct chacha8_ctx *x, uint64_t pos, uint32_t n_blocks, uint8_t *c)
+{
+#ifdef CHACHA8_SIMD
+    const int width = chacha8_simd_width();
+
+    if (width >= 16) {
+        for (; n_blocks >= 16; n_blocks -= 16) {
+            chacha8_blocks_16(x, pos, c);
+            pos += 16;
+            c += 16 * 64;
+        }
+    }
+    if (width >= 8) {
+        for (; n_blocks >= 8; n_blocks -= 8) {
+            chacha8_blocks_8(x, pos, c);
+            pos += 8;
+            c += 8 * 64;
+        }
+    }
+    for (; n_blocks >= 4; n_blocks -= 4) {
+        chacha8_blocks_4(x, pos, c);
+        pos += 4;
+        c += 4 * 64;
+    }
+#endif
+    chacha8_get_keystream_1(x, pos, n_blocks, c);
+}
@@ -11,16 +11,22 @@
 #include <chia/phase4.hpp>
 #include <chia/util.hpp>
 #include <chia/copy.h>
+#include <chia/checkpoint.h>
+#include <chia/Scheduler.h>
 
 #include <bls.hpp>
 #include <sodium.h>
 #include <cxxopts.hpp>
 
 #include <string>
+#include <atomic>
 #include <csignal>
+#include <sys/stat.h>
 
 #ifndef _WIN32
 #include <sys/resource.h>
+#else
+#include <direct.h>
 #endif
 
 #ifdef __linux__ 
@@ -54,23 +60,132 @@ static void interrupt_handler(int sig)
     }
 }
 
+static void make_dir(const std::string& path)
+{
+#ifdef _WIN32
+	_mkdir(path.c_str());
+#else
+	mkdir(path.c_str(), 0755);
+#endif
+}
+
+/*
+ * Rough k32 estimates of one plot in phase 1 + 2 (stage = 1) or phase 3 + 4 (stage = 3), for --parallel.
+ */
+static budget_t estimate_budget(const int stage, const int num_threads, const bool tmp_in_ram)
+{
+	budget_t out;
+	out.threads = num_threads;
+	if(stage == 1) {
+		out.memory = (uint64_t(3) << 29) + num_threads * (uint64_t(1) << 28);		// 1.5 GiB + 256 MiB per thread
+		out.tmp_space = uint64_t(256) << 30;
+	} else {
+		out.memory = (uint64_t(1) << 30) + num_threads * (uint64_t(1) << 27);		// 1 GiB + 128 MiB per thread
+		out.tmp_space = uint64_t(192) << 30;
+	}
+	if(tmp_in_ram) {
+		out.memory += out.tmp_space;
+		out.tmp_space = 0;
+	}
+	return out;
+}
+
+/*
+ * Parses a list of "<dir>[@<weight>]", measures the write speed when no weight is given.
+ */
+static std::shared_ptr<Storage> create_striped_storage(
+		const std::string& tmp_dir, const std::vector<std::string>& list, const std::string& type)
+{
+	std::vector<StripedStorage::member_t> members;
+	for(const auto& entry : list) {
+		StripedStorage::member_t member;
+		const auto pos = entry.find_last_of('@');
+		member.dir = entry.substr(0, pos);
+		if(member.dir.empty() || member.dir.find_last_of("/\\") != member.dir.size() - 1) {
+			throw std::invalid_argument("invalid stripe directory: " + member.dir + " (needs trailing '/' or '\\')");
+		}
+		if(pos != std::string::npos) {
+			member.weight = std::atof(entry.c_str() + pos + 1);
+		} else {
+			member.weight = measure_write_speed(member.dir);
+		}
+		if(!(member.weight > 0)) {
+			throw std::invalid_argument("invalid stripe weight: " + entry);
+		}
+		member.storage = create_storage(type);
+		std::cout << "Stripe for " << tmp_dir << ": " << member.dir << " (weight " << member.weight << ")" << std::endl;
+		members.push_back(member);
+	}
+	return std::make_shared<StripedStorage>(tmp_dir, members);
+}
+
+/*
+ * Runs all phases, skipping the tables which are done according to checkpoint (optional).
+ * Phase 3 and 4 use num_threads_3, before_phase_3 (optional) is called when switching.
+ */
 inline
-phase4::output_t create_plot(	const int num_threads,
+phase4::output_t compute_plot(	const phase1::input_t& params,
+								const int num_threads,
 								const int log_num_buckets,
 								const int log_num_buckets_3,
-								const vector<uint8_t>& pool_key_bytes,
-								const vector<uint8_t>& farmer_key_bytes,
 								const std::string& tmp_dir,
-								const std::string& tmp_dir_2)
+								const std::string& tmp_dir_2,
+								checkpoint_t* checkpoint,
+								const int num_threads_3,
+								const std::function<void()>& before_phase_3)
 {
 	const auto total_begin = get_wall_time_micros();
+	const auto& plot_name = params.plot_name;
+	
+	phase1::output_t out_1;
+	phase1::compute(params, out_1, num_threads, log_num_buckets, plot_name, tmp_dir, tmp_dir_2, checkpoint);
+	
+	phase2::output_t out_2;
+	phase2::compute(out_1, out_2, num_threads, log_num_buckets_3, plot_name, tmp_dir, tmp_dir_2, checkpoint);
+	
+	if(before_phase_3) {
+		before_phase_3();
+	}
+	
+	phase3::output_t out_3;
+	phase3::compute(out_2, out_3, num_threads_3, log_num_buckets_3, plot_name, tmp_dir, tmp_dir_2, checkpoint);
+	
+	phase4::output_t out_4;
+	phase4::compute(out_3, out_4, num_threads_3, log_num_buckets_3, plot_name, tmp_dir, tmp_dir_2, checkpoint);
+	
+	const auto time_secs = (get_wall_time_micros() - total_begin) / 1e6;
+	std::cout << "Total plot creation time was "
+			<< time_secs << " sec (" << time_secs / 60. << " min)" << std::endl;
+	return out_4;
+}
 
+inline
+void print_settings(const int num_threads, const int log_num_buckets, const int log_num_buckets_3)
+{
 	std::cout << "Process ID: " << GETPID() << std::endl;
 	std::cout << "Number of Threads: " << num_threads << std::endl;
 	std::cout << "Number of Buckets P1:    2^" << log_num_buckets
 			<< " (" << (1 << log_num_buckets) << ")" << std::endl;
 	std::cout << "Number of Buckets P3+P4: 2^" << log_num_buckets_3
 			<< " (" << (1 << log_num_buckets_3) << ")" << std::endl;
+	if(Numa::num_nodes() > 1) {
+		std::cout << "NUMA Nodes: " << Numa::num_nodes() << std::endl;
+	}
+}
+
+inline
+phase4::output_t create_plot(	const int num_threads,
+								const int log_num_buckets,
+								const int log_num_buckets_3,
+								const vector<uint8_t>& pool_key_bytes,
+								const vector<uint8_t>& farmer_key_bytes,
+								const std::string& tmp_dir,
+								const std::string& tmp_dir_2,
+								const bool with_checkpoint,
+								const int num_threads_3,
+								const std::function<void()>& before_phase_3)
+{
+	print_settings(num_threads, log_num_buckets, log_num_buckets_3);
 	
 	bls::G1Element pool_key;
 	bls::G1Element farmer_key;
@@ -127,22 +242,43 @@ phase4::output_t create_plot(	const int num_threads,
 	}
 	params.plot_name = plot_name;
 	
-	phase1::output_t out_1;
-	phase1::compute(params, out_1, num_threads, log_num_buckets, plot_name, tmp_dir, tmp_dir_2);
+	if(!with_checkpoint) {
+		return compute_plot(params, num_threads, log_num_buckets, log_num_buckets_3, tmp_dir, tmp_dir_2, nullptr,
+							num_threads_3, before_phase_3);
+	}
+	checkpoint_t checkpoint;
+	checkpoint.file_name = tmp_dir + plot_name + ".manifest";
+	checkpoint.log_num_buckets = log_num_buckets;
+	checkpoint.log_num_buckets_3 = log_num_buckets_3;
+	checkpoint.tmp_dir = tmp_dir;
+	checkpoint.tmp_dir_2 = tmp_dir_2;
+	checkpoint.params = params;
 	
-	phase2::output_t out_2;
-	phase2::compute(out_1, out_2, num_threads, log_num_buckets_3, plot_name, tmp_dir, tmp_dir_2);
+	std::cout << "Checkpoint: " << checkpoint.file_name << std::endl;
 	
-	phase3::output_t out_3;
-	phase3::compute(out_2, out_3, num_threads, log_num_buckets_3, plot_name, tmp_dir, tmp_dir_2);
+	return compute_plot(params, num_threads, log_num_buckets, log_num_buckets_3, tmp_dir, tmp_dir_2, &checkpoint,
+						num_threads_3, before_phase_3);
+}
+
+/*
+ * Continues a plot from its last checkpoint, see --checkpoint.
+ */
+inline
+phase4::output_t resume_plot(	const int num_threads,
+								checkpoint_t& checkpoint,
+								const int num_threads_3,
+								const std::function<void()>& before_phase_3)
+{
+	print_settings(num_threads, checkpoint.log_num_buckets, checkpoint.log_num_buckets_3);
 	
-	phase4::output_t out_4;
-	phase4::compute(out_3, out_4, num_threads, log_num_buckets_3, plot_name, tmp_dir, tmp_dir_2);
+	std::cout << "Working Directory:   " << (checkpoint.tmp_dir.empty() ? "$PWD" : checkpoint.tmp_dir) << std::endl;
+	std::cout << "Working Directory 2: " << (checkpoint.tmp_dir_2.empty() ? "$PWD" : checkpoint.tmp_dir_2) << std::endl;
+	std::cout << "Plot Name: " << checkpoint.params.plot_name << std::endl;
+	std::cout << "Resuming from " << checkpoint.file_name << " after phase "
+			<< checkpoint.phase << " table " << checkpoint.table << std::endl;
 	
-	const auto time_secs = (get_wall_time_micros() - total_begin) / 1e6;
-	std::cout << "Total plot creation time was "
-			<< time_secs << " sec (" << time_secs / 60. << " min)" << std::endl;
-	return out_4;
+	return compute_plot(checkpoint.params, num_threads, checkpoint.log_num_buckets, checkpoint.log_num_buckets_3,
+						checkpoint.tmp_dir, checkpoint.tmp_dir_2, &checkpoint, num_threads_3, before_phase_3);
 }
 
 
@@ -173,6 +309,19 @@ int main(int argc, char** argv)
 	int num_buckets = 256;
 	int num_buckets_3 = 0;
 	bool tmptoggle = false;
+	bool ram_mode = false;
+	bool with_checkpoint = false;
+	int num_parallel = 1;
+	int max_threads = 0;
+	double max_memory = 0;
+	double max_tmp = 0;
+	std::string resume_file;
+	std::vector<std::string> stripe;
+	std::vector<std::string> stripe2;
+	std::vector<std::string> queue_depth;
+	std::string trace_prefix;
+	std::string storage;
+	std::string storage2;
 	
 	options.allow_unrecognised_options().add_options()(
 		"n, count", "Number of plots to create (default = 1, -1 = infinite)", cxxopts::value<int>(num_plots))(
@@ -185,6 +334,28 @@ int main(int argc, char** argv)
 		"p, poolkey", "Pool Public Key (48 bytes)", cxxopts::value<std::string>(pool_key_str))(
 		"f, farmerkey", "Farmer Public Key (48 bytes)", cxxopts::value<std::string>(farmer_key_str))(
 		"G, tmptoggle", "Alternate tmpdir/tmpdir2", cxxopts::value<bool>(tmptoggle))(
+		"storage", "Storage backend for <tmpdir>: uring, pread, stdio, direct, ram (default = uring)", cxxopts::value<std::string>(storage))(
+		"storage2", "Storage backend for <tmpdir2> (default = <storage>)", cxxopts::value<std::string>(storage2))(
+		"stripe", "Spread <tmpdir> data across directories: <dir>[@<weight>],... (default weight = measured MB/s)",
+				cxxopts::value<std::vector<std::string>>(stripe))(
+		"stripe2", "Spread <tmpdir2> data across directories, see --stripe", cxxopts::value<std::vector<std::string>>(stripe2))(
+		"ram", "Keep all temporary data in memory, same as --storage ram --storage2 ram (needs ~256 GiB RAM)", cxxopts::value<bool>(ram_mode))(
+		"checkpoint", "Save a manifest after each table, to continue via --resume after a crash (needs more tmp space)",
+				cxxopts::value<bool>(with_checkpoint))(
+		"resume", "Continue a plot from its manifest, <tmpdir>/<plot name>.manifest", cxxopts::value<std::string>(resume_file))(
+		"parallel", "Number of plots in flight, phase 1 of the next plot starts while the previous is in phase 3 (default = 1)",
+				cxxopts::value<int>(num_parallel))(
+		"max-threads", "Thread budget of all plots (default = threads + (parallel - 1) * threads / 2)", cxxopts::value<int>(max_threads))(
+		"max-memory", "Memory budget of all plots in GiB (default = unlimited)", cxxopts::value<double>(max_memory))(
+		"max-tmp", "Tmp space budget of all plots in GiB (default = unlimited)", cxxopts::value<double>(max_tmp))(
+		"iodepth", "Number of I/O requests in flight per reader / writer (default = 8, 1 = no io_uring)", cxxopts::value<int>(g_io_queue_depth))(
+		"telemetry", "Print busy / idle / blocked time per pipeline stage after each table, "
+				"and save it to <tmpdir>/<plot name>.p<N>.telemetry.json (not with --parallel)", cxxopts::value<bool>(g_telemetry))(
+		"trace", "Save a timeline of all pipeline jobs in Chrome trace format to <prefix>.<N>.json after plot N, "
+				"for chrome://tracing or ui.perfetto.dev", cxxopts::value<std::string>(trace_prefix))(
+		"numa", "Bind threads to NUMA nodes and split bucket reads between nodes", cxxopts::value<bool>(g_numa))(
+		"queue-depth", "Number of inputs queued per pipeline stage: [<stage>=]<depth>,... (default = 1, phase1/slice, phase3/slice and phase4/read = 4)",
+				cxxopts::value<std::vector<std::string>>(queue_depth))(
 		"help", "Print help");
 	
 	if(argc <= 1) {
@@ -197,6 +368,25 @@ int main(int argc, char** argv)
 		std::cout << options.help({""}) << std::endl;
 		return 0;
 	}
+	checkpoint_t resume;
+	if(!resume_file.empty()) {
+		try {
+			resume.load(resume_file);
+		} catch(const std::exception& ex) {
+			std::cout << "Failed to load manifest: " << ex.what() << std::endl;
+			return -2;
+		}
+		tmp_dir = resume.tmp_dir;
+		tmp_dir2 = resume.tmp_dir_2;
+		num_buckets = 1 << resume.log_num_buckets;
+		num_buckets_3 = 1 << resume.log_num_buckets_3;
+		
+		// memo = bytes(pool_public_key) + bytes(farmer_public_key) + bytes(local_master_sk)
+		if(pool_key_str.empty() && farmer_key_str.empty() && resume.params.memo.size() >= 2 * bls::G1Element::SIZE) {
+			pool_key_str = bls::Util::HexStr(resume.params.memo.data(), bls::G1Element::SIZE);
+			farmer_key_str = bls::Util::HexStr(resume.params.memo.data() + bls::G1Element::SIZE, bls::G1Element::SIZE);
+		}
+	}
 	if(pool_key_str.empty()) {
 		std::cout << "Pool Public Key (48 bytes) needs to be specified via -p <hex>, see `chia keys show`." << std::endl;
 		return -2;
@@ -249,6 +439,66 @@ int main(int argc, char** argv)
 		std::cout << "Invalid threads parameter: " << num_threads << " (supported: [1..1024])" << std::endl;
 		return -2;
 	}
+	if(num_parallel < 1 || num_parallel > 64) {
+		std::cout << "Invalid parallel parameter: " << num_parallel << " (supported: [1..64])" << std::endl;
+		return -2;
+	}
+	if(g_telemetry && num_parallel > 1) {
+		std::cout << "Telemetry is not supported with parallel plots, the counters are shared by all plots" << std::endl;
+		return -2;
+	}
+	if(g_io_queue_depth < 1 || g_io_queue_depth > 4096) {
+		std::cout << "Invalid iodepth parameter: " << g_io_queue_depth << " (supported: [1..4096])" << std::endl;
+		return -2;
+	}
+	if(ram_mode) {
+		storage = "ram";
+		storage2 = "ram";
+	}
+	if(with_checkpoint && (storage == "ram" || storage2 == "ram")) {
+		std::cout << "Checkpoints are not supported with RAM storage" << std::endl;
+		return -2;
+	}
+	if(!resume_file.empty() && (storage == "ram" || storage2 == "ram")) {
+		std::cout << "Resume is not supported with RAM storage, the files of the manifest are on disk" << std::endl;
+		return -2;
+	}
+	if(storage.empty()) {
+		storage = "uring";
+	}
+	if(tmp_dir2 == tmp_dir && ((!storage2.empty() && storage2 != storage) || !stripe2.empty())) {
+		std::cout << "--storage2 / --stripe2 need a separate tmpdir2, otherwise both use the storage of tmpdir" << std::endl;
+		return -2;
+	}
+	if(storage2.empty()) {
+		storage2 = storage;
+	}
+	try {
+		set_storage(tmp_dir2, stripe2.empty() ? create_storage(storage2) : create_striped_storage(tmp_dir2, stripe2, storage2));
+		set_storage(tmp_dir, stripe.empty() ? create_storage(storage) : create_striped_storage(tmp_dir, stripe, storage));
+	} catch(const std::exception& ex) {
+		std::cout << ex.what() << " (supported storage: uring, pread, stdio, direct, ram)" << std::endl;
+		return -2;
+	}
+	for(const auto& entry : queue_depth) {
+		const auto pos = entry.find('=');
+		const auto stage = pos != std::string::npos ? entry.substr(0, pos) : std::string();
+		const int depth = std::atoi(entry.c_str() + (pos != std::string::npos ? pos + 1 : 0));
+		if(depth < 1 || depth > 1024) {
+			std::cout << "Invalid queue-depth parameter: " << entry << " (supported: [1..1024])" << std::endl;
+			return -2;
+		}
+		if(stage.empty()) {
+			g_queue_depth = depth;
+		} else {
+			set_queue_depth(stage, depth);
+		}
+	}
+	g_trace = !trace_prefix.empty();
+	
+	if(g_numa && Numa::num_nodes() < 2) {
+		std::cout << "Only one NUMA node found, --numa has no effect" << std::endl;
+	}
 	if(log_num_buckets < 4 || log_num_buckets > 16) {
 		std::cout << "Invalid buckets parameter: 2^" << log_num_buckets << " (supported: 2^[4..16])" << std::endl;
 		return -2;
@@ -327,6 +577,8 @@ int main(int argc, char** argv)
 	#endif	
 	std::cout << std::endl;
 	std::cout << "Final Directory: " << final_dir << std::endl;
+	std::cout << "Storage: " << get_storage(tmp_dir)->name() << " (tmpdir), "
+			<< get_storage(tmp_dir2)->name() << " (tmpdir2)" << std::endl;
 	if(num_plots >= 0) {
 		std::cout << "Number of Plots: " << num_plots << std::endl;
 	} else {
@@ -351,30 +603,135 @@ int main(int argc, char** argv)
 			}
 		}, "final/copy");
 	
+	// phase 3 + 4 are mostly disk bound, so they share the cores with phase 1 of the next plot
+	const int num_threads_3 = num_parallel > 1 ? std::max(num_threads / 2, 1) : num_threads;
+	const bool tmp_in_ram = storage == "ram" && storage2 == "ram";
+	const auto budget_1 = estimate_budget(1, num_threads, tmp_in_ram);
+	const auto budget_3 = estimate_budget(3, num_threads_3, tmp_in_ram);
+	
+	budget_t limit;
+	limit.threads = max_threads > 0 ? max_threads : num_threads + (num_parallel - 1) * num_threads_3;
+	limit.memory = max_memory * pow(1024, 3);
+	limit.tmp_space = max_tmp * pow(1024, 3);
+	
+	Scheduler scheduler(limit);
+	try {
+		scheduler.check(budget_1);
+		scheduler.check(budget_3);
+	} catch(const std::exception& ex) {
+		std::cout << "Invalid budget: " << ex.what() << std::endl;
+		return -2;
+	}
+	
+	if(num_parallel > 1) {
+		std::cout << "Parallel Plots: " << num_parallel << ", Thread Budget: " << limit.threads
+				<< ", Memory Budget: " << (limit.memory ? std::to_string(limit.memory >> 30) + " GiB" : "unlimited")
+				<< ", Tmp Budget: " << (limit.tmp_space ? std::to_string(limit.tmp_space >> 30) + " GiB" : "unlimited") << std::endl;
+		
+		// separate subtree per slot, including the stripe directories
+		std::vector<std::string> dirs = {tmp_dir, tmp_dir2};
+		for(const auto& entry : stripe) {
+			dirs.push_back(entry.substr(0, entry.find_last_of('@')));
+		}
+		for(const auto& entry : stripe2) {
+			dirs.push_back(entry.substr(0, entry.find_last_of('@')));
+		}
+		for(int slot = 0; slot < num_parallel; ++slot) {
+			for(const auto& dir : dirs) {
+				make_dir(dir + "plot_" + std::to_string(slot));
+			}
+		}
+	}
+	
+	std::mutex slot_mutex;
+	std::condition_variable slot_signal;
+	std::vector<bool> slot_busy(num_parallel);
+	std::vector<std::thread> slot_thread(num_parallel);
+	std::atomic_bool is_fail {false};
+	
 	for(int i = 0; i < num_plots || num_plots < 0; ++i)
 	{
+		int slot = 0;
+		{
+			std::unique_lock<std::mutex> lock(slot_mutex);
+			while(true) {
+				slot = std::find(slot_busy.begin(), slot_busy.end(), false) - slot_busy.begin();
+				if(slot < num_parallel) {
+					break;
+				}
+				slot_signal.wait(lock);
+			}
+			slot_busy[slot] = true;
+		}
+		if(slot_thread[slot].joinable()) {
+			slot_thread[slot].join();
+		}
+		if(is_fail) {
+			break;
+		}
 		if (gracefully_exit) {
 			std::cout << std::endl << "Process has been interrupted, waiting for copy/rename operations to finish ..." << std::endl;
 			break;
 		}
+		const std::string sub_dir = num_parallel > 1 ? "plot_" + std::to_string(slot) + "/" : "";
+		const std::string plot_tmp_dir = tmp_dir + sub_dir;
+		const std::string plot_tmp_dir2 = tmp_dir2 + sub_dir;
+		
+		scheduler.acquire(budget_1);
+		
 		std::cout << "Crafting plot " << i+1 << " out of " << num_plots << std::endl;
-		const auto out = create_plot(
-				num_threads, log_num_buckets, log_num_buckets_3,
-				pool_key, farmer_key, tmp_dir, tmp_dir2);
 		
-		if(final_dir != tmp_dir)
-		{
-			const auto dst_path = final_dir + out.params.plot_name + ".plot";
-			std::cout << "Started copy to " << dst_path << std::endl;
-			copy_thread.take_copy(std::make_pair(out.plot_file_name, dst_path));
-		}
+		slot_thread[slot] = std::thread([&, i, slot, plot_tmp_dir, plot_tmp_dir2]() {
+			Trace::set_thread_name("plot/" + std::to_string(slot));
+			budget_t budget = budget_1;
+			const auto next_stage = [&]() {
+				scheduler.exchange(budget, budget_3);
+				budget = budget_3;
+			};
+			try {
+				const auto out = (i == 0 && !resume_file.empty()) ?
+						resume_plot(num_threads, resume, num_threads_3, next_stage) :
+						create_plot(num_threads, log_num_buckets, log_num_buckets_3,
+									pool_key, farmer_key, plot_tmp_dir, plot_tmp_dir2, with_checkpoint,
+									num_threads_3, next_stage);
+				
+				const auto dst_path = final_dir + out.params.plot_name + ".plot";
+				if(out.plot_file_name != dst_path)
+				{
+					std::cout << "Started copy to " << dst_path << std::endl;
+					copy_thread.take_copy(std::make_pair(out.plot_file_name, dst_path));
+				}
+			} catch(const std::exception& ex) {
+				std::cout << "Plot " << i+1 << " failed with: " << ex.what() << std::endl;
+				is_fail = true;
+			}
+			if(g_trace) {
+				Trace::write(trace_prefix + "." + std::to_string(i + 1) + ".json");
+			}
+			scheduler.release(budget);
+			{
+				std::lock_guard<std::mutex> lock(slot_mutex);
+				slot_busy[slot] = false;
+			}
+			slot_signal.notify_all();
+		});
+		
 		if (tmptoggle) {
 			tmp_dir.swap(tmp_dir2);
 		}
 	}
+	for(auto& thread : slot_thread) {
+		if(thread.joinable()) {
+			thread.join();
+		}
+	}
 	copy_thread.close();
 	
-	return 0;
+	if(g_trace) {
+		Trace::write(trace_prefix + ".json");		// final copy
+		std::cout << "Saved trace to " << trace_prefix << ".*.json" << std::endl;
+	}
+	return is_fail ? -1 : 0;
 }
 
 
@@ -7,7 +7,34 @@
 
 #include <chia/settings.h>
 
+#include <map>
+
 
 size_t g_read_chunk_size = 65536;
 size_t g_write_chunk_size = 4096;
+int g_io_queue_depth = 8;
+int g_queue_depth = 1;
+bool g_numa = false;
+bool g_telemetry = false;
+bool g_trace = false;
+
+static std::map<std::string, int> g_stage_queue_depth = {
+	{"phase1/slice", 4},
+	{"phase3/slice", 4},
+	{"phase4/read", 4},
+};
+
+int get_queue_depth(const std::string& stage)
+{
+	const auto iter = g_stage_queue_depth.find(stage);
+	if(iter != g_stage_queue_depth.end()) {
+		return iter->second;
+	}
+	return g_queue_depth;
+}
+
+void set_queue_depth(const std::string& stage, int depth)
+{
+	g_stage_queue_depth[stage] = depth;
+}
 
@@ -0,0 +1,111 @@
+/*
+ * test_async_io.cpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <chia/AsyncIO.h>
+
+#include <cstdio>
+#include <random>
+#include <iostream>
+
+
+static void expect(const bool value, const std::string& what) {
+	if(!value) {
+		throw std::logic_error(what);
+	}
+}
+
+/*
+ * Writes and reads back data in random sized requests, which are contiguous in the file and
+ * partly in memory, with random plug() / unplug() and wait() in between, to exercise merging.
+ */
+void test_merge(AsyncIO& io, const std::string& file_name, const size_t size, const int num_rounds)
+{
+	std::mt19937_64 generator(size);
+	std::vector<uint8_t> data(size);
+	for(auto& value : data) {
+		value = generator();
+	}
+	const int fd = open_file(file_name, true);
+	
+	// separate buffers, so only some requests are contiguous in memory
+	std::vector<std::vector<uint8_t>> copies;
+	size_t offset = 0;
+	io.plug();
+	while(offset < size) {
+		const size_t length = std::min<size_t>(size - offset, 1 + generator() % 300000);
+		const uint8_t* src = data.data() + offset;
+		if(generator() % 2) {
+			copies.emplace_back(src, src + length);
+			src = copies.back().data();
+		}
+		io.write(fd, src, length, offset);
+		offset += length;
+		if(generator() % 7 == 0) {
+			io.unplug();
+			io.plug();
+		}
+	}
+	io.unplug();
+	io.wait_all();
+	
+	for(int round = 0; round < num_rounds; ++round)
+	{
+		std::vector<uint8_t> out(size);
+		std::vector<uint64_t> tickets;
+		offset = 0;
+		io.plug();
+		while(offset < size) {
+			const size_t length = std::min<size_t>(size - offset, 1 + generator() % 500000);
+			tickets.push_back(io.read(fd, out.data() + offset, length, offset));
+			offset += length;
+			if(generator() % 5 == 0) {
+				io.wait(tickets[generator() % tickets.size()]);
+			}
+			if(generator() % 11 == 0) {
+				io.unplug();
+				io.plug();
+			}
+		}
+		io.unplug();
+		io.wait_all();
+		expect(out == data, "round " + std::to_string(round) + ": mismatch");
+	}
+	
+	// merged with a request which ends past the end of file: fails that request only
+	std::vector<uint8_t> first(100);
+	std::vector<uint8_t> second(150);
+	bool is_thrown = false;
+	io.plug();
+	const auto ticket = io.read(fd, first.data(), first.size(), size - 200);
+	try {
+		// synchronous I/O throws here already
+		const auto ticket_2 = io.read(fd, second.data(), second.size(), size - 100);
+		io.unplug();
+		io.wait(ticket_2);
+	} catch(const std::runtime_error&) {
+		is_thrown = true;
+	}
+	io.unplug();
+	io.wait(ticket);
+	expect(is_thrown, "read past the end did not throw");
+	expect(std::equal(first.begin(), first.end(), data.end() - 200), "read before the end failed");
+	
+	close_file(fd);
+	std::remove(file_name.c_str());
+}
+
+
+int main(int argc, char** argv)
+{
+	const std::string file_name = "test_async_io.tmp";
+	
+	for(const int depth : {1, 2, 8, 64}) {
+		AsyncIO io(depth);
+		test_merge(io, file_name, 16 << 20, 10);
+		std::cout << "depth " << depth << (io.is_async() ? " (io_uring)" : " (sync)") << " OK" << std::endl;
+	}
+	return 0;
+}
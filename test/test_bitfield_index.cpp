@@ -0,0 +1,75 @@
+/*
+ * test_bitfield_index.cpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <chia/bitfield_index.hpp>
+
+#include <random>
+#include <iostream>
+
+
+/*
+ * Compares rank() with a running count of all positions, and lookup() with bitfield::count().
+ */
+void check(const bitfield& field, const bool use_simd, const std::string& title)
+{
+	const bitfield_index index(field, use_simd);
+	
+	uint64_t count = 0;
+	std::vector<int64_t> used;
+	for(int64_t pos = 0; pos < field.size(); ++pos) {
+		if(index.rank(pos) != count) {
+			throw std::logic_error(title + ": rank(" + std::to_string(pos) + ") = "
+					+ std::to_string(index.rank(pos)) + ", expected " + std::to_string(count));
+		}
+		if(field.get(pos)) {
+			used.push_back(pos);
+			count++;
+		}
+	}
+	std::mt19937_64 generator(used.size());
+	for(size_t i = 0; i < std::min<size_t>(used.size(), 2000); ++i) {
+		const size_t first = generator() % used.size();
+		size_t second = first;
+		while(second + 1 < used.size() && used[second + 1] - used[first] < 1024 && generator() % 4) {
+			second++;
+		}
+		const auto pos = used[first];
+		const auto next = used[second];
+		const auto res = index.lookup(pos, next - pos);
+		const auto pos_count = uint64_t(field.count(0, pos));
+		if(res.first != pos_count || res.second != field.count(0, next) - pos_count) {
+			throw std::logic_error(title + ": lookup(" + std::to_string(pos) + ", " + std::to_string(next - pos) + ") mismatch");
+		}
+	}
+}
+
+
+int main(int argc, char** argv)
+{
+	std::mt19937_64 generator(1337);
+	
+	if(!bitfield_index::has_simd()) {
+		std::cout << "AVX-512 not supported, testing the scalar build only" << std::endl;
+	}
+	// including sizes which are not a multiple of 512 bits, so the last block is partial
+	for(const int64_t size : {1, 63, 64, 448, 511, 512, 513, 1000, 4096 + 3 * 64, 100000, (1 << 20) + 320}) {
+		for(const int density : {0, 1, 50, 99, 100}) {
+			bitfield field(size);
+			for(int64_t i = 0; i < size; ++i) {
+				if(int(generator() % 100) < density) {
+					field.set(i);
+				}
+			}
+			const std::string title = std::to_string(size) + " bits, " + std::to_string(density) + " %";
+			check(field, false, title + ", scalar");
+			if(bitfield_index::has_simd()) {
+				check(field, true, title + ", AVX-512");
+			}
+		}
+	}
+	std::cout << "bitfield_index OK" << std::endl;
+	return 0;
+}
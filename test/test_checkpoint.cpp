@@ -0,0 +1,208 @@
+/*
+ * test_checkpoint.cpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <chia/phase2.hpp>
+#include <chia/DiskSort.hpp>
+
+#include <random>
+#include <iostream>
+
+
+/*
+ * Writes random phase 1 tables, each entry points to two entries of the previous table.
+ */
+phase1::output_t make_tables(const std::string& prefix, const size_t num_entries)
+{
+	std::mt19937_64 generator(1337);
+	phase1::output_t out;
+	out.params.plot_name = prefix;
+	{
+		DiskTable<phase1::tmp_entry_1> table(prefix + ".p1.table1.tmp");
+		for(size_t i = 0; i < num_entries; ++i) {
+			phase1::tmp_entry_1 entry;
+			entry.x = generator();
+			table.write(entry);
+		}
+		table.close();
+		out.table[0] = table.get_info();
+	}
+	for(int i = 1; i < 7; ++i) {
+		std::vector<phase1::entry_7> entries(num_entries);
+		uint64_t pos = 0;
+		for(auto& entry : entries) {
+			pos = std::min<uint64_t>(pos + generator() % 3, num_entries - 1024);
+			entry.y = generator();
+			entry.pos = pos;
+			entry.off = 1 + generator() % 1023;
+		}
+		const std::string file_name = prefix + ".p1.table" + std::to_string(i + 1) + ".tmp";
+		if(i < 6) {
+			DiskTable<phase1::tmp_entry_x> table(file_name);
+			for(const auto& entry : entries) {
+				phase1::tmp_entry_x tmp;
+				tmp.pos = entry.pos;
+				tmp.off = entry.off;
+				table.write(tmp);
+			}
+			table.close();
+			out.table[i] = table.get_info();
+		} else {
+			DiskTable<phase1::entry_7> table(file_name);
+			for(const auto& entry : entries) {
+				table.write(entry);
+			}
+			table.close();
+			out.table[i] = table.get_info();
+		}
+	}
+	return out;
+}
+
+template<typename T>
+std::vector<T> read_all(DiskTable<T>& table)
+{
+	std::vector<T> out;
+	Thread<std::pair<std::vector<T>, size_t>> thread(
+		[&out](std::pair<std::vector<T>, size_t>& input) {
+			out.insert(out.end(), input.first.begin(), input.first.end());
+		}, "test/read");
+	table.read(&thread);
+	thread.close();
+	return out;
+}
+
+std::vector<phase2::entry_x> read_all(phase2::DiskSortT& sort)
+{
+	std::vector<phase2::entry_x> out;
+	Thread<std::pair<std::vector<phase2::entry_x>, size_t>> thread(
+		[&out](std::pair<std::vector<phase2::entry_x>, size_t>& input) {
+			if(input.second != out.size()) {
+				throw std::logic_error("block offset mismatch");
+			}
+			out.insert(out.end(), input.first.begin(), input.first.end());
+		}, "test/read");
+	sort.read(&thread, 2);
+	thread.close();
+	return out;
+}
+
+void compare(const phase2::output_t& lhs, const phase2::output_t& rhs)
+{
+	if(lhs.table_7.num_entries != rhs.table_7.num_entries) {
+		throw std::logic_error("table 7 size mismatch");
+	}
+	DiskTable<phase2::entry_7> table_L(lhs.table_7);
+	DiskTable<phase2::entry_7> table_R(rhs.table_7);
+	const auto entries_L = read_all(table_L);
+	const auto entries_R = read_all(table_R);
+	for(size_t i = 0; i < entries_L.size(); ++i) {
+		const auto& L = entries_L[i];
+		const auto& R = entries_R[i];
+		if(L.y != R.y || L.pos != R.pos || L.off != R.off) {
+			throw std::logic_error("table 7 mismatch at " + std::to_string(i));
+		}
+	}
+	for(int64_t i = 0; i < lhs.bitfield_1->size(); ++i) {
+		if(lhs.bitfield_1->get(i) != rhs.bitfield_1->get(i)) {
+			throw std::logic_error("bitfield_1 mismatch at " + std::to_string(i));
+		}
+	}
+	for(int i = 1; i < 6; ++i) {
+		const auto sort_L = read_all(*lhs.sort[i]);
+		const auto sort_R = read_all(*rhs.sort[i]);
+		if(sort_L.size() != sort_R.size()) {
+			throw std::logic_error("table " + std::to_string(i + 1) + " size mismatch");
+		}
+		for(size_t k = 0; k < sort_L.size(); ++k) {
+			const auto& L = sort_L[k];
+			const auto& R = sort_R[k];
+			if(L.key != R.key || L.pos != R.pos || L.off != R.off) {
+				throw std::logic_error("table " + std::to_string(i + 1) + " mismatch at " + std::to_string(k));
+			}
+		}
+	}
+}
+
+
+/*
+ * Runs phase 2 once straight through, and once with a checkpoint which is interrupted
+ * after table <stop> and then resumed from the reloaded manifest. Results need to be identical.
+ */
+int main(int argc, char** argv)
+{
+	const int num_threads = argc > 1 ? atoi(argv[1]) : 4;
+	const int log_num_buckets = argc > 2 ? atoi(argv[2]) : 4;
+	const size_t num_entries = argc > 3 ? atoll(argv[3]) : 100000;
+	const int stop = argc > 4 ? atoi(argv[4]) : 5;
+	
+	phase2::output_t reference;
+	phase2::compute(make_tables("test.ck.ref", num_entries), reference, num_threads, log_num_buckets, "test.ck.ref", "", "");
+	
+	const auto input = make_tables("test.ck", num_entries);
+	{
+		checkpoint_t checkpoint;
+		checkpoint.file_name = "test.ck.manifest";
+		checkpoint.params = input.params;
+		checkpoint.log_num_buckets = log_num_buckets;
+		
+		struct interrupt_t {};
+		std::function<void()> on_save = [&checkpoint, &on_save, stop]() {
+			if(checkpoint.phase == 2 && checkpoint.table == stop) {
+				throw interrupt_t();
+			}
+			checkpoint.after_save(on_save);
+		};
+		checkpoint.after_save(on_save);
+		
+		phase2::output_t out;
+		try {
+			phase2::compute(input, out, num_threads, log_num_buckets, "test.ck", "", "", &checkpoint);
+			throw std::logic_error("phase 2 was not interrupted");
+		} catch(const interrupt_t&) {
+			std::cout << "Interrupted after table " << stop << std::endl;
+		}
+	}
+	
+	checkpoint_t resume;
+	resume.load("test.ck.manifest");
+	if(resume.phase != 2 || resume.table != stop) {
+		throw std::logic_error("manifest: phase " + std::to_string(resume.phase) + ", table " + std::to_string(resume.table));
+	}
+	if(resume.params.plot_name != "test.ck" || resume.log_num_buckets != log_num_buckets) {
+		throw std::logic_error("manifest: params mismatch");
+	}
+	phase2::output_t out;
+	phase2::compute(input, out, num_threads, log_num_buckets, "test.ck", "", "", &resume);
+	
+	compare(reference, out);
+	
+	// phase 3 would delete these
+	for(auto& sort : reference.sort) {
+		if(sort) {
+			sort->close();
+		}
+	}
+	for(auto& sort : out.sort) {
+		if(sort) {
+			sort->set_keep_files(false);
+			sort->close();
+		}
+	}
+	remove_segment(reference.table_7.file_name);
+	remove_segment(out.table_7.file_name);
+	resume.remove();
+	for(int i = 1; i < 7; ++i) {
+		std::remove(("test.ck.p2.bitfield" + std::to_string(i) + ".tmp").c_str());
+	}
+	for(const auto& prefix : {"test.ck", "test.ck.ref"}) {
+		for(int i = 1; i <= 7; ++i) {
+			std::remove((std::string(prefix) + ".p1.table" + std::to_string(i) + ".tmp").c_str());
+		}
+	}
+	
+	std::cout << "Resumed phase 2 is identical" << std::endl;
+	return 0;
+}
@@ -6,12 +6,85 @@
  */
 
 #include <chia/phase1.h>
+#include <chia/phase3.h>
 #include <chia/DiskSort.hpp>
+#include <chia/DiskTable.h>
 
 #include <random>
 #include <iostream>
 
 
+/*
+ * Sorts input with Sort and returns the time in ms, throws if not sorted.
+ */
+template<typename T, typename Key, typename Sort>
+double bench_sort(const std::vector<T>& input, const size_t block_size, const int key_bits)
+{
+	auto copy = input;
+	std::vector<T> data(input.size());
+	std::vector<T> tmp;
+	
+	const auto begin = get_wall_time_micros();
+	for(size_t i = 0; i < data.size(); i += block_size) {
+		Sort{}(copy.data() + i, data.data() + i, std::min(block_size, data.size() - i), key_bits, tmp);
+	}
+	const auto time = (get_wall_time_micros() - begin) / 1000.;
+	
+	for(size_t i = 0; i < data.size(); i += block_size) {
+		const auto end = std::min(i + block_size, data.size());
+		for(size_t k = i + 1; k < end; ++k) {
+			if(Key{}(data[k]) < Key{}(data[k - 1])) {
+				throw std::logic_error("not sorted");
+			}
+		}
+	}
+	return time;
+}
+
+bool equal(const phase1::entry_1& lhs, const phase1::entry_1& rhs) {
+	return lhs.y == rhs.y && lhs.x == rhs.x;
+}
+template<int N>
+bool equal(const phase1::entry_xm<N>& lhs, const phase1::entry_xm<N>& rhs) {
+	return lhs.y == rhs.y && lhs.pos == rhs.pos && lhs.off == rhs.off && lhs.meta == rhs.meta;
+}
+bool equal(const phase2::entry_x& lhs, const phase2::entry_x& rhs) {
+	return lhs.key == rhs.key && lhs.pos == rhs.pos && lhs.off == rhs.off;
+}
+bool equal(const phase3::entry_lp& lhs, const phase3::entry_lp& rhs) {
+	return lhs.point == rhs.point && lhs.key == rhs.key;
+}
+bool equal(const phase3::entry_np& lhs, const phase3::entry_np& rhs) {
+	return lhs.key == rhs.key && lhs.pos == rhs.pos;
+}
+
+/*
+ * Checks that entries survive a round trip through T::write() and the bucket file layout.
+ */
+template<typename T, typename Key>
+void test_layout(const std::vector<T>& input, const int key_size, const int log_num_buckets)
+{
+	typedef bucket_layout_t<T, Key> Layout;
+	const int key_bits = key_size - log_num_buckets;
+	const size_t entry_size = Layout::entry_size(key_bits);
+	
+	for(const auto& entry : input) {
+		uint8_t buf[T::disk_size] = {};
+		T out;
+		if(entry.write(buf) != T::disk_size || out.read(buf) != T::disk_size || !equal(entry, out)) {
+			throw std::logic_error("entry layout mismatch");
+		}
+		Layout::write(entry, buf, key_bits);
+		
+		const uint64_t key_prefix = (Key{}(entry) >> key_bits) << key_bits;
+		Layout::read(out, buf, key_bits, key_prefix);
+		if(!equal(entry, out)) {
+			throw std::logic_error("bucket layout mismatch");
+		}
+	}
+	std::cout << "bucket layout: " << entry_size << " of " << T::disk_size << " bytes" << std::endl;
+}
+
 int main(int argc, char** argv)
 {
 	std::mt19937_64 generator;
@@ -23,12 +96,99 @@ int main(int argc, char** argv)
 //	const size_t num_buckets = size_t(1) << log_num_buckets;
 	const size_t num_threads = 4;
 	
+	if(argc > 3) {
+		g_io_queue_depth = atoi(argv[3]);
+	}
+	const std::string storage_name = argc > 4 ? argv[4] : "uring";
+	
+	std::shared_ptr<Storage> storage;
+	if(storage_name == "striped") {
+		std::vector<StripedStorage::member_t> members(3);
+		for(size_t i = 0; i < members.size(); ++i) {
+			members[i].dir = "stripe_" + std::to_string(i) + "_";
+			members[i].storage = create_storage("uring");
+			members[i].weight = i + 1;
+		}
+		const auto striped = std::make_shared<StripedStorage>("", members);
+		size_t count[3] = {};
+		for(size_t i = 0; i < 48; ++i) {
+			count[striped->get_index("test.sort_bucket_" + std::to_string(i) + ".tmp")]++;
+		}
+		if(!(count[0] < count[1] && count[1] < count[2])) {
+			throw std::logic_error("stripe placement not weighted");
+		}
+		storage = striped;
+	} else {
+		storage = create_storage(storage_name);
+	}
+	
+	std::cout << "io queue depth: " << g_io_queue_depth << ", storage: " << storage->name() << std::endl;
+	
+	if(true) {
+		std::vector<phase1::entry_1> entry_1(1000);
+		std::vector<phase1::entry_4> entry_4(1000);
+		std::vector<phase2::entry_x> entry_x(1000);
+		std::vector<phase3::entry_lp> entry_lp(1000);
+		std::vector<phase3::entry_np> entry_np(1000);
+		
+		for(auto& entry : entry_1) {
+			entry.y = generator() >> (64 - 38);
+			entry.x = generator();
+		}
+		for(auto& entry : entry_4) {
+			entry.y = generator() >> (64 - 38);
+			entry.pos = generator();
+			entry.off = generator() >> (64 - 10);
+			for(auto& byte : entry.meta) {
+				byte = generator();
+			}
+		}
+		for(auto& entry : entry_x) {
+			entry.key = generator();
+			entry.pos = generator();
+			entry.off = generator() >> (64 - 10);
+		}
+		for(auto& entry : entry_lp) {
+			entry.point = generator() >> 1;
+			entry.key = generator();
+		}
+		for(auto& entry : entry_np) {
+			entry.key = generator();
+			entry.pos = generator();
+		}
+		test_layout<phase1::entry_1, phase1::get_y<phase1::entry_1>>(entry_1, 38, log_num_buckets);
+		test_layout<phase1::entry_4, phase1::get_y<phase1::entry_4>>(entry_4, 38, log_num_buckets);
+		test_layout<phase2::entry_x, phase2::get_pos<phase2::entry_x>>(entry_x, 32, log_num_buckets);
+		test_layout<phase3::entry_lp, phase3::get_line_point<phase3::entry_lp>>(entry_lp, 63, log_num_buckets);
+		test_layout<phase3::entry_np, phase3::get_sort_key<phase3::entry_np>>(entry_np, 32, log_num_buckets);
+	}
+	
+	if(true) {
+		typedef phase1::entry_1 T;
+		typedef phase1::get_y<T> Key;
+		
+		// same block size and key bits as DiskSort::read()
+		const int key_bits = test_bits - 2 * log_num_buckets;
+		const size_t block_size = size_t(1) << key_bits;
+		
+		std::vector<T> input(test_size);
+		for(size_t i = 0; i < test_size; ++i) {
+			input[i].y = generator() % block_size;
+			input[i].x = i;
+		}
+		const auto std_time = bench_sort<T, Key, std_sort_t<T, Key>>(input, block_size, key_bits);
+		const auto radix_time = bench_sort<T, Key, radix_sort_t<T, Key>>(input, block_size, key_bits);
+		
+		std::cout << "std_sort_t took " << std_time << " ms, radix_sort_t took " << radix_time
+				<< " ms (" << block_size << " entries per block, " << key_bits << " key bits)" << std::endl;
+	}
+	
 	if(true) {
 		std::cout << "sizeof(phase1::entry_1) = " << sizeof(phase1::entry_1) << std::endl;
 		
-		typedef DiskSort<phase1::entry_1, phase1::get_y<phase1::entry_1>> DiskSort1;
+		typedef phase1::DiskSort1 DiskSort1;
 		
-		DiskSort1 sort(test_bits, log_num_buckets, "test");
+		DiskSort1 sort(test_bits, log_num_buckets, "test", false, storage);
 		
 		const auto add_begin = get_wall_time_micros();
 		for(size_t i = 0; i < test_size; ++i) {
@@ -40,19 +200,60 @@ int main(int argc, char** argv)
 		sort.finish();
 		std::cout << "add() took " << (get_wall_time_micros() - add_begin) / 1000. << " ms" << std::endl;
 		
-		FILE* out = fopen("sorted.out", "wb");
+		uint64_t y_max = 0;
+		size_t num_sorted = 0;
+		DiskTable<phase1::entry_1> out("sorted.out", 0, storage);
 		
 		Thread<std::pair<std::vector<phase1::entry_1>, size_t>> thread(
-			[out](std::pair<std::vector<phase1::entry_1>, size_t>& input) {
+			[&out, &y_max, &num_sorted](std::pair<std::vector<phase1::entry_1>, size_t>& input) {
+				if(input.second != num_sorted) {
+					throw std::logic_error("block offset mismatch");
+				}
 				for(const auto& entry : input.first) {
-					write_entry(out, entry);
+					if(entry.y < y_max) {
+						throw std::logic_error("entry.y < y_max");
+					}
+					y_max = entry.y;
+					out.write(entry);
 				}
+				num_sorted += input.first.size();
 			}, "test_output");
 		
 		const auto sort_begin = get_wall_time_micros();
 		sort.read(&thread, num_threads);
-		fclose(out);
+		thread.close();
+		out.close();
 		std::cout << "sort() took " << (get_wall_time_micros() - sort_begin) / 1000. << " ms" << std::endl;
+		
+		if(num_sorted != test_size) {
+			throw std::logic_error("num_sorted != test_size");
+		}
+		
+		// read back, in order
+		size_t num_read = 0;
+		y_max = 0;
+		Thread<std::pair<std::vector<phase1::entry_1>, size_t>> check(
+			[&y_max, &num_read](std::pair<std::vector<phase1::entry_1>, size_t>& input) {
+				if(input.second != num_read) {
+					throw std::logic_error("table offset mismatch");
+				}
+				for(const auto& entry : input.first) {
+					if(entry.y < y_max) {
+						throw std::logic_error("table entry.y < y_max");
+					}
+					y_max = entry.y;
+				}
+				num_read += input.first.size();
+			}, "test_check");
+		
+		const auto table_begin = get_wall_time_micros();
+		DiskTable<phase1::entry_1>(out.get_info(), storage).read(&check);
+		check.close();
+		std::cout << "DiskTable::read() took " << (get_wall_time_micros() - table_begin) / 1000. << " ms" << std::endl;
+		
+		if(num_read != test_size) {
+			throw std::logic_error("num_read != test_size");
+		}
 	}
 	
 	if(false) {
@@ -88,6 +289,7 @@ int main(int argc, char** argv)
 		
 		const auto sort_begin = get_wall_time_micros();
 		sort.read(&thread, num_threads);
+		thread.close();
 		fclose(out);
 		std::cout << "sort() took " << (get_wall_time_micros() - sort_begin) / 1000. << " ms" << std::endl;
 	}
@@ -0,0 +1,59 @@
+/*
+ * test_f1.cpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <chia/phase1.hpp>
+
+#include "chia_ref/calculate_bucket.hpp"
+
+#include <iostream>
+
+using namespace phase1;
+
+
+int main(int argc, char** argv)
+{
+	const size_t num_blocks = argc > 1 ? atoi(argv[1]) : 4096;
+	
+	uint8_t id[32] = {};
+	for(size_t i = 0; i < sizeof(id); ++i) {
+		id[i] = i + 1;
+	}
+	
+	// compare against the reference F1 at the start, middle and end of the x range
+	const uint64_t offsets[] = {0, 12345, (uint64_t(1) << 28) - num_blocks};
+	
+	F1Calculator F1(id);
+	chia::F1Calculator F1_ref(32, id);
+	
+	std::vector<entry_1> block(num_blocks * 16);
+	
+	for(const auto offset : offsets)
+	{
+		const auto begin = get_wall_time_micros();
+		F1.compute_block(offset, num_blocks, block.data());
+		std::cout << "compute_block() took " << (get_wall_time_micros() - begin) / 1e3 << " ms" << std::endl;
+		
+		uint64_t y_ref[1 << chia::kBatchSizes];
+		for(size_t i = 0; i < block.size(); i += (1 << chia::kBatchSizes))
+		{
+			const uint64_t x_begin = offset * 16 + i;
+			F1_ref.CalculateBuckets(x_begin, 1 << chia::kBatchSizes, y_ref);
+			
+			for(size_t k = 0; k < (1 << chia::kBatchSizes); ++k) {
+				const auto& entry = block[i + k];
+				if(entry.x != x_begin + k || entry.y != y_ref[k]) {
+					std::cout << "Mismatch at x = " << x_begin + k << ": y = " << entry.y
+							<< ", expected " << y_ref[k] << std::endl;
+					return -1;
+				}
+			}
+		}
+	}
+	std::cout << "F1 output matches reference" << std::endl;
+	return 0;
+}
+
+
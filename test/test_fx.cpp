@@ -0,0 +1,119 @@
+/*
+ * test_fx.cpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <chia/phase1.hpp>
+
+#include "chia_ref/calculate_bucket.hpp"
+
+#include <random>
+#include <iostream>
+
+using namespace phase1;
+
+std::mt19937_64 generator;
+
+
+template<typename T>
+void randomize(T& entry)
+{
+	entry.y = generator() % (uint64_t(1) << (32 + kExtraBits));
+	for(auto& byte : entry.meta) {
+		byte = generator();
+	}
+}
+
+template<>
+void randomize(entry_1& entry)
+{
+	entry.y = generator() % (uint64_t(1) << (32 + kExtraBits));
+	entry.x = generator();
+}
+
+template<typename T>
+chia::Bits to_bits(const T& entry)
+{
+	uint8_t meta[16];
+	size_t num_bytes = 0;
+	get_meta<T>{}(entry, meta, &num_bytes);
+	return chia::Bits(meta, num_bytes, num_bytes * 8);
+}
+
+template<typename S>
+bool check_meta(const S& entry, const chia::Bits& C)
+{
+	uint8_t bytes[16] = {};
+	C.ToBytes(bytes);
+	return memcmp(bytes, entry.meta.data(), sizeof(entry.meta)) == 0;
+}
+
+template<>
+bool check_meta(const entry_7& entry, const chia::Bits& C)
+{
+	return true;
+}
+
+template<int R_index, typename T, typename S>
+bool test_table(const size_t count)
+{
+	std::vector<match_t<T>> matches(count);
+	for(auto& match : matches) {
+		randomize(match.left);
+		randomize(match.right);
+		match.pos = generator();
+		match.off = generator() % 1024;
+	}
+	std::vector<S> out(count);
+	
+	const auto begin = get_wall_time_micros();
+	FxCalculator<R_index, T, S> Fx;
+	Fx.evaluate_batch(matches.data(), matches.size(), out.data());
+	const auto time = (get_wall_time_micros() - begin) / 1e3;
+	
+	chia::FxCalculator Fx_ref(32, R_index);
+	for(size_t i = 0; i < count; ++i)
+	{
+		const auto& match = matches[i];
+		const auto& entry = out[i];
+		const auto res = Fx_ref.CalculateBucket(
+				chia::Bits(match.left.y, 32 + kExtraBits), to_bits(match.left), to_bits(match.right));
+		
+		// f7 is truncated to k bits
+		const uint64_t y = res.first.GetValue() >> (R_index == 7 ? kExtraBits : 0);
+		
+		if(entry.y != y || !check_meta(entry, res.second)
+			|| entry.pos != match.pos || entry.off != match.off)
+		{
+			std::cout << "Table " << R_index << ": mismatch at " << i << std::endl;
+			return false;
+		}
+	}
+	std::cout << "Table " << R_index << ": evaluate_batch() took " << time << " ms" << std::endl;
+	return true;
+}
+
+
+int main(int argc, char** argv)
+{
+	const size_t count = argc > 1 ? atoi(argv[1]) : 100000;
+	
+	generator.seed(0);
+	
+	bool ok = true;
+	ok = ok && test_table<2, entry_1, entry_2>(count);
+	ok = ok && test_table<3, entry_2, entry_3>(count);
+	ok = ok && test_table<4, entry_3, entry_4>(count);
+	ok = ok && test_table<5, entry_4, entry_5>(count);
+	ok = ok && test_table<6, entry_5, entry_6>(count);
+	ok = ok && test_table<7, entry_6, entry_7>(count);
+	
+	if(!ok) {
+		return -1;
+	}
+	std::cout << "Fx output matches reference" << std::endl;
+	return 0;
+}
+
+
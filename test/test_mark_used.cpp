@@ -0,0 +1,139 @@
+/*
+ * test_mark_used.cpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <chia/phase2.hpp>
+
+#include <random>
+#include <iostream>
+
+using namespace phase2;
+
+typedef phase1::tmp_entry_x entry_t;
+
+
+/*
+ * Block of entries starting at pos_begin, which are spread over <spread> positions of L.
+ */
+std::vector<entry_t> make_block(std::mt19937_64& generator, const size_t num_entries,
+								const uint64_t pos_begin, const uint64_t spread)
+{
+	std::vector<entry_t> out(num_entries);
+	for(auto& entry : out) {
+		entry.pos = pos_begin + generator() % spread;
+		entry.off = generator() % 1024;
+	}
+	return out;
+}
+
+// how it was done before mark_used()
+void mark_used_ref(	const std::vector<entry_t>& entries, const size_t offset,
+					bitfield* L_used, const bitfield* R_used)
+{
+	for(size_t i = 0; i < entries.size(); ++i) {
+		if(R_used && !R_used->get(offset + i)) {
+			continue;
+		}
+		L_used->set(entries[i].pos);
+		L_used->set(entries[i].pos + entries[i].off);
+	}
+}
+
+void compare(const bitfield& lhs, const bitfield& rhs, const std::string& title)
+{
+	for(int64_t i = 0; i < lhs.size() / 64; ++i) {
+		if(lhs.data()[i] != rhs.data()[i]) {
+			throw std::logic_error(title + ": mismatch at word " + std::to_string(i));
+		}
+	}
+	std::cout << title << " OK" << std::endl;
+}
+
+
+int main(int argc, char** argv)
+{
+	const int num_threads = argc > 1 ? atoi(argv[1]) : 4;
+	const int64_t L_size = (int64_t(1) << 26) + 1000;		// last shard is partial
+	
+	std::mt19937_64 generator(1337);
+	
+	// 1 in 4 entries dropped
+	bitfield R_used(L_size);
+	for(int64_t i = 0; i < L_size; ++i) {
+		if(generator() % 4) {
+			R_used.set(i);
+		}
+	}
+	
+	// [local, scattered as in tables 2-6] x [all entries, filtered by R_used]
+	for(const bool is_scattered : {false, true}) {
+		for(const bitfield* R_filter : {(const bitfield*)nullptr, (const bitfield*)&R_used}) {
+			bitfield L_used(L_size);
+			bitfield L_used_ref(L_size);
+			{
+				Marker marker(&L_used);
+				Marker::Cache cache(&marker);
+				size_t offset = 0;
+				uint64_t pos = 0;
+				for(int k = 0; k < 200; ++k) {
+					const size_t num_entries = 1 + generator() % 4096;
+					const auto entries = is_scattered ?
+							make_block(generator, num_entries, 0, L_size - 1024) :
+							make_block(generator, num_entries, pos, 4 * num_entries);
+					mark_used(entries, offset, cache, R_filter);
+					mark_used_ref(entries, offset, &L_used_ref, R_filter);
+					offset += num_entries;
+					pos = (pos + 2 * num_entries) % (L_size / 2);
+				}
+			}
+			compare(L_used, L_used_ref, std::string(is_scattered ? "scattered" : "local")
+					+ (R_filter ? ", filtered" : ""));
+		}
+	}
+	
+	// all dropped by R_used: nothing to mark
+	{
+		bitfield L_used(L_size);
+		bitfield R_none(L_size);
+		{
+			Marker marker(&L_used);
+			Marker::Cache cache(&marker);
+			mark_used(make_block(generator, 1000, 0, 1000), 0, cache, &R_none);
+		}
+		compare(L_used, bitfield(L_size), "all dropped");
+	}
+	
+	// concurrent, as in compute_table()
+	{
+		std::vector<std::vector<entry_t>> blocks;
+		bitfield L_used(L_size);
+		bitfield L_used_ref(L_size);
+		size_t offset = 0;
+		for(int k = 0; k < 1000; ++k) {
+			const size_t num_entries = 1 + generator() % 4096;
+			blocks.push_back(k % 10 ?
+					make_block(generator, num_entries, (k / 10) * 4096, 8192) :
+					make_block(generator, num_entries, 0, L_size - 1024));
+			mark_used_ref(blocks.back(), offset, &L_used_ref, &R_used);
+			offset += num_entries;
+		}
+		Marker marker(&L_used);
+		UnorderedThreadPool<std::pair<std::vector<entry_t>, size_t>, size_t, std::shared_ptr<Marker::Cache>> pool(
+			[&marker, &R_used](std::pair<std::vector<entry_t>, size_t>& input, size_t&, std::shared_ptr<Marker::Cache>& cache) {
+				if(!cache) {
+					cache = marker.add_cache();
+				}
+				mark_used(input.first, input.second, *cache, &R_used);
+			}, nullptr, num_threads, "test/mark");
+		offset = 0;
+		for(const auto& block : blocks) {
+			pool.take_copy(std::make_pair(block, offset));
+			offset += block.size();
+		}
+		pool.close();
+		compare(L_used, L_used_ref, "concurrent");
+	}
+	return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * test_matcher.cpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <chia/phase1.hpp>
+
+#include <random>
+#include <iostream>
+
+using namespace phase1;
+
+std::mt19937_64 generator;
+
+
+/*
+ * Fills a BC group with random sorted y values, roughly half of them with duplicates.
+ */
+void randomize_group(std::vector<entry_1>& bucket, const uint64_t group, const size_t count)
+{
+	bucket.resize(count);
+	for(auto& entry : bucket) {
+		entry.y = group * kBC + generator() % kBC;
+		entry.x = generator();
+	}
+	if(count && generator() % 2) {
+		for(size_t i = 0; i < count / 16; ++i) {
+			bucket[generator() % count].y = bucket[generator() % count].y;
+		}
+	}
+	std::sort(bucket.begin(), bucket.end(),
+		[](const entry_1& a, const entry_1& b) -> bool { return a.y < b.y; });
+}
+
+bool test_probe(const probe_targets_t probe, const char* name, const size_t num_iter)
+{
+	uint64_t bitmap[FxMatcher<entry_1>::kBitmapWords];
+	uint32_t hits[kExtraBitsPow];
+	uint32_t hits_ref[kExtraBitsPow];
+	
+	for(size_t iter = 0; iter < num_iter; ++iter) {
+		for(auto& word : bitmap) {
+			word = generator() & generator();
+		}
+		const uint32_t r = generator() % kBC;
+		const uint32_t parity = generator() % 2;
+		const int count = probe(bitmap, L_target_sq[parity], r, hits);
+		const int count_ref = probe_targets(bitmap, L_target_sq[parity], r, hits_ref);
+		
+		if(count != count_ref || memcmp(hits, hits_ref, count * sizeof(uint32_t))) {
+			std::cout << "probe_targets_" << name << "(): mismatch at r = " << r << std::endl;
+			return false;
+		}
+	}
+	// with a full bitmap every target is a hit
+	for(auto& word : bitmap) {
+		word = ~uint64_t(0);
+	}
+	for(uint32_t parity = 0; parity < 2; ++parity) {
+		for(uint32_t r = 0; r < kBC; ++r) {
+			if(probe(bitmap, L_target_sq[parity], r, hits) != kExtraBitsPow) {
+				std::cout << "probe_targets_" << name << "(): missing targets at r = " << r << std::endl;
+				return false;
+			}
+			for(int i = 0; i < kExtraBitsPow; ++i) {
+				if(hits[i] != L_targets[parity][r][i]) {
+					std::cout << "probe_targets_" << name << "(): wrong target at r = " << r << std::endl;
+					return false;
+				}
+			}
+		}
+	}
+	std::cout << "probe_targets_" << name << "() matches reference" << std::endl;
+	return true;
+}
+
+/*
+ * Checks that evaluating matches by index gives the same entries as evaluating copies.
+ */
+bool test_eval(const std::vector<std::vector<entry_1>>& groups, const size_t num_groups)
+{
+	FxMatcher<entry_1> matcher;
+	std::vector<match_group_t<entry_1>> input;
+	std::vector<match_idx_t> matches;
+	std::vector<match_t<entry_1>> matches_ref;
+	
+	uint64_t L_offset = 0;
+	for(size_t i = 0; i < num_groups; ++i) {
+		match_group_t<entry_1> group;
+		group.L_offset = L_offset;
+		group.bucket_L = groups[i];
+		group.bucket_R = groups[i + 1];
+		matcher.find_matches(input.size(), group, matches);
+		input.push_back(group);
+		L_offset += groups[i].size();
+	}
+	for(const auto& match : matches) {
+		const auto& group = input[match.group];
+		match_t<entry_1> copy;
+		copy.left = group.bucket_L[match.idx_L];
+		copy.right = group.bucket_R[match.idx_R];
+		copy.pos = group.L_offset + match.idx_L;
+		copy.off = match.idx_R + (group.bucket_L.size() - match.idx_L);
+		matches_ref.push_back(copy);
+	}
+	std::vector<entry_2> out(matches.size());
+	std::vector<entry_2> out_ref(matches.size());
+	
+	FxCalculator<2, entry_1, entry_2> Fx;
+	Fx.evaluate_batch(input.data(), matches.data(), matches.size(), out.data());
+	Fx.evaluate_batch(matches_ref.data(), matches_ref.size(), out_ref.data());
+	
+	for(size_t i = 0; i < out.size(); ++i) {
+		const auto& a = out[i];
+		const auto& b = out_ref[i];
+		if(a.y != b.y || a.pos != b.pos || a.off != b.off || a.meta != b.meta) {
+			std::cout << "evaluate_batch(): mismatch at " << i << std::endl;
+			return false;
+		}
+	}
+	std::cout << "evaluate_batch() by index matches copies (" << out.size() << " entries)" << std::endl;
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	const size_t num_groups = argc > 1 ? atoi(argv[1]) : 100000;
+	
+	generator.seed(0);
+	initialize();
+	
+	bool ok = test_probe(&probe_targets, "scalar", 100000);
+#ifdef PHASE1_MATCH_SIMD
+	if(__builtin_cpu_supports("avx2")) {
+		ok = ok && test_probe(&probe_targets_avx2, "avx2", 100000);
+	}
+	if(__builtin_cpu_supports("avx512f")) {
+		ok = ok && test_probe(&probe_targets_avx512, "avx512", 100000);
+	}
+#endif
+	
+	std::vector<std::vector<entry_1>> groups(num_groups + 1);
+	for(size_t i = 0; i < groups.size(); ++i) {
+		randomize_group(groups[i], i, generator() % 400);
+	}
+	
+	uint16_t idx_L[kBC];
+	uint16_t idx_R[kBC];
+	uint16_t idx_L_ref[kBC];
+	uint16_t idx_R_ref[kBC];
+	FxMatcher<entry_1> matcher;
+	
+	size_t num_matches = 0;
+	double time = 0;
+	double time_ref = 0;
+	for(size_t i = 0; ok && i < num_groups; ++i)
+	{
+		const auto& bucket_L = groups[i];
+		const auto& bucket_R = groups[i + 1];
+		
+		const auto t0 = get_wall_time_micros();
+		const int count = matcher.find_matches_ex(bucket_L, bucket_R, idx_L, idx_R);
+		const auto t1 = get_wall_time_micros();
+		const int count_ref = matcher.find_matches_ex_ref(bucket_L, bucket_R, idx_L_ref, idx_R_ref);
+		const auto t2 = get_wall_time_micros();
+		time += t1 - t0;
+		time_ref += t2 - t1;
+		
+		if(count != count_ref
+			|| memcmp(idx_L, idx_L_ref, count * sizeof(uint16_t))
+			|| memcmp(idx_R, idx_R_ref, count * sizeof(uint16_t)))
+		{
+			std::cout << "find_matches_ex(): mismatch at group " << i
+					<< " (" << count << " vs " << count_ref << " matches)" << std::endl;
+			ok = false;
+		}
+		num_matches += count;
+	}
+	ok = ok && test_eval(groups, std::min<size_t>(num_groups, 1000));
+	
+	if(!ok) {
+		return -1;
+	}
+	std::cout << "find_matches_ex() took " << time / 1e3 << " ms, reference took "
+			<< time_ref / 1e3 << " ms (" << num_matches << " matches)" << std::endl;
+	std::cout << "Matches are identical to reference" << std::endl;
+	return 0;
+}
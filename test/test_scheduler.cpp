@@ -0,0 +1,175 @@
+/*
+ * test_scheduler.cpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <chia/Scheduler.h>
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+
+static void sleep_ms(const int ms) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+static budget_t make_budget(const int threads, const uint64_t memory = 0) {
+	budget_t out;
+	out.threads = threads;
+	out.memory = memory;
+	return out;
+}
+
+static void expect(const bool value, const std::string& what) {
+	if(!value) {
+		throw std::logic_error(what);
+	}
+}
+
+
+int main(int argc, char** argv)
+{
+	const int num_threads = argc > 1 ? atoi(argv[1]) : 4;
+	const int num_parallel = argc > 2 ? atoi(argv[2]) : 3;
+	const int num_plots = argc > 3 ? atoi(argv[3]) : 50;
+	
+	// aborts instead of hanging, if anything below deadlocks
+	std::atomic_bool is_done {false};
+	std::thread watchdog([&is_done]() {
+		for(int i = 0; i < 600 && !is_done; ++i) {
+			sleep_ms(100);
+		}
+		if(!is_done) {
+			std::cout << "Deadlock" << std::endl;
+			std::abort();
+		}
+	});
+	
+	// check() rejects what can never be granted
+	{
+		Scheduler scheduler(make_budget(4));
+		bool is_thrown = false;
+		try {
+			scheduler.check(make_budget(5));
+		} catch(const std::logic_error&) {
+			is_thrown = true;
+		}
+		expect(is_thrown, "check() did not throw");
+		scheduler.check(make_budget(4));
+		Scheduler(budget_t()).check(make_budget(1000, uint64_t(1) << 50));		// unlimited
+	}
+	
+	// acquire() is FIFO: a small request does not overtake a larger one which arrived first
+	{
+		Scheduler scheduler(make_budget(4));
+		scheduler.acquire(make_budget(4));
+		
+		std::mutex mutex;
+		std::vector<int> order;
+		std::thread large([&]() {
+			scheduler.acquire(make_budget(2));
+			std::lock_guard<std::mutex> lock(mutex);
+			order.push_back(2);
+		});
+		sleep_ms(100);
+		std::thread small([&]() {
+			scheduler.acquire(make_budget(1));
+			std::lock_guard<std::mutex> lock(mutex);
+			order.push_back(1);
+		});
+		sleep_ms(100);
+		scheduler.release(make_budget(1));		// small would fit now
+		sleep_ms(100);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			expect(order.empty(), "acquire() was overtaken");
+		}
+		scheduler.release(make_budget(1));
+		large.join();
+		scheduler.release(make_budget(2));
+		small.join();
+		expect(order == std::vector<int>({2, 1}), "acquire() out of order");
+		expect(scheduler.get_used().threads == 3, "used.threads != 3");
+	}
+	
+	// exchange() does not queue behind a waiting acquire(), which needs what it gives back
+	{
+		Scheduler scheduler(make_budget(4));
+		scheduler.acquire(make_budget(3));
+		std::thread waiting([&]() {
+			scheduler.acquire(make_budget(3));
+		});
+		sleep_ms(100);
+		scheduler.exchange(make_budget(3), make_budget(1));
+		waiting.join();
+		expect(scheduler.get_used().threads == 4, "used.threads != 4");
+	}
+	
+	// plots as in chia_plot: phase 1 with full threads, phase 3 with half, next phase 1 in parallel
+	{
+		const int num_threads_3 = std::max(num_threads / 2, 1);
+		const auto budget_1 = make_budget(num_threads, uint64_t(3) << 30);
+		const auto budget_3 = make_budget(num_threads_3, uint64_t(2) << 30);
+		
+		budget_t limit;
+		limit.threads = num_threads + (num_parallel - 1) * num_threads_3;
+		limit.memory = uint64_t(7) << 30;
+		Scheduler scheduler(limit);
+		
+		// what the plots hold by their own count: added after acquiring, subtracted before giving back
+		std::atomic<int> num_done {0};
+		std::atomic<int> held_threads {0};
+		std::atomic<uint64_t> held_memory {0};
+		std::atomic<int> max_threads {0};
+		std::atomic_bool is_fail {false};
+		
+		const auto hold = [&](const budget_t& budget) {
+			const int threads = (held_threads += budget.threads);
+			const uint64_t memory = (held_memory += budget.memory);
+			if(threads > limit.threads || memory > limit.memory) {
+				is_fail = true;
+			}
+			int prev = max_threads;
+			while(threads > prev && !max_threads.compare_exchange_weak(prev, threads));
+		};
+		const auto unhold = [&](const budget_t& budget) {
+			held_threads -= budget.threads;
+			held_memory -= budget.memory;
+		};
+		std::vector<std::thread> slots;
+		for(int slot = 0; slot < num_parallel; ++slot) {
+			slots.emplace_back([&, slot]() {
+				std::mt19937 generator(slot);
+				while(num_done++ < num_plots) {
+					scheduler.acquire(budget_1);
+					hold(budget_1);
+					sleep_ms(generator() % 5);
+					unhold(budget_1);
+					scheduler.exchange(budget_1, budget_3);
+					hold(budget_3);
+					sleep_ms(generator() % 10);
+					unhold(budget_3);
+					scheduler.release(budget_3);
+				}
+			});
+		}
+		for(auto& thread : slots) {
+			thread.join();
+		}
+		expect(!is_fail, "budget exceeded");
+		expect(num_parallel < 2 || max_threads > num_threads, "plots did not overlap");
+		expect(scheduler.get_used().threads == 0 && scheduler.get_used().memory == 0, "budget not released");
+	}
+	
+	is_done = true;
+	watchdog.join();
+	
+	std::cout << "Scheduler OK" << std::endl;
+	return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * test_thread.cpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <chia/Thread.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+
+typedef std::pair<int, uint64_t> item_t;		// [producer, sequence]
+
+static void expect(const bool value, const std::string& what) {
+	if(!value) {
+		throw std::logic_error(what);
+	}
+}
+
+/*
+ * Checks that each producer's items arrive exactly once and in order. [NOT thread-safe]
+ */
+struct checker_t {
+	std::vector<uint64_t> next;
+	
+	checker_t(const int num_producers) : next(num_producers) {}
+	
+	void take(const item_t& item) {
+		if(item.second != next[item.first]) {
+			throw std::logic_error("producer " + std::to_string(item.first) + ": expected "
+					+ std::to_string(next[item.first]) + ", got " + std::to_string(item.second));
+		}
+		next[item.first]++;
+	}
+	
+	void check(const uint64_t count) const {
+		for(size_t i = 0; i < next.size(); ++i) {
+			expect(next[i] == count, "producer " + std::to_string(i) + ": " + std::to_string(next[i]) + " items");
+		}
+	}
+};
+
+void test_ring(const size_t capacity, const int num_producers, const uint64_t count)
+{
+	RingQueue<item_t> queue(capacity);
+	std::vector<std::thread> producers;
+	for(int i = 0; i < num_producers; ++i) {
+		producers.emplace_back([&queue, i, count]() {
+			for(uint64_t k = 0; k < count; ++k) {
+				item_t item(i, k);
+				while(!queue.try_push(item)) {
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+	checker_t checker(num_producers);
+	for(uint64_t k = 0; k < num_producers * count; ++k) {
+		item_t item;
+		while(!queue.try_pop(item)) {
+			std::this_thread::yield();
+		}
+		checker.take(item);
+	}
+	for(auto& thread : producers) {
+		thread.join();
+	}
+	item_t item;
+	expect(!queue.try_pop(item), "queue not empty");
+	checker.check(count);
+}
+
+void test_thread(const int depth, const int num_producers, const uint64_t count)
+{
+	checker_t checker(num_producers);
+	Thread<item_t> thread([&checker](item_t& item) {
+		checker.take(item);
+	}, "", depth);
+	
+	std::vector<std::thread> producers;
+	for(int i = 0; i < num_producers; ++i) {
+		producers.emplace_back([&thread, i, count]() {
+			for(uint64_t k = 0; k < count; ++k) {
+				thread.take_copy(item_t(i, k));
+			}
+		});
+	}
+	for(auto& producer : producers) {
+		producer.join();
+	}
+	thread.close();
+	checker.check(count);
+}
+
+void test_failure(const int depth, const int num_producers, const uint64_t count)
+{
+	uint64_t num_done = 0;
+	Thread<item_t> thread([&num_done](item_t& item) {
+		if(++num_done == 1000) {
+			throw std::runtime_error("test failure");
+		}
+	}, "", depth);
+	
+	// producers keep going, take() needs to return once the thread failed
+	std::vector<std::thread> producers;
+	for(int i = 0; i < num_producers; ++i) {
+		producers.emplace_back([&thread, i, count]() {
+			for(uint64_t k = 0; k < count; ++k) {
+				thread.take_copy(item_t(i, k));
+			}
+		});
+	}
+	for(auto& producer : producers) {
+		producer.join();
+	}
+	bool is_thrown = false;
+	try {
+		thread.close();
+	} catch(const std::runtime_error&) {
+		is_thrown = true;
+	}
+	expect(is_thrown, "close() did not throw");
+	expect(num_done == 1000, "thread continued after failure");
+}
+
+
+int main(int argc, char** argv)
+{
+	const int num_producers = argc > 1 ? atoi(argv[1]) : 4;
+	const uint64_t count = argc > 2 ? atoll(argv[2]) : 20000;
+	
+	// aborts instead of hanging
+	std::atomic_bool is_done {false};
+	std::thread watchdog([&is_done]() {
+		for(int i = 0; i < 1200 && !is_done; ++i) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+		if(!is_done) {
+			std::cout << "Deadlock" << std::endl;
+			std::abort();
+		}
+	});
+	
+	for(const int depth : {1, 2, 4, 16}) {
+		test_ring(depth, num_producers, count);
+		test_thread(depth, num_producers, count);
+		test_thread(depth, 1, count);
+		test_failure(depth, num_producers, count);
+		std::cout << "depth " << depth << " OK" << std::endl;
+	}
+	
+	is_done = true;
+	watchdog.join();
+	return 0;
+}